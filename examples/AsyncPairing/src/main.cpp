@@ -0,0 +1,155 @@
+/**
+ * AsyncPairing/src/main.cpp - Example of a pairing flow written as coroutines
+ *
+ * This example demonstrates BLESecureAsync. Instead of setting flags in
+ * callbacks and polling them in loop(), the pairing flow is one coroutine
+ * that awaits each step and is resumed directly from BLESecure's event
+ * handlers. A second coroutine handles the passkey prompt.
+ *
+ * The device uses IO_CAPABILITY_KEYBOARD_ONLY: the central displays a
+ * passkey that is typed into the Serial Monitor as 'passkey:123456'.
+ *
+ * Needs C++20 coroutines, see build_flags in platformio.ini.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+#include <BLESecureAsync.h>
+
+// Define UUIDs for service and characteristic
+UUID service("9b1f4a01-3c5d-4e2a-8f61-0d2c7e5a9b31");
+UUID characteristicUUID("9b1f4a02-3c5d-4e2a-8f61-0d2c7e5a9b31");
+
+uint16_t char_handle;
+
+// Shows the prompt when the SM asks for a passkey and confirms when it was entered
+BLESecureTask passkeyPrompt(BLEDevice device)
+{
+  if (co_await BLESecureAsync.passkeyRequested(&device) < 0)
+    co_return; // Disconnected before a passkey was needed
+
+  Serial.println("Enter the passkey shown on the central as 'passkey:123456'");
+
+  if (co_await BLESecureAsync.passkeyEntered(&device) >= 0)
+    Serial.println("Passkey handed to the Security Manager");
+}
+
+// The whole secure session setup as one sequence of steps.
+// Coroutines take the BLEDevice by value so it lives in the coroutine frame.
+BLESecureTask secureSession(BLEDevice device)
+{
+  uint32_t start = millis();
+
+  // Bonded peers only need to re-encrypt, everyone else pairs
+  BLEPairingResult result = co_await BLESecureAsync.reencrypt(&device);
+  if (result.status != ERROR_CODE_SUCCESS)
+  {
+    passkeyPrompt(device);
+    result = co_await BLESecureAsync.pair(&device);
+  }
+
+  if (result.status != ERROR_CODE_SUCCESS)
+  {
+    Serial.print("Could not secure the link, status: ");
+    Serial.println(result.status);
+    co_return;
+  }
+
+  Serial.print(result.reencryption ? "Re-encrypted" : "Paired");
+  Serial.print(" in ");
+  Serial.print(millis() - start);
+  Serial.print(" ms, key size: ");
+  Serial.print(result.keySize);
+  Serial.print(", MITM: ");
+  Serial.println(result.authenticated ? "yes" : "no");
+
+  // Continue with application steps that need the secured link here
+  Serial.println("Protected characteristic is now accessible");
+}
+
+void bleDeviceConnected(BLEStatus status, BLEDevice *device)
+{
+  if (status != BLE_STATUS_OK)
+    return;
+
+  Serial.println("Device connected!");
+
+  // The coroutine runs until its first co_await and returns here
+  if (!secureSession(*device).started())
+    Serial.println("No free coroutine frame, increase BLESECURE_ASYNC_FRAMES");
+}
+
+void bleDeviceDisconnected(BLEDevice *device)
+{
+  Serial.println("Device disconnected!");
+  BTstack.startAdvertising();
+}
+
+int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  if (characteristic_id == char_handle)
+  {
+    Serial.print("Received protected data: ");
+    for (int i = 0; i < buffer_size; i++)
+    {
+      Serial.print((char)buffer[i]);
+    }
+    Serial.println();
+  }
+  return 0;
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE Async Pairing Example");
+
+  // Set device name
+  BTstack.setup("AsyncSecBLE");
+
+  // Passkey entry: MITM protection with a keyboard-only peripheral
+  BLESecure.begin(IO_CAPABILITY_KEYBOARD_ONLY);
+  BLESecure.setSecurityLevel(SECURITY_HIGH, true);
+
+  // The coroutine requests pairing itself
+  BLESecure.requestPairingOnConnect(false);
+
+  // Route pairing steps to waiting coroutines
+  BLESecureAsync.begin();
+
+  BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
+  BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
+
+  // Add service and characteristic
+  BTstack.addGATTService(&service);
+  char_handle = BTstack.addGATTCharacteristicDynamic(&characteristicUUID, ATT_PROPERTY_WRITE, 0);
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_HIGH);
+
+  // Start advertising
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections...");
+}
+
+void loop()
+{
+  // Read serial input for passkey entry, this resumes passkeyPrompt()
+  if (Serial.available())
+  {
+    String input = Serial.readStringUntil('\n');
+    if (input.startsWith("passkey:"))
+    {
+      uint32_t passkey = input.substring(8).toInt();
+      BLESecure.setEnteredPasskey(passkey);
+    }
+  }
+
+  // Process BLE events
+  BTstack.loop();
+}
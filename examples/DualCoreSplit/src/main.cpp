@@ -0,0 +1,301 @@
+/**
+ * DualCoreSplit/src/main.cpp - Example of BLESecure on core0 and the application on core1
+ *
+ * This example demonstrates BLESecureDualCore. BTstack and BLESecure run on
+ * core0, a simulated sensor fusion workload keeps one core 100% busy, and
+ * security events reach core1 through lock-free rings.
+ *
+ * Two placements of the workload can be compared at runtime:
+ *   'mode:single'  fusion runs in loop() on core0, next to BTstack
+ *   'mode:dual'    fusion runs in loop1() on core1, core0 only serves BTstack
+ *
+ * Two latencies on the stack core are collected in histograms:
+ *   - BTstack timer lateness: a 10 ms BTstack timer records how late it fires
+ *   - Write handling: time from a GATT write in the BTstack context until
+ *     loop() on core0 handles it
+ * Write repeatedly from a central (e.g. nRF Connect), switch modes in the
+ * Serial Monitor and print the distributions with 'report'.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+#include <BLESecureDualCore.h>
+
+// Define UUIDs for service and characteristic
+UUID service("8e2d4f01-3a6c-4b9e-b527-6d1f0a3c9e84");
+UUID characteristicUUID("8e2d4f02-3a6c-4b9e-b527-6d1f0a3c9e84");
+
+uint16_t char_handle;
+
+// One fusion step, the workload runs these back to back
+#define FUSION_STEP_US 20000
+
+// Period of the BTstack timer whose lateness is measured
+#define PROBE_TIMER_MS 10
+
+// Where the fusion workload runs, switched from the Serial Monitor
+volatile bool dualCore = true;
+
+// Set in the GATT write callback (BTstack context), consumed by loop() on core0
+volatile bool writePending = false;
+volatile uint32_t writeReceivedUs = 0;
+
+// Latency histogram, upper bucket bounds in microseconds
+const uint32_t bucketLimitsUs[] = {100, 500, 1000, 2000, 5000, 10000, 20000};
+const int bucketCount = sizeof(bucketLimitsUs) / sizeof(bucketLimitsUs[0]) + 1;
+
+typedef struct
+{
+  uint32_t buckets[bucketCount];
+  uint32_t samples;
+  uint32_t maxUs;
+  uint64_t totalUs;
+} LatencyHistogram;
+
+// [0] = single core, [1] = dual core
+LatencyHistogram timerHistogram[2];
+LatencyHistogram writeHistogram[2];
+
+btstack_timer_source_t probeTimer;
+uint32_t probeDueUs = 0;
+
+// Fused orientation, only there so the compiler cannot drop the work
+volatile float fusedAngle = 0.0f;
+
+void recordLatency(LatencyHistogram &histogram, uint32_t latencyUs)
+{
+  int bucket = 0;
+  while (bucket < bucketCount - 1 && latencyUs >= bucketLimitsUs[bucket])
+    bucket++;
+
+  histogram.buckets[bucket]++;
+  histogram.samples++;
+  histogram.totalUs += latencyUs;
+  if (latencyUs > histogram.maxUs)
+    histogram.maxUs = latencyUs;
+}
+
+void printHistogram(const char *name, const LatencyHistogram &histogram)
+{
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(histogram.samples);
+  Serial.print(" samples");
+  if (histogram.samples == 0)
+  {
+    Serial.println();
+    return;
+  }
+
+  Serial.print(", mean ");
+  Serial.print((uint32_t)(histogram.totalUs / histogram.samples));
+  Serial.print(" us, max ");
+  Serial.print(histogram.maxUs);
+  Serial.println(" us");
+
+  for (int i = 0; i < bucketCount; i++)
+  {
+    if (i < bucketCount - 1)
+    {
+      Serial.print("  < ");
+      Serial.print(bucketLimitsUs[i]);
+    }
+    else
+    {
+      Serial.print("  >= ");
+      Serial.print(bucketLimitsUs[i - 1]);
+    }
+    Serial.print(" us: ");
+    Serial.println(histogram.buckets[i]);
+  }
+}
+
+void printReport()
+{
+  printHistogram("Timer lateness, fusion on core0", timerHistogram[0]);
+  printHistogram("Timer lateness, fusion on core1", timerHistogram[1]);
+  printHistogram("Write handling, fusion on core0", writeHistogram[0]);
+  printHistogram("Write handling, fusion on core1", writeHistogram[1]);
+
+  BLEDualCoreStats stats = BLESecureDualCore.getStats();
+  Serial.print("Rings: ");
+  Serial.print(stats.eventsPosted);
+  Serial.print(" events posted, ");
+  Serial.print(stats.eventsDropped);
+  Serial.print(" dropped, max event latency ");
+  Serial.print(stats.maxEventLatencyUs);
+  Serial.print(" us, ");
+  Serial.print(stats.commandsExecuted);
+  Serial.print(" commands, max command latency ");
+  Serial.print(stats.maxCommandLatencyUs);
+  Serial.println(" us");
+}
+
+// Stand-in for a complementary filter over a batch of IMU samples
+void fusionStep()
+{
+  uint32_t start = time_us_32();
+  float angle = fusedAngle;
+  float gyro = 0.01f;
+  while (time_us_32() - start < FUSION_STEP_US)
+  {
+    float accel = sinf(angle) * 0.5f;
+    angle = 0.98f * (angle + gyro * 0.001f) + 0.02f * accel;
+  }
+  fusedAngle = angle;
+}
+
+void probeTimerHandler(btstack_timer_source_t *ts)
+{
+  uint32_t now = time_us_32();
+  recordLatency(timerHistogram[dualCore ? 1 : 0], now - probeDueUs);
+
+  probeDueUs = now + PROBE_TIMER_MS * 1000;
+  btstack_run_loop_set_timer(ts, PROBE_TIMER_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  // Only timestamp here, the work happens in loop() like in a real application
+  if (characteristic_id == char_handle)
+  {
+    writeReceivedUs = time_us_32();
+    writePending = true;
+  }
+  return 0;
+}
+
+// The stack core's reaction to a write, runs in loop()
+void handlePendingWrite()
+{
+  if (!writePending)
+    return;
+
+  uint32_t latency = time_us_32() - writeReceivedUs;
+  writePending = false;
+  recordLatency(writeHistogram[dualCore ? 1 : 0], latency);
+}
+
+void handleSerial()
+{
+  if (!Serial.available())
+    return;
+
+  String input = Serial.readStringUntil('\n');
+  if (input.startsWith("mode:single"))
+  {
+    dualCore = false;
+    Serial.println("Fusion on core0, next to BTstack");
+  }
+  else if (input.startsWith("mode:dual"))
+  {
+    dualCore = true;
+    Serial.println("Fusion on core1, core0 serves BTstack only");
+  }
+  else if (input.startsWith("report"))
+  {
+    printReport();
+  }
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE Dual-Core Split Example");
+
+  // Set device name
+  BTstack.setup("DualCoreBLE");
+
+  // Just Works pairing, the measurement does not depend on the security level
+  BLESecure.begin(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+  BLESecure.setSecurityLevel(SECURITY_MEDIUM, true);
+  BLESecure.requestPairingOnConnect(true);
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
+  BLESecure.enableFastReconnect(true);
+
+  // Pins BLESecure to this core and takes over its callbacks
+  BLESecureDualCore.begin();
+
+  // Add service and characteristic
+  BTstack.addGATTService(&service);
+  char_handle = BTstack.addGATTCharacteristicDynamic(&characteristicUUID, ATT_PROPERTY_WRITE | ATT_PROPERTY_WRITE_WITHOUT_RESPONSE, 0);
+
+  // Start the lateness probe
+  {
+    BluetoothLock b;
+    probeDueUs = time_us_32() + PROBE_TIMER_MS * 1000;
+    btstack_run_loop_set_timer_handler(&probeTimer, probeTimerHandler);
+    btstack_run_loop_set_timer(&probeTimer, PROBE_TIMER_MS);
+    btstack_run_loop_add_timer(&probeTimer);
+  }
+
+  // Start advertising
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections... ('mode:single', 'mode:dual', 'report')");
+}
+
+// core0: BTstack, BLESecure and, in single-core mode, the fusion workload
+void loop()
+{
+  handlePendingWrite();
+  handleSerial();
+
+  if (dualCore)
+  {
+    // Nothing else on this core, sleep until BTstack or core1 needs us
+    BLESecure.waitForEvent(100);
+    BLESecureDualCore.poll();
+  }
+  else
+  {
+    BTstack.loop();
+    BLESecureDualCore.poll();
+    fusionStep();
+  }
+}
+
+void setup1()
+{
+}
+
+// core1: security events and, in dual-core mode, the fusion workload
+void loop1()
+{
+  BLESecurityEvent event;
+  while (BLESecureDualCore.receiveEvent(&event))
+  {
+    switch (event.type)
+    {
+    case SECURITY_EVENT_CONNECTED:
+      if (event.status == BLE_STATUS_OK)
+        Serial.println("Device connected!");
+      break;
+
+    case SECURITY_EVENT_DISCONNECTED:
+      // Fast reconnect advertising restarts on core0, core1 never calls BTstack
+      Serial.println("Device disconnected!");
+      break;
+
+    case SECURITY_EVENT_PAIRING_RESULT:
+      Serial.print("Pairing finished in ");
+      Serial.print(event.result.elapsedMs);
+      Serial.println(" ms");
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  if (dualCore)
+    fusionStep();
+  else
+    delay(1);
+}
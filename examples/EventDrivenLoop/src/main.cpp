@@ -0,0 +1,233 @@
+/**
+ * EventDrivenLoop/src/main.cpp - Example of an event-driven loop without delay() polling
+ *
+ * This example demonstrates BLESecure.waitForEvent(). Instead of
+ * `BTstack.loop(); delay(10);` the loop sleeps in WFE until BLESecure sees a
+ * BTstack event (connection, SM, GATT access) or the timeout for periodic
+ * application work passes.
+ *
+ * To compare both styles, every write to the characteristic is timestamped
+ * in the GATT write callback and handled later in loop(). The time between
+ * the two is collected in a histogram. Write repeatedly from a central
+ * (e.g. nRF Connect), switch modes in the Serial Monitor with 'mode:poll'
+ * and 'mode:event', and print the distribution with 'report'.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+
+// Define UUIDs for service and characteristic
+UUID service("5c3e7a01-8d2f-4b6a-9e41-2f0b6c8d1a57");
+UUID characteristicUUID("5c3e7a02-8d2f-4b6a-9e41-2f0b6c8d1a57");
+
+uint16_t char_handle;
+
+// Periodic application work in event mode, bounds how long waitForEvent() sleeps
+#define APP_WORK_INTERVAL_MS 100
+
+// Polling interval of the classic loop
+#define POLL_DELAY_MS 10
+
+bool eventDriven = true;
+
+// Set in the GATT write callback (BTstack context), consumed by loop()
+volatile bool writePending = false;
+volatile uint32_t writeReceivedUs = 0;
+
+// Latency histogram, upper bucket bounds in microseconds
+const uint32_t bucketLimitsUs[] = {100, 500, 1000, 2000, 5000, 10000, 20000};
+const int bucketCount = sizeof(bucketLimitsUs) / sizeof(bucketLimitsUs[0]) + 1;
+
+typedef struct
+{
+  uint32_t buckets[bucketCount];
+  uint32_t samples;
+  uint32_t maxUs;
+  uint64_t totalUs;
+} LatencyHistogram;
+
+LatencyHistogram pollHistogram;
+LatencyHistogram eventHistogram;
+
+void recordLatency(LatencyHistogram &histogram, uint32_t latencyUs)
+{
+  int bucket = 0;
+  while (bucket < bucketCount - 1 && latencyUs >= bucketLimitsUs[bucket])
+    bucket++;
+
+  histogram.buckets[bucket]++;
+  histogram.samples++;
+  histogram.totalUs += latencyUs;
+  if (latencyUs > histogram.maxUs)
+    histogram.maxUs = latencyUs;
+}
+
+void printHistogram(const char *name, const LatencyHistogram &histogram)
+{
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(histogram.samples);
+  Serial.print(" samples");
+  if (histogram.samples == 0)
+  {
+    Serial.println();
+    return;
+  }
+
+  Serial.print(", mean ");
+  Serial.print((uint32_t)(histogram.totalUs / histogram.samples));
+  Serial.print(" us, max ");
+  Serial.print(histogram.maxUs);
+  Serial.println(" us");
+
+  for (int i = 0; i < bucketCount; i++)
+  {
+    if (i < bucketCount - 1)
+    {
+      Serial.print("  < ");
+      Serial.print(bucketLimitsUs[i]);
+    }
+    else
+    {
+      Serial.print("  >= ");
+      Serial.print(bucketLimitsUs[i - 1]);
+    }
+    Serial.print(" us: ");
+    Serial.println(histogram.buckets[i]);
+  }
+}
+
+void printReport()
+{
+  printHistogram("Polling loop (delay 10 ms)", pollHistogram);
+  printHistogram("Event-driven loop", eventHistogram);
+
+  BLEEventWaitStats stats = BLESecure.getEventWaitStats();
+  Serial.print("waitForEvent: ");
+  Serial.print(stats.wakeups);
+  Serial.print(" wakeups, ");
+  Serial.print(stats.timeouts);
+  Serial.print(" timeouts, max latency ");
+  Serial.print(stats.maxLatencyUs);
+  Serial.println(" us");
+}
+
+void bleDeviceConnected(BLEStatus status, BLEDevice *device)
+{
+  if (status == BLE_STATUS_OK)
+  {
+    Serial.println("Device connected!");
+  }
+}
+
+void bleDeviceDisconnected(BLEDevice *device)
+{
+  Serial.println("Device disconnected!");
+  BTstack.startAdvertising();
+}
+
+int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  // Only timestamp here, the work happens in loop() like in a real application
+  if (characteristic_id == char_handle)
+  {
+    writeReceivedUs = time_us_32();
+    writePending = true;
+  }
+  return 0;
+}
+
+// The application's reaction to a write, runs in loop()
+void handlePendingWrite()
+{
+  if (!writePending)
+    return;
+
+  uint32_t latency = time_us_32() - writeReceivedUs;
+  writePending = false;
+  recordLatency(eventDriven ? eventHistogram : pollHistogram, latency);
+}
+
+void handleSerial()
+{
+  if (!Serial.available())
+    return;
+
+  String input = Serial.readStringUntil('\n');
+  if (input.startsWith("mode:poll"))
+  {
+    eventDriven = false;
+    Serial.println("Polling loop with delay(10)");
+  }
+  else if (input.startsWith("mode:event"))
+  {
+    eventDriven = true;
+    Serial.println("Event-driven loop with waitForEvent()");
+  }
+  else if (input.startsWith("report"))
+  {
+    printReport();
+  }
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE Event-Driven Loop Example");
+
+  pinMode(LED_BUILTIN, OUTPUT);
+
+  // Set device name
+  BTstack.setup("EventLoopBLE");
+
+  // Just Works pairing, the measurement does not depend on the security level
+  BLESecure.begin(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+  BLESecure.setSecurityLevel(SECURITY_MEDIUM, true);
+  BLESecure.requestPairingOnConnect(true);
+
+  BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
+  BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
+
+  // Add service and characteristic
+  BTstack.addGATTService(&service);
+  char_handle = BTstack.addGATTCharacteristicDynamic(&characteristicUUID, ATT_PROPERTY_WRITE | ATT_PROPERTY_WRITE_WITHOUT_RESPONSE, 0);
+
+  // Start advertising
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections... ('mode:poll', 'mode:event', 'report')");
+}
+
+void loop()
+{
+  static unsigned long lastWork = 0;
+
+  // Process BLE events
+  BTstack.loop();
+
+  handlePendingWrite();
+  handleSerial();
+
+  // Periodic application work, here a heartbeat LED
+  if (millis() - lastWork >= APP_WORK_INTERVAL_MS)
+  {
+    digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN));
+    lastWork = millis();
+  }
+
+  if (eventDriven)
+  {
+    // Sleep until BTstack has something for us, but no longer than the next app work
+    BLESecure.waitForEvent(APP_WORK_INTERVAL_MS);
+  }
+  else
+  {
+    delay(POLL_DELAY_MS);
+  }
+}
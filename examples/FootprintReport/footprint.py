@@ -0,0 +1,202 @@
+"""
+footprint.py - Static RAM and flash used by pico-ble-secure, by feature
+
+PlatformIO extra script. Links with a map file and a cross reference table
+and adds the "footprint" target:
+
+    pio run -e minimal -t footprint
+
+Every input section the linker kept is attributed to the library source it
+came from, and across sources to a feature: the SMEVENTCB machinery
+(std::function slots and their handlers), callback registration and
+dispatch, and logging strings. Library objects that reference malloc or
+operator new are listed as heap users. With BLESECURE_NO_HEAP=1 in
+build_flags the build fails if there are any.
+"""
+
+import re
+from os.path import join
+
+Import("env")
+
+MAP_FILE = join(env.subst("$BUILD_DIR"), "firmware.map")
+
+# Mangled names keep the cross reference table one symbol per token
+env.Append(LINKFLAGS=["-Wl,-Map," + MAP_FILE, "-Wl,--cref", "-Wl,--no-demangle"])
+
+LIBRARY_OBJECT = re.compile(r"(BLESecure\w*)\.cpp\.o\)?$")
+
+# First match wins, the SMEVENTCB slots also have "callback" in their names
+FEATURES = [
+    ("SMEVENTCB machinery", re.compile(r"_BLESECURECB|_Function_handler|_Function_base|_M_manager|bad_function_call")),
+    ("Callbacks", re.compile(r"[Cc]allback|callPlain")),
+    ("Logging strings", re.compile(r"^\.rodata\.str")),
+]
+
+HEAP_SYMBOLS = re.compile(r"^(malloc|calloc|realloc|strdup|_malloc_r|_calloc_r|_realloc_r|_Znwj|_Znaj)(RKSt9nothrow_t)?$")
+
+
+def memory_of(section):
+    """Return (flash, ram) flags for an input section, None if it is not loaded"""
+    if section.startswith((".bss", "COMMON", ".uninitialized_data")):
+        return (False, True)
+    if section.startswith((".data", ".time_critical")):
+        return (True, True)
+    if section.startswith((".text", ".rodata", ".ARM.extab", ".ARM.exidx", ".init_array", ".fini_array")):
+        return (True, False)
+    return None
+
+
+def parse_map(path):
+    """Kept input sections of library objects as (section, size, module)"""
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    try:
+        start = lines.index("Linker script and memory map")
+    except ValueError:
+        start = 0
+
+    sections = []
+    pending = None
+
+    def add(section, size, obj):
+        match = LIBRARY_OBJECT.search(obj.strip())
+        if match and size:
+            sections.append((section, size, match.group(1)))
+
+    for line in lines[start:]:
+        if line.startswith("Cross Reference Table"):
+            break
+
+        # " .text.name  0xaddr  0xsize  object" or the name alone when it is long
+        match = re.match(r"^ (\S+)\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if match:
+            add(match.group(1), int(match.group(2), 16), match.group(3))
+            pending = None
+            continue
+
+        match = re.match(r"^ (\S+)$", line)
+        if match:
+            pending = match.group(1)
+            continue
+
+        match = re.match(r"^\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$", line)
+        if match and pending:
+            add(pending, int(match.group(1), 16), match.group(2))
+        pending = None
+
+    return sections
+
+
+def heap_users(path):
+    """Library modules that reference an allocator, with the symbols"""
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    users = {}
+    in_cref = False
+    symbol = None
+    files = 0
+    for line in lines:
+        if line.startswith("Cross Reference Table"):
+            in_cref = True
+            continue
+        if not in_cref or not line.strip() or line.startswith("Symbol"):
+            continue
+
+        # A symbol starts in the first column, the first file defines it, the others reference it
+        if not line[0].isspace():
+            parts = line.split(None, 1)
+            symbol = parts[0]
+            files = len(parts) - 1
+            continue
+
+        files += 1
+        if files == 1 or symbol is None or not HEAP_SYMBOLS.match(symbol):
+            continue
+        match = LIBRARY_OBJECT.search(line.strip())
+        if match:
+            users.setdefault(match.group(1), set()).add(symbol)
+
+    return users
+
+
+def no_heap_enabled():
+    for define in env.get("CPPDEFINES", []):
+        if isinstance(define, (tuple, list)):
+            name, value = define[0], str(define[1]) if len(define) > 1 else "1"
+        else:
+            name, _, value = str(define).partition("=")
+            value = value or "1"
+        if name == "BLESECURE_NO_HEAP":
+            return value != "0"
+    return False
+
+
+def print_table(title, rows):
+    print("%-28s %8s %8s" % (title, "Flash", "RAM"))
+    for name, (flash, ram) in rows:
+        print("%-28s %8d %8d" % (name, flash, ram))
+    print("")
+
+
+def report(target, source, env):
+    sections = parse_map(MAP_FILE)
+
+    modules = {}
+    features = dict((name, [0, 0]) for name, _ in FEATURES)
+    total = [0, 0]
+    for section, size, module in sections:
+        memory = memory_of(section)
+        if memory is None:
+            continue
+        sizes = modules.setdefault(module, [0, 0])
+        for i in range(2):
+            if memory[i]:
+                sizes[i] += size
+                total[i] += size
+        for name, pattern in FEATURES:
+            if pattern.search(section):
+                for i in range(2):
+                    if memory[i]:
+                        features[name][i] += size
+                break
+
+    print("")
+    print("pico-ble-secure footprint (%s)" % env.subst("$PIOENV"))
+    print("")
+    print_table("Module", sorted(modules.items(), key=lambda item: -item[1][0]) + [("Library total", total)])
+    print_table("Feature", [(name, features[name]) for name, _ in FEATURES])
+
+    users = heap_users(MAP_FILE)
+    if users:
+        print("Heap users:")
+        for module in sorted(users):
+            print("  %s: %s" % (module, ", ".join(sorted(users[module]))))
+    else:
+        print("Heap users: none")
+    print("")
+    return 0
+
+
+def check_heap(target, source, env):
+    users = heap_users(MAP_FILE)
+    if not users:
+        return 0
+    print("BLESECURE_NO_HEAP: library objects reference the heap")
+    for module in sorted(users):
+        print("  %s: %s" % (module, ", ".join(sorted(users[module]))))
+    return 1
+
+
+if no_heap_enabled():
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_heap)
+
+env.AddCustomTarget(
+    name="footprint",
+    dependencies="$BUILD_DIR/${PROGNAME}.elf",
+    actions=report,
+    title="Footprint",
+    description="Static RAM and flash of pico-ble-secure by feature",
+)
@@ -0,0 +1,123 @@
+/**
+ * FootprintReport/src/main.cpp - Sketch measured by the footprint report
+ *
+ * This example is built rather than run. Each environment in platformio.ini
+ * links a different set of BLESecure features into the same peripheral:
+ *
+ *   baseline   BTstack only, no BLESecure
+ *   minimal    begin() and a security level
+ *   fixed      the same security set up with BLESecureFixed instead
+ *   callbacks  every pairing and connection callback registered
+ *   full       callbacks, diagnostics service, persistent statistics, profilers
+ *   noheap     callbacks with BLESECURE_NO_HEAP=1, fails if the library allocates
+ *
+ * `pio run -e <env> -t footprint` prints the library's static RAM and flash
+ * by source file and by feature. The firmware totals of two environments,
+ * printed by `pio run`, give the cost of the features in between.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+
+#ifndef FOOTPRINT_BASELINE
+#include <BLESecure.h>
+#endif
+
+#ifdef FOOTPRINT_FIXED
+#include <BLESecurePolicy.h>
+
+using FootprintSecurity = BLESecureFixed<BLESecurityPolicy<SECURITY_HIGH, true, IO_CAPABILITY_DISPLAY_YES_NO>>;
+#endif
+
+#ifdef FOOTPRINT_FULL
+#include <BLESecureDiagnostics.h>
+#include <BLESecureStatsStore.h>
+#endif
+
+// Define UUIDs for service and characteristic
+UUID service("2b7e4c10-6a1d-4f3e-8c95-0d4a7b1e3f60");
+UUID characteristicUUID("2b7e4c11-6a1d-4f3e-8c95-0d4a7b1e3f60");
+
+#ifdef FOOTPRINT_CALLBACKS
+void passkeyDisplay(uint32_t passkey)
+{
+  Serial.println(passkey);
+}
+
+void passkeyEntry()
+{
+  BLESecure.setEnteredPasskey(123456);
+}
+
+void numericComparison(uint32_t passkey, BLEDevice *device)
+{
+  BLESecure.acceptNumericComparison(true);
+}
+
+void pairingStatus(BLEPairingStatus status, BLEDevice *device)
+{
+  Serial.println(status);
+}
+
+void pairingResult(const BLEPairingResult &result, BLEDevice *device)
+{
+  Serial.println(result.elapsedMs);
+}
+
+void deviceConnected(BLEStatus status, BLEDevice *device)
+{
+  Serial.println(status);
+}
+
+void deviceDisconnected(BLEDevice *device)
+{
+  BTstack.startAdvertising();
+}
+#endif
+
+void setup()
+{
+  Serial.begin(115200);
+
+  BTstack.setup("FootprintBLE");
+
+#if defined(FOOTPRINT_FIXED)
+  FootprintSecurity::begin();
+#elif !defined(FOOTPRINT_BASELINE)
+  BLESecure.begin(IO_CAPABILITY_DISPLAY_YES_NO);
+  BLESecure.setSecurityLevel(SECURITY_HIGH, true);
+#endif
+
+#ifdef FOOTPRINT_CALLBACKS
+  BLESecure.setPasskeyDisplayCallback(passkeyDisplay);
+  BLESecure.setPasskeyEntryCallback(passkeyEntry);
+  BLESecure.setNumericComparisonCallback(numericComparison);
+  BLESecure.setPairingStatusCallback(pairingStatus);
+  BLESecure.setPairingResultCallback(pairingResult);
+  BLESecure.setBLEDeviceConnectedCallback(deviceConnected);
+  BLESecure.setBLEDeviceDisconnectedCallback(deviceDisconnected);
+#endif
+
+  BTstack.addGATTService(&service);
+  BTstack.addGATTCharacteristic(&characteristicUUID, ATT_PROPERTY_READ, "footprint");
+
+#ifdef FOOTPRINT_FULL
+  BLESecureDiagnostics.begin();
+  BLESecureStatsStore.begin();
+#endif
+
+  BTstack.startAdvertising();
+}
+
+void loop()
+{
+  BTstack.loop();
+
+#ifdef FOOTPRINT_FULL
+  BLESecureStatsStore.poll();
+#endif
+
+  delay(10);
+}
@@ -0,0 +1,159 @@
+/**
+ * FreeRTOSSecurity/src/main.cpp - Example of BLESecure under FreeRTOS
+ *
+ * This example demonstrates BLESecureRTOS. BLESecure is driven by its own
+ * high-priority owner task. A low-priority application task receives the
+ * security events from a queue, and loop() posts commands from the Serial
+ * Monitor. Neither of them calls BLESecure or takes BluetoothLock directly.
+ *
+ * Serial commands:
+ *   'yes' / 'no'  answer a numeric comparison
+ *   'unbond'      remove the bond of the connected device
+ *   'clear'       remove all bonds
+ *
+ * For the Raspberry Pi Pico with arduino-pico core and FreeRTOS enabled.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+#include <BLESecureRTOS.h>
+
+// Define UUIDs for service and characteristic
+UUID service("b4a61e01-7c93-4d2f-a815-3e9d0c6f2b48");
+UUID characteristicUUID("b4a61e02-7c93-4d2f-a815-3e9d0c6f2b48");
+
+uint16_t char_handle;
+
+// Written by the application task, read by loop()
+volatile hci_con_handle_t connectedHandle = HCI_CON_HANDLE_INVALID;
+
+// Receives security events at low priority, slow work here never delays the stack
+void securityEventTask(void *param)
+{
+  BLESecurityEvent event;
+
+  for (;;)
+  {
+    if (!BLESecureRTOS.receiveEvent(&event, portMAX_DELAY))
+      continue;
+
+    switch (event.type)
+    {
+    case SECURITY_EVENT_CONNECTED:
+      if (event.status == BLE_STATUS_OK)
+      {
+        connectedHandle = event.handle;
+        Serial.println("Device connected!");
+      }
+      break;
+
+    case SECURITY_EVENT_DISCONNECTED:
+      connectedHandle = HCI_CON_HANDLE_INVALID;
+      Serial.println("Device disconnected!");
+      break;
+
+    case SECURITY_EVENT_PASSKEY_DISPLAY:
+      Serial.print("Passkey: ");
+      Serial.println(event.passkey);
+      break;
+
+    case SECURITY_EVENT_PASSKEY_REQUEST:
+      Serial.println("Passkey entry is not supported by this example");
+      break;
+
+    case SECURITY_EVENT_NUMERIC_COMPARISON:
+      Serial.print("Does the central show ");
+      Serial.print(event.passkey);
+      Serial.println("? Answer 'yes' or 'no'");
+      break;
+
+    case SECURITY_EVENT_PAIRING_STATUS:
+      if (event.status == PAIRING_FAILED)
+        Serial.println("Pairing failed");
+      break;
+
+    case SECURITY_EVENT_PAIRING_RESULT:
+      Serial.print(event.result.reencryption ? "Re-encrypted" : "Paired");
+      Serial.print(", status: ");
+      Serial.print(event.result.status);
+      Serial.print(", ");
+      Serial.print(event.result.elapsedMs);
+      Serial.println(" ms");
+      break;
+    }
+  }
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE FreeRTOS Security Example");
+
+  // Set device name
+  BTstack.setup("RTOSSecBLE");
+
+  // Numeric comparison with Secure Connections
+  BLESecure.begin(IO_CAPABILITY_DISPLAY_YES_NO);
+  BLESecure.setSecurityLevel(SECURITY_HIGH_SC, true);
+  BLESecure.requestPairingOnConnect(true);
+
+  // Start the owner task, it takes over BLESecure's callbacks
+  if (!BLESecureRTOS.begin())
+    Serial.println("Could not start the BLESecure owner task");
+
+  // Application task below the owner task
+  xTaskCreate(securityEventTask, "Security", 1024, nullptr, tskIDLE_PRIORITY + 1, nullptr);
+
+  // Add service and characteristic
+  BTstack.addGATTService(&service);
+  char_handle = BTstack.addGATTCharacteristicDynamic(&characteristicUUID, ATT_PROPERTY_READ | ATT_PROPERTY_WRITE, 0);
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_HIGH_SC);
+
+  // Start advertising
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections...");
+}
+
+void loop()
+{
+  // Commands only post to the owner task, they never block on BluetoothLock
+  if (Serial.available())
+  {
+    String input = Serial.readStringUntil('\n');
+    if (input.startsWith("yes"))
+    {
+      BLESecureRTOS.acceptNumericComparison(true);
+    }
+    else if (input.startsWith("no"))
+    {
+      BLESecureRTOS.acceptNumericComparison(false);
+    }
+    else if (input.startsWith("unbond") && connectedHandle != HCI_CON_HANDLE_INVALID)
+    {
+      BLEDevice device(connectedHandle);
+      BLESecureRTOS.removeBonding(&device);
+    }
+    else if (input.startsWith("clear"))
+    {
+      BLESecureRTOS.clearAllBondings();
+    }
+  }
+
+  // Report when the application task falls behind
+  static uint32_t lastDropped = 0;
+  BLERTOSStats stats = BLESecureRTOS.getStats();
+  if (stats.eventsDropped + stats.commandsDropped != lastDropped)
+  {
+    lastDropped = stats.eventsDropped + stats.commandsDropped;
+    Serial.print("Dropped events: ");
+    Serial.print(stats.eventsDropped);
+    Serial.print(", dropped commands: ");
+    Serial.println(stats.commandsDropped);
+  }
+
+  delay(100);
+}
@@ -0,0 +1,191 @@
+/**
+ * L2CAPThroughput/src/main.cpp - Throughput benchmark: L2CAP channel vs. notifications
+ *
+ * This example streams data over an encrypted link and reports KB/s once per second.
+ * Data goes over the BLESecureChannel LE credit-based L2CAP channel while a central
+ * has it open, and over GATT notifications otherwise, so both paths can be compared
+ * on the same link.
+ *
+ * The central must open an L2CAP channel on PSM 0x0081 (e.g. with a custom app);
+ * nRF Connect can be used to test the notification path.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+#include <BLESecureChannel.h>
+#include "BLENotify.h"
+
+// Dynamic PSM for the bulk channel
+#define BULK_PSM 0x0081
+
+// Define UUIDs for service and characteristic
+UUID service("9a1c0001-8f4e-4b5a-b1d2-6e3f7c8d9e01");
+UUID characteristicUUID("9a1c0002-8f4e-4b5a-b1d2-6e3f7c8d9e01");
+
+// Service and Characteristic handles
+uint16_t char_handle;
+
+// Flag to track if a device is connected
+bool deviceConnected = false;
+BLEDevice *connectedDevice = nullptr;
+
+// Throughput accounting
+uint32_t notifyBytes = 0;
+uint32_t lastChannelBytes = 0;
+unsigned long lastReport = 0;
+uint8_t pattern = 0;
+
+// Callbacks for BLE events
+void bleDeviceConnected(BLEStatus status, BLEDevice *device)
+{
+  if (status == BLE_STATUS_OK)
+  {
+    Serial.println("Device connected!");
+    deviceConnected = true;
+    connectedDevice = device;
+  }
+}
+
+void bleDeviceDisconnected(BLEDevice *device)
+{
+  Serial.println("Device disconnected!");
+  deviceConnected = false;
+  connectedDevice = nullptr;
+  BLENotify.handleDisconnection();
+  BTstack.startAdvertising();
+}
+
+// Callback for pairing status updates
+void onPairingStatus(BLEPairingStatus status, BLEDevice *device)
+{
+  if (status == PAIRING_COMPLETE)
+    Serial.println("Link secured - benchmark running");
+  else if (status == PAIRING_FAILED)
+    Serial.println("Pairing failed");
+}
+
+void onChannelOpen(BLEDevice *device, uint16_t remoteMtu)
+{
+  Serial.println("L2CAP channel open - switching benchmark to the channel");
+}
+
+void onChannelClosed()
+{
+  Serial.println("L2CAP channel closed - switching benchmark to notifications");
+}
+
+// Callback for GATT characteristic write (CCC descriptor handling)
+int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  if (buffer_size == 2)
+  {
+    uint16_t value = (buffer[1] << 8) | buffer[0];
+    BLENotify.handleSubscriptionChange(characteristic_id - 1, value == 0x0001);
+  }
+  return 0;
+}
+
+// Fill every free slot of the send ring in place
+void fillChannel()
+{
+  uint16_t capacity;
+  uint8_t *slot;
+  while ((slot = BLESecureChannel.acquireSendBuffer(&capacity)) != nullptr)
+  {
+    memset(slot, pattern++, capacity);
+    BLESecureChannel.commitSendBuffer(capacity);
+  }
+}
+
+// Send one notification sized to the negotiated MTU
+void sendNotification()
+{
+  uint8_t payload[244];
+  uint16_t len = BLESecure.getMaxNotificationPayload(connectedDevice);
+  if (len > sizeof(payload))
+    len = sizeof(payload);
+  if (len == 0)
+    return;
+
+  memset(payload, pattern++, len);
+  if (BLENotify.notify(char_handle, payload, len))
+    notifyBytes += len;
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE L2CAP Throughput Example");
+
+  BLENotify.begin();
+  BTstack.setup("ThroughputBLE");
+
+  BLESecure.begin(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+  BLESecure.setSecurityLevel(SECURITY_MEDIUM, true);
+  BLESecure.requestPairingOnConnect(true);
+
+  // Bigger MTU, 251-byte LL payloads and 2M PHY once encrypted
+  BLESecure.setLinkUpgrade(LINK_UPGRADE_ALL);
+
+  BLESecure.setPairingStatusCallback(onPairingStatus);
+  BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
+  BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
+
+  // The channel is only accepted on encrypted links
+  BLESecureChannel.setOpenCallback(onChannelOpen);
+  BLESecureChannel.setClosedCallback(onChannelClosed);
+  BLESecureChannel.begin(BULK_PSM, SECURITY_MEDIUM);
+
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
+  BTstack.addGATTService(&service);
+  char_handle = BLENotify.addNotifyCharacteristic(&characteristicUUID, ATT_PROPERTY_READ | ATT_PROPERTY_NOTIFY);
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_MEDIUM);
+
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections...");
+}
+
+void loop()
+{
+  if (deviceConnected)
+  {
+    if (BLESecureChannel.isOpen())
+    {
+      fillChannel();
+    }
+    else if (BLENotify.isSubscribed(char_handle) && BLESecure.isAccessAllowed(connectedDevice, char_handle))
+    {
+      sendNotification();
+    }
+  }
+
+  // Report throughput once per second
+  if (millis() - lastReport >= 1000)
+  {
+    uint32_t channelBytes = BLESecureChannel.getStats().bytesSent;
+    uint32_t elapsed = millis() - lastReport;
+
+    if (channelBytes != lastChannelBytes || notifyBytes > 0)
+    {
+      Serial.print("L2CAP channel: ");
+      Serial.print((channelBytes - lastChannelBytes) / (float)elapsed, 2); // bytes/ms == KB/s
+      Serial.print(" KB/s, notifications: ");
+      Serial.print(notifyBytes / (float)elapsed, 2);
+      Serial.println(" KB/s");
+    }
+
+    lastChannelBytes = channelBytes;
+    notifyBytes = 0;
+    lastReport = millis();
+  }
+
+  // Process BLE events
+  BTstack.loop();
+  BLENotify.update();
+}
@@ -0,0 +1,180 @@
+/**
+ * LazySecurity/src/main.cpp - Example of pairing on first protected access
+ *
+ * This example demonstrates per-characteristic security levels. A public
+ * characteristic can be read without pairing; pairing is only requested when
+ * the client first touches the protected characteristic.
+ *
+ * Set LAZY_SECURITY to 0 to pair on connect instead and compare the
+ * connection-to-first-data latency printed on the Serial Monitor.
+ *
+ * For the Raspberry Pi Pico with arduino-pico core.
+ */
+
+#include <Arduino.h>
+#include <BTstackLib.h>
+#include <BLESecure.h>
+
+// 1 = pair on first protected access, 0 = pair on connect
+#define LAZY_SECURITY 1
+
+// Define UUIDs for service and characteristics
+UUID service("4f7c1a01-6b2e-4d1a-9c55-1f0e6a7b2c11");
+UUID publicCharUUID("4f7c1a02-6b2e-4d1a-9c55-1f0e6a7b2c11");
+UUID secretCharUUID("4f7c1a03-6b2e-4d1a-9c55-1f0e6a7b2c11");
+
+// Characteristic handles
+uint16_t public_handle;
+uint16_t secret_handle;
+
+// Flag to track if a device is connected
+bool deviceConnected = false;
+BLEDevice *connectedDevice = nullptr;
+bool latencyReported = false;
+
+// Callbacks for BLE events
+void bleDeviceConnected(BLEStatus status, BLEDevice *device)
+{
+  if (status == BLE_STATUS_OK)
+  {
+    Serial.println("Device connected!");
+    deviceConnected = true;
+    connectedDevice = device;
+    latencyReported = false;
+  }
+  else
+  {
+    Serial.print("Connection failed with status: ");
+    Serial.println(status);
+  }
+}
+
+void bleDeviceDisconnected(BLEDevice *device)
+{
+  Serial.println("Device disconnected!");
+  deviceConnected = false;
+  connectedDevice = nullptr;
+  BTstack.startAdvertising();
+}
+
+// Callback for pairing status updates
+void onPairingStatus(BLEPairingStatus status, BLEDevice *device)
+{
+  switch (status)
+  {
+  case PAIRING_IDLE:
+    Serial.println("Pairing idle");
+    break;
+  case PAIRING_STARTED:
+    Serial.println("Pairing started");
+    break;
+  case PAIRING_COMPLETE:
+    Serial.println("Pairing complete - protected characteristic is now accessible");
+    break;
+  case PAIRING_FAILED:
+    Serial.println("Pairing failed");
+    break;
+  }
+}
+
+// Only called for permitted accesses, BLESecure rejects the rest
+uint16_t gattReadCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  const char *value = nullptr;
+  if (characteristic_id == public_handle)
+    value = "public data";
+  else if (characteristic_id == secret_handle)
+    value = "secret data";
+
+  if (!value)
+    return 0;
+
+  uint16_t len = strlen(value);
+  if (buffer)
+  {
+    if (len > buffer_size)
+      len = buffer_size;
+    memcpy(buffer, value, len);
+  }
+  return len;
+}
+
+int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
+{
+  if (characteristic_id == secret_handle)
+  {
+    Serial.print("Received protected data: ");
+    for (int i = 0; i < buffer_size; i++)
+    {
+      Serial.print((char)buffer[i]);
+    }
+    Serial.println();
+  }
+  return 0;
+}
+
+void setup()
+{
+  // Initialize serial for debugging
+  Serial.begin(115200);
+  while (!Serial)
+    delay(10);
+  Serial.println("BLE Lazy Security Example");
+
+  // Set device name
+  BTstack.setup("LazySecBLE");
+
+  // Just Works pairing keeps the example free of user interaction
+  BLESecure.begin(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
+  BLESecure.setSecurityLevel(SECURITY_MEDIUM, true);
+
+#if LAZY_SECURITY
+  BLESecure.requestPairingOnConnect(false);
+  BLESecure.requestPairingOnAccess(true);
+  Serial.println("Mode: pair on first protected access");
+#else
+  BLESecure.requestPairingOnConnect(true);
+  Serial.println("Mode: pair on connect");
+#endif
+
+  BLESecure.setPairingStatusCallback(onPairingStatus);
+  BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
+  BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
+
+  // Register GATT callbacks through BLESecure so access is checked first
+  BLESecure.setGATTCharacteristicRead(gattReadCallback);
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
+
+  // Add service and characteristics
+  BTstack.addGATTService(&service);
+  public_handle = BTstack.addGATTCharacteristicDynamic(&publicCharUUID, ATT_PROPERTY_READ, 0);
+  secret_handle = BTstack.addGATTCharacteristicDynamic(&secretCharUUID, ATT_PROPERTY_READ | ATT_PROPERTY_WRITE, 1);
+
+  // Only the secret characteristic needs an encrypted link
+  BLESecure.setCharacteristicSecurity(secret_handle, SECURITY_MEDIUM);
+
+  // Start advertising
+  BTstack.startAdvertising();
+  Serial.println("Waiting for connections...");
+}
+
+void loop()
+{
+  // Report how long the first useful data took after connecting
+  if (deviceConnected && !latencyReported)
+  {
+    uint32_t latency = BLESecure.getFirstDataLatency(connectedDevice);
+    if (latency > 0)
+    {
+      Serial.print("Connection-to-first-data latency: ");
+      Serial.print(latency);
+      Serial.println(" ms");
+      latencyReported = true;
+    }
+  }
+
+  // Process BLE events
+  BTstack.loop();
+
+  delay(10);
+}
@@ -91,6 +91,50 @@ void onPairingStatus(BLEPairingStatus status, BLEDevice *device)
   }
 }
 
+const char *pairingMethodName(uint8_t method)
+{
+  switch (method)
+  {
+  case PAIRING_METHOD_JUST_WORKS:
+    return "Just Works";
+  case PAIRING_METHOD_PASSKEY_DISPLAY:
+    return "passkey display";
+  case PAIRING_METHOD_PASSKEY_ENTRY:
+    return "passkey entry";
+  case PAIRING_METHOD_NUMERIC_COMPARISON:
+    return "numeric comparison";
+  default:
+    return "none";
+  }
+}
+
+// Callback with the details of each completed pairing or re-encryption
+void onPairingResult(const BLEPairingResult &result, BLEDevice *device)
+{
+  Serial.print(result.reencryption ? "Re-encryption" : "Pairing");
+  Serial.print(result.status == 0 ? " succeeded in " : " failed after ");
+  Serial.print(result.elapsedMs);
+  Serial.println(" ms");
+  if (result.status != 0)
+  {
+    Serial.print("  status: ");
+    Serial.print(result.status);
+    Serial.print(", reason: ");
+    Serial.println(result.reason);
+    return;
+  }
+  Serial.print("  method: ");
+  Serial.print(pairingMethodName(result.method));
+  Serial.print(", key size: ");
+  Serial.print(result.keySize);
+  Serial.print(", MITM: ");
+  Serial.print(result.authenticated ? "yes" : "no");
+  Serial.print(", SC: ");
+  Serial.print(result.secureConnections ? "yes" : "no");
+  Serial.print(", bonded: ");
+  Serial.println(result.bonded ? "yes" : "no");
+}
+
 // Callback for GATT characteristic write
 int gattWriteCallback(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size)
 {
@@ -158,14 +202,15 @@ void setup()
   // Register callbacks for security events
   BLESecure.setPasskeyDisplayCallback(onPasskeyDisplay);
   BLESecure.setPairingStatusCallback(onPairingStatus);
+  BLESecure.setPairingResultCallback(onPairingResult);
   BLESecure.setNumericComparisonCallback(onNumericComparison);
 
   // Register callbacks for BLE connection events
   BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
   BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
 
-  // Register GATT write callback
-  BTstack.setGATTCharacteristicWrite(gattWriteCallback);
+  // Register GATT write callback through BLESecure, so writes are checked against the characteristic security
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
 
   // Add service and characteristic
   BTstack.addGATTService(&service);
@@ -175,6 +220,9 @@ void setup()
           ATT_PROPERTY_WRITE |
           ATT_PROPERTY_NOTIFY);
 
+  // Only notify this characteristic on links that reached SECURITY_HIGH
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_HIGH);
+
   // Start advertising
   BTstack.startAdvertising();
 
@@ -187,7 +235,7 @@ void loop()
   // If connected and paired, send a notification every 5 seconds
   static unsigned long lastNotify = 0;
 
-  if (deviceConnected && BLESecure.getPairingStatus() == PAIRING_COMPLETE)
+  if (deviceConnected && BLESecure.isAccessAllowed(connectedDevice, char_handle))
   {
     if (millis() - lastNotify > 5000)
     {
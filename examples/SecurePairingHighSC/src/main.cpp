@@ -11,6 +11,7 @@
 #include <Arduino.h>
 #include <BTstackLib.h>
 #include <BLESecure.h>
+#include <BLESecureNotifier.h>
 #include "BLENotify.h"
 
 // Define UUIDs for service and characteristic
@@ -24,9 +25,6 @@ uint16_t char_handle;
 bool deviceConnected = false;
 BLEDevice *connectedDevice = nullptr;
 
-// Global variable to store the current MTU size
-uint16_t current_mtu_size = 23; // ATT_DEFAULT_MTU is 23 bytes
-
 // Callbacks for BLE events
 void bleDeviceConnected(BLEStatus status, BLEDevice *device)
 {
@@ -53,9 +51,6 @@ void bleDeviceDisconnected(BLEDevice *device)
   deviceConnected = false;
   connectedDevice = nullptr;
 
-  // Reset MTU size to default
-  current_mtu_size = 23; // Default is 23 bytes
-
   // Let BLENotify know of disconnection
   BLENotify.handleDisconnection();
 }
@@ -192,6 +187,9 @@ void setup()
   // Request pairing automatically when a device connects
   BLESecure.requestPairingOnConnect(true);
 
+  // Once secured, exchange MTU, enable 251-byte LL payloads and switch to 2M PHY
+  BLESecure.setLinkUpgrade(LINK_UPGRADE_ALL);
+
   // Register callbacks for security events
   BLESecure.setPasskeyDisplayCallback(onPasskeyDisplay);
   BLESecure.setPasskeyEntryCallback(onPasskeyEntry);
@@ -202,8 +200,8 @@ void setup()
   BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
   BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
 
-  // Register GATT write callback
-  BTstack.setGATTCharacteristicWrite(gattWriteCallback);
+  // Register GATT write callback through BLESecure, so writes are checked against the characteristic security
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
 
   // Add service and characteristic
   BTstack.addGATTService(&service);
@@ -213,6 +211,12 @@ void setup()
           ATT_PROPERTY_WRITE |
           ATT_PROPERTY_NOTIFY);
 
+  // Only notify this characteristic on links that reached SECURITY_HIGH_SC with a 128-bit key
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_HIGH_SC, 16);
+
+  // Queue notifications and send them once the link meets the level above
+  BLESecureNotifier.begin();
+
   // Start advertising
   BTstack.startAdvertising();
 
@@ -222,49 +226,53 @@ void setup()
 
 void loop()
 {
-  // If connected and paired, send a notification every 5 seconds
+  // If connected, queue a notification every 5 seconds. BLESecureNotifier holds
+  // it until the link is secured and then sends whatever has accumulated.
   static unsigned long lastNotify = 0;
 
-  if (deviceConnected && BLESecure.getPairingStatus() == PAIRING_COMPLETE)
+  if (deviceConnected && millis() - lastNotify > 5000)
   {
-    if (millis() - lastNotify > 5000)
+    // Debug negotiated link properties
+    BLELinkInfo link = BLESecure.getLinkInfo(connectedDevice);
+    Serial.print("MTU: ");
+    Serial.print(link.mtu);
+    Serial.print(", LL payload: ");
+    Serial.print(link.txOctets);
+    Serial.print(", PHY: ");
+    Serial.println(link.txPhy == 3 ? "Coded" : link.txPhy == 2 ? "2M" : "1M");
+
+    // Check if client is subscribed to notifications
+    if (BLENotify.isSubscribed(char_handle))
     {
-      // Create a message with timestamp
       char message[30];
-      sprintf(message, "secure msg: %lu", millis() / 1000);
+      int len = snprintf(message, sizeof(message), "secure msg: %lu", millis() / 1000);
 
-      // Debug MTU and notification process
-      Serial.print("Current MTU size: ");
-      Serial.println(current_mtu_size);
-
-      // Check if client is subscribed to notifications
-      if (BLENotify.isSubscribed(char_handle))
+      if (BLESecureNotifier.notify(connectedDevice, char_handle, message, len))
       {
-        Serial.print("Client is subscribed. Attempting to send notification (");
-        Serial.print(strlen(message));
-        Serial.print(" bytes, MTU: ");
-        Serial.print(current_mtu_size);
-        Serial.println(")");
-
-        // Send notification using BLENotify
-        bool success = BLENotify.notify(char_handle, message, strlen(message));
-        if (success)
-        {
-          Serial.print("Sent highly secure notification: ");
-          Serial.println(message);
-        }
-        else
-        {
-          Serial.println("Failed to send notification!");
-        }
+        Serial.print("Queued notification: ");
+        Serial.println(message);
       }
       else
       {
-        Serial.println("Client is not subscribed to notifications");
+        Serial.println("Notification queue full, message dropped!");
       }
 
-      lastNotify = millis();
+      BLENotifyQueueStats stats = BLESecureNotifier.getStats(connectedDevice);
+      Serial.print("Queue: ");
+      Serial.print(stats.queuedBytes);
+      Serial.print(" bytes waiting, ");
+      Serial.print(stats.sentCount);
+      Serial.print(" sent, ");
+      Serial.print(stats.droppedCount);
+      Serial.print(" dropped, max payload: ");
+      Serial.println(BLESecure.getMaxNotificationPayload(connectedDevice));
+    }
+    else
+    {
+      Serial.println("Client is not subscribed to notifications");
     }
+
+    lastNotify = millis();
   }
 
   // Read serial input for passkey entry (if requested)
@@ -146,8 +146,8 @@ void setup()
   BLESecure.setBLEDeviceConnectedCallback(bleDeviceConnected);
   BLESecure.setBLEDeviceDisconnectedCallback(bleDeviceDisconnected);
 
-  // Register GATT write callback
-  BTstack.setGATTCharacteristicWrite(gattWriteCallback);
+  // Register GATT write callback through BLESecure, so writes are checked against the characteristic security
+  BLESecure.setGATTCharacteristicWrite(gattWriteCallback);
 
   // Add service and characteristic
   BTstack.addGATTService(&service);
@@ -157,6 +157,9 @@ void setup()
           ATT_PROPERTY_WRITE |
           ATT_PROPERTY_NOTIFY);
 
+  // Only notify this characteristic on links that reached SECURITY_MEDIUM
+  BLESecure.setCharacteristicSecurity(char_handle, SECURITY_MEDIUM);
+
   // Start advertising
   BTstack.startAdvertising();
 
@@ -169,7 +172,7 @@ void loop()
   // If connected and paired, send a notification every 5 seconds
   static unsigned long lastNotify = 0;
 
-  if (deviceConnected && BLESecure.getPairingStatus() == PAIRING_COMPLETE)
+  if (deviceConnected && BLESecure.isAccessAllowed(connectedDevice, char_handle))
   {
     if (millis() - lastNotify > 5000)
     {
@@ -17,6 +17,11 @@
 #include "ble/sm.h"
 #include "BluetoothLock.h"
 #include "gap.h"
+#include "btstack_run_loop.h"
+#include "hardware/sync.h"
+#include "BLESecureRateLimiter.h"
+#include "BLESecureLock.h"
+#include "BLESecureProfiler.h"
 // We don't need to include BluetoothHCI.h since we'll use other methods
 
 // Security levels
@@ -30,6 +35,21 @@ typedef enum
 
 // Note: We use the io_capability_t enum from bluetooth.h directly
 
+// Number of simultaneous connections tracked by BLESecure
+#ifndef BLESECURE_MAX_CONNECTIONS
+#define BLESECURE_MAX_CONNECTIONS 4
+#endif
+
+// Connections whose pairing the rate limiter rejected, remembered until the handle is reused
+#ifndef BLESECURE_REJECTED_HANDLES
+#define BLESECURE_REJECTED_HANDLES 4
+#endif
+
+// Highest ATT handle that can carry a per-characteristic security level
+#ifndef BLESECURE_MAX_ATT_HANDLES
+#define BLESECURE_MAX_ATT_HANDLES 64
+#endif
+
 // Pairing status
 typedef enum
 {
@@ -39,6 +59,218 @@ typedef enum
     PAIRING_FAILED = 3
 } BLEPairingStatus;
 
+// What to do when re-encryption with a bonded device fails (e.g. the
+// central still has a bond that this device lost)
+typedef enum
+{
+    STALE_BOND_REPORT = 0,         // Report PAIRING_FAILED only (default)
+    STALE_BOND_REPAIR = 1,         // Request fresh pairing on the same connection
+    STALE_BOND_DROP_AND_REPAIR = 2 // Delete the local bond entry, then request fresh pairing
+} BLEStaleBondPolicy;
+
+// Stale-bond recovery counters
+typedef struct
+{
+    uint32_t reencryptionFailures; // Re-encryption failures seen
+    uint32_t recoveriesStarted;    // Fresh pairings requested after a failure
+    uint32_t recoveriesSucceeded;  // Fresh pairings that completed successfully
+    uint32_t recoveriesFailed;     // Fresh pairings that failed or were disconnected
+    uint32_t bondsDropped;         // Local bond entries deleted by the policy
+    uint32_t lastRecoveryMs;       // Failure-to-paired time of the last recovery
+    uint32_t maxRecoveryMs;        // Longest failure-to-paired time
+    uint32_t totalRecoveryMs;      // Sum over successful recoveries (for the mean)
+} BLEStaleBondStats;
+
+// Advertising schedule used after a disconnect when fast reconnect is enabled.
+// Intervals are in units of 0.625 ms like gap_advertisements_set_params().
+typedef struct
+{
+    bool directed;            // Start with high-duty directed advertising to the last bonded peer
+    uint16_t fastIntervalMin; // Undirected fast phase interval
+    uint16_t fastIntervalMax;
+    uint32_t fastDurationMs;  // Length of the fast phase before falling back to slow
+    uint16_t slowIntervalMin; // Undirected slow phase interval (until connected)
+    uint16_t slowIntervalMax;
+} BLEReconnectAdvConfig;
+
+// Which reconnect advertising phase a bonded peer came back in
+typedef enum
+{
+    RECONNECT_ADV_IDLE = 0,
+    RECONNECT_ADV_DIRECTED = 1,
+    RECONNECT_ADV_FAST = 2,
+    RECONNECT_ADV_SLOW = 3
+} BLEReconnectAdvPhase;
+
+// Disconnect-to-reencrypted timing for bonded peers
+typedef struct
+{
+    uint32_t reconnects;       // Bonded peers that came back and re-encrypted
+    uint32_t viaDirected;      // ...while directed advertising was running
+    uint32_t viaFast;          // ...during the fast undirected phase
+    uint32_t viaSlow;          // ...during the slow undirected phase
+    uint32_t lastReconnectMs;  // Disconnect-to-reencrypted time of the last reconnect
+    uint32_t maxReconnectMs;
+    uint32_t totalReconnectMs; // Sum over all reconnects (for the mean)
+} BLEReconnectStats;
+
+// Where resolvable private addresses of bonded peers were resolved
+typedef struct
+{
+    uint32_t controllerResolved; // Connections resolved by the controller's resolving list
+    uint32_t hostResolved;       // RPAs the controller left to the Security Manager, resolved against stored IRKs
+    uint32_t hostFailed;         // RPAs the controller left to the Security Manager, matching no stored IRK
+    uint16_t resolvingListSize;  // Controller resolving list capacity (0 if unknown)
+    uint16_t bondsWithIrk;       // Bonded devices that have an IRK
+} BLEAddressResolutionStats;
+
+// LE connection parameters (intervals in units of 1.25 ms, timeout in units of 10 ms)
+typedef struct
+{
+    uint16_t intervalMin;
+    uint16_t intervalMax;
+    uint16_t latency;
+    uint16_t supervisionTimeout;
+} BLEConnectionParams;
+
+// Measured pairing durations for one security level's parameter set
+typedef struct
+{
+    uint32_t pairings;    // Successful pairings measured
+    uint32_t lastMs;      // Duration of the last pairing (started to complete)
+    uint32_t maxMs;
+    uint32_t totalMs;     // Sum over all measured pairings (for the mean)
+    uint16_t lastInterval; // Connection interval in effect at completion (units of 1.25 ms)
+} BLEPairingTimingStats;
+
+// Link upgrades started after pairing or re-encryption completes (combine with |)
+typedef enum
+{
+    LINK_UPGRADE_NONE = 0x00,
+    LINK_UPGRADE_MTU = 0x01,         // ATT MTU exchange
+    LINK_UPGRADE_DATA_LENGTH = 0x02, // LE Data Length Extension (251-byte LL payloads)
+    LINK_UPGRADE_PHY_2M = 0x04,      // Switch to the LE 2M PHY
+    LINK_UPGRADE_ALL = 0x07
+} BLELinkUpgrade;
+
+// Negotiated link properties of a connection
+typedef struct
+{
+    uint16_t mtu;          // ATT MTU
+    uint16_t txOctets;     // Max LL payload we send per packet
+    uint16_t rxOctets;     // Max LL payload we receive per packet
+    uint8_t txPhy;         // 1 = LE 1M, 2 = LE 2M, 3 = LE Coded
+    uint8_t rxPhy;
+    uint16_t connInterval; // Connection interval (units of 1.25 ms)
+} BLELinkInfo;
+
+// waitForEvent() counters
+typedef struct
+{
+    uint32_t wakeups;        // Returns because an event was signalled
+    uint32_t timeouts;       // Returns because the timeout passed first
+    uint32_t lastLatencyUs;  // Signal-to-return time of the last wakeup
+    uint32_t maxLatencyUs;
+    uint64_t totalLatencyUs; // Sum over all wakeups (for the mean)
+} BLEEventWaitStats;
+
+// Pairing failures are counted per SM reason code below this (0 = no SM reason, e.g. a timeout)
+#define BLESECURE_FAILURE_REASONS 15
+
+// Durations of recent successful pairings and re-encryptions kept for percentiles
+#ifndef BLESECURE_LATENCY_SAMPLES
+#define BLESECURE_LATENCY_SAMPLES 16
+#endif
+
+// Pairing and re-encryption outcome counters
+typedef struct
+{
+    uint32_t pairings;             // Successful pairings
+    uint32_t pairingFailures;
+    uint32_t reencryptions;        // Successful re-encryptions with a bonded device
+    uint32_t reencryptionFailures;
+    uint32_t failureReasons[BLESECURE_FAILURE_REASONS]; // Pairing failures by SM reason, higher codes count as 0
+    uint32_t bondsEvicted;         // Bond entries deleted by BLESecure (stale-bond policy, removeBonding, clearAllBondings)
+    uint32_t totalPairingMs;       // Sum of successful pairing durations (for the mean)
+} BLESecurityCounters;
+
+// Pairing methods (combine with |)
+typedef enum
+{
+    PAIRING_METHOD_NONE = 0x00,
+    PAIRING_METHOD_JUST_WORKS = 0x01,         // No user interaction, no MITM protection
+    PAIRING_METHOD_PASSKEY_DISPLAY = 0x02,    // We show a passkey, the peer enters it
+    PAIRING_METHOD_PASSKEY_ENTRY = 0x04,      // The peer shows a passkey, we enter it
+    PAIRING_METHOD_NUMERIC_COMPARISON = 0x08, // Both sides confirm a number (Secure Connections only)
+    PAIRING_METHOD_ALL = 0x0F
+} BLEPairingMethod;
+
+// Outcome of a pairing or re-encryption, packed into 6 bytes
+typedef struct __attribute__((packed))
+{
+    uint32_t elapsedMs : 19;        // Time from start to completion (saturates at 524287)
+    uint32_t keySize : 5;           // Encryption key size in bytes, 0 if not encrypted
+    uint32_t method : 4;            // BLEPairingMethod used, PAIRING_METHOD_NONE for re-encryption
+    uint32_t authenticated : 1;     // Key is MITM protected
+    uint32_t secureConnections : 1; // LE Secure Connections were used
+    uint32_t bonded : 1;            // Keys are stored in the LE device DB
+    uint32_t reencryption : 1;      // Re-encryption with an existing bond, not a new pairing
+    uint8_t status;                 // ERROR_CODE_SUCCESS or the failure status
+    uint8_t reason;                 // SM pairing failure reason, 0 if none
+} BLEPairingResult;
+
+// Pairing steps reported to the pairing step hook
+typedef enum
+{
+    PAIRING_STEP_RESULT,             // Pairing or re-encryption finished, see getLastPairingResult()
+    PAIRING_STEP_PASSKEY_REQUESTED,  // The SM wants a passkey from setEnteredPasskey()
+    PAIRING_STEP_PASSKEY_ENTERED,    // setEnteredPasskey() passed a passkey to the SM (value = passkey)
+    PAIRING_STEP_DISCONNECTED        // The connection closed (value = HCI reason)
+} BLEPairingStep;
+
+// SM event subscriptions (combine with |). Pairing and re-encryption state
+// tracking always runs, these select what else BLESecure does per SM event.
+typedef enum
+{
+    SM_SUBSCRIBE_NONE = 0x00,
+    SM_SUBSCRIBE_PAIRING_PROMPTS = 0x01,    // Just Works, passkey and numeric comparison prompts, declined without it
+    SM_SUBSCRIBE_PAIRING_STATUS = 0x02,     // Pairing status callback
+    SM_SUBSCRIBE_ADDRESS_RESOLUTION = 0x04, // Host identity resolving events and counters
+    SM_SUBSCRIBE_STATS = 0x08,              // Pairing timing and reconnect statistics
+    SM_SUBSCRIBE_TRACE = 0x10,              // Serial log of pairing and re-encryption events
+    SM_SUBSCRIBE_ALL = 0x1F
+} BLESMSubscription;
+
+// Boot timeline milestones, each recorded once per boot
+typedef enum
+{
+    BOOT_MILESTONE_BEGIN,            // BLESecure.begin() entered
+    BOOT_MILESTONE_BEGIN_DONE,       // begin() returned
+    BOOT_MILESTONE_STACK_WORKING,    // BTstack reported HCI_STATE_WORKING
+    BOOT_MILESTONE_ADVERTISING,      // The controller enabled the first advertising set
+    BOOT_MILESTONE_DEFERRED_DONE,    // Deferred startup work finished (fast startup)
+    BOOT_MILESTONE_FIRST_CONNECTION,
+    BOOT_MILESTONE_FIRST_ENCRYPTION, // First encrypted link (pairing or re-encryption)
+    BOOT_MILESTONE_APP_READY,        // Set by the application with markBootMilestone()
+    BOOT_MILESTONE_COUNT
+} BLEBootMilestone;
+
+// Startup tasks that can wait for advertising in fast startup
+#ifndef BLESECURE_STARTUP_TASKS
+#define BLESECURE_STARTUP_TASKS 4
+#endif
+
+// SM authentication requirements for a security level
+constexpr uint8_t blesecureAuthReq(BLESecurityLevel level, bool bonding)
+{
+    return (level == SECURITY_LOW ? 0 : (bonding ? SM_AUTHREQ_BONDING : 0)) |
+           (level >= SECURITY_HIGH ? SM_AUTHREQ_MITM_PROTECTION : 0) |
+           (level == SECURITY_HIGH_SC ? SM_AUTHREQ_SECURE_CONNECTION : 0);
+}
+
+template <class Policy>
+class BLESecureFixed;
+
 class BLESecureClass
 {
 public:
@@ -73,22 +305,39 @@ public:
 
     // Callback for handling passkey display
     void setPasskeyDisplayCallback(void (*callback)(uint32_t passkey));
+    void setPasskeyDisplayCallback(void (*callback)(void *ctx, uint32_t passkey), void *ctx);
 
     // Callback for handling passkey entry requests
     void setPasskeyEntryCallback(void (*callback)(void));
+    void setPasskeyEntryCallback(void (*callback)(void *ctx), void *ctx);
 
     // Set passkey for entry method (call this from the passkey entry callback)
     void setEnteredPasskey(uint32_t passkey);
 
     // Callback for pairing status updates
     void setPairingStatusCallback(void (*callback)(BLEPairingStatus status, BLEDevice *device));
+    void setPairingStatusCallback(void (*callback)(void *ctx, BLEPairingStatus status, BLEDevice *device), void *ctx);
+
+    // Callback with the full outcome of each pairing or re-encryption
+    void setPairingResultCallback(void (*callback)(const BLEPairingResult &result, BLEDevice *device));
+    void setPairingResultCallback(void (*callback)(void *ctx, const BLEPairingResult &result, BLEDevice *device), void *ctx);
+
+    // Outcome of the most recent pairing or re-encryption
+    BLEPairingResult getLastPairingResult();
+
+    // Hook called from the BTstack context on each pairing step, used by BLESecureAsync
+    void setPairingStepHook(void (*hook)(void *ctx, BLEPairingStep step, hci_con_handle_t handle, uint32_t value), void *ctx);
 
     // Callback for numeric comparison (call acceptNumericComparison from this)
     void setNumericComparisonCallback(void (*callback)(uint32_t passkey, BLEDevice *device));
+    void setNumericComparisonCallback(void (*callback)(void *ctx, uint32_t passkey, BLEDevice *device), void *ctx);
 
     // Accept or reject numeric comparison
     void acceptNumericComparison(bool accept);
 
+    // Reject the pairing waiting for a passkey or numeric comparison answer
+    void declinePairing();
+
     // Get the current pairing status
     BLEPairingStatus getPairingStatus();
 
@@ -98,11 +347,168 @@ public:
     // Process security manager events - should be called from the main event handler
     void handleSMEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
 
+    // Select which SM events are processed and which bookkeeping runs (default SM_SUBSCRIBE_ALL)
+    void setEventSubscriptions(uint8_t subscriptions);
+    uint8_t getEventSubscriptions();
+
+    // Process HCI events (connection tracking) - registered by begin()
+    void handleHCIEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
     // Method to register connection callback that also handles auto-pairing
     void setBLEDeviceConnectedCallback(void (*callback)(BLEStatus status, BLEDevice *device));
+    void setBLEDeviceConnectedCallback(void (*callback)(void *ctx, BLEStatus status, BLEDevice *device), void *ctx);
 
     // Method to register disconnection callback
     void setBLEDeviceDisconnectedCallback(void (*callback)(BLEDevice *device));
+    void setBLEDeviceDisconnectedCallback(void (*callback)(void *ctx, BLEDevice *device), void *ctx);
+
+    // Enable token-bucket rate limiting of new pairings (global and per peer)
+    void enablePairingRateLimit(bool enable);
+
+    // Configure bucket sizes, refill periods and deny-list backoff
+    void setPairingRateLimit(const BLEPairingRateLimitConfig &config);
+
+    // Get counters for admitted and rejected pairing attempts
+    BLEPairingRateLimitStats getPairingRateLimitStats();
+
+    // Forget all tracked peers, deny-list entries and counters
+    void resetPairingRateLimit();
+
+    // Require a security level (and optionally a minimum key size, 7-16) for an ATT handle
+    void setCharacteristicSecurity(uint16_t attHandle, BLESecurityLevel level, uint8_t minKeySize = 0);
+
+    // Check if a connection may read, write or be notified on an ATT handle
+    bool isAccessAllowed(BLEDevice *device, uint16_t attHandle);
+
+    // Request pairing on the first access to a protected characteristic instead of on connect
+    void requestPairingOnAccess(bool enable);
+
+    // Method to register GATT write callback that enforces characteristic security (replaces BTstack's)
+    void setGATTCharacteristicWrite(int (*callback)(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size));
+    void setGATTCharacteristicWrite(int (*callback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size), void *ctx);
+
+    // Method to register GATT read callback that enforces characteristic security (replaces BTstack's)
+    void setGATTCharacteristicRead(uint16_t (*callback)(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size));
+    void setGATTCharacteristicRead(uint16_t (*callback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size), void *ctx);
+
+    // Security level reached on a connection
+    BLESecurityLevel getSecurityLevel(BLEDevice *device);
+
+    // Time from connection to the first permitted characteristic access (0 if none yet)
+    uint32_t getFirstDataLatency(BLEDevice *device);
+
+    // Restart advertising automatically after a disconnect using the reconnect schedule
+    void enableFastReconnect(bool enable);
+
+    // Configure the directed/fast/slow reconnect advertising schedule
+    void setReconnectAdvertising(const BLEReconnectAdvConfig &config);
+
+    // Start the reconnect schedule now (directed only if a bonded peer was last connected)
+    void startReconnectAdvertising();
+
+    // Get disconnect-to-reencrypted statistics for bonded peers
+    BLEReconnectStats getReconnectStats();
+
+    // Only accept connections from bonded devices (Filter Accept List built from the bond DB).
+    // Returns false if bonded peers use private addresses the controller does not resolve,
+    // advertising then stays open to all devices.
+    bool restrictToBondedDevices(bool enable);
+
+    // Reprogram the Filter Accept List from the bond DB (done automatically on bond changes),
+    // returns false like restrictToBondedDevices()
+    bool refreshAcceptList();
+
+    // Number of devices currently programmed into the Filter Accept List
+    int getAcceptListSize();
+
+    // Load bonded IRKs into the controller's resolving list and enable address resolution, or turn it off
+    bool enableControllerAddressResolution(bool enable);
+
+    // Get counters for controller and host address resolution
+    BLEAddressResolutionStats getAddressResolutionStats();
+
+    // Defer work that does not decide who may connect until the first advertising set is
+    // enabled (call first in setup()): the bonded IRK count, the BLESecureStatsStore load and
+    // tasks from deferStartupTask(). The accept list and resolving list are never deferred.
+    void setFastStartup(bool enable);
+
+    // Run a task on the BTstack run loop once advertising is up, or at once without fast startup.
+    // Returns false if BLESECURE_STARTUP_TASKS tasks are already queued.
+    bool deferStartupTask(void (*task)(void *ctx), void *ctx);
+
+    // True from begin() in fast startup until the deferred work has run
+    bool isStartupDeferred();
+
+    // Record a milestone now if it was not reached yet (for BOOT_MILESTONE_APP_READY)
+    void markBootMilestone(BLEBootMilestone milestone);
+
+    // Microseconds from reset to a milestone, 0 if not reached yet
+    uint32_t getBootMilestoneUs(BLEBootMilestone milestone);
+
+    // Write the boot timeline, one reached milestone per line
+    void printBootTimeline(Print &out);
+
+    // Request short connection intervals while pairing/re-encryption runs
+    void enableSecurityPhaseConnectionParams(bool enable);
+
+    // Connection parameters requested while pairing at a given security level
+    void setPairingConnectionParams(BLESecurityLevel level, const BLEConnectionParams &params);
+
+    // Connection parameters requested once pairing or re-encryption has finished
+    void setSteadyConnectionParams(const BLEConnectionParams &params);
+
+    // Get measured pairing durations for a security level
+    BLEPairingTimingStats getPairingTimingStats(BLESecurityLevel level);
+
+    // Choose which link upgrades run once a connection is secured (BLELinkUpgrade flags)
+    void setLinkUpgrade(uint8_t upgrades);
+
+    // Get the negotiated MTU, data length, PHY and interval of a connection
+    BLELinkInfo getLinkInfo(BLEDevice *device);
+
+    // Largest notification payload that fits the connection's ATT MTU
+    uint16_t getMaxNotificationPayload(BLEDevice *device);
+
+    // Choose how failed re-encryption with a bonded device is handled
+    void setStaleBondPolicy(BLEStaleBondPolicy policy);
+
+    // Get stale-bond recovery counters and timings
+    BLEStaleBondStats getStaleBondStats();
+
+    // Sleep (WFE) until a BTstack or BLESecure event is signalled or timeoutMs passes.
+    // Returns true for an event, false for a timeout. Replaces delay() in loop().
+    bool waitForEvent(uint32_t timeoutMs);
+
+    // Wake waitForEvent(), safe from interrupt handlers and the other core
+    void signalEvent();
+
+    // Get wakeup and latency counters of waitForEvent()
+    BLEEventWaitStats getEventWaitStats();
+
+    // Get pairing and re-encryption outcome counters
+    BLESecurityCounters getSecurityCounters();
+
+    // Copy the durations (ms) of recent successful pairings and re-encryptions, returns how many
+    uint8_t getSecurityLatencySamples(uint32_t *samples, uint8_t maxSamples);
+
+    // Serve reads of one ATT handle from library code instead of the user read callback,
+    // the handler gets the requesting connection and the read offset
+    void setReadHandler(uint16_t attHandle, uint16_t (*handler)(void *ctx, hci_con_handle_t con_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size), void *ctx);
+
+    // Get BluetoothLock hold and wait times of one API (needs BLESECURE_LOCK_PROFILING=1)
+    BLELockProfile getLockProfile(BLELockSite site);
+
+    // Clear the lock profiles of all APIs
+    void resetLockProfile();
+
+    // Get library and callback time of one SM event type (needs BLESECURE_EVENT_PROFILING=1)
+    BLEEventProfile getEventProfile(uint8_t smEventType);
+
+    // Clear the profiles of all SM event types
+    void resetEventProfile();
+
+    // Write the SM event profiles as CSV, one line per event type seen
+    void printEventProfileCSV(Print &out);
 
     // Flag to indicate if pairing should be automatically requested on connect
     bool _requestPairingOnConnect;
@@ -115,22 +521,313 @@ private:
     bool _useFixedPasskey;
     bool _bondingEnabled;
 
-    // Callback functions
-    void (*_passkeyDisplayCallback)(uint32_t passkey);
-    void (*_passkeyEntryCallback)(void);
-    void (*_pairingStatusCallback)(BLEPairingStatus status, BLEDevice *device);
-    void (*_numericComparisonCallback)(uint32_t passkey, BLEDevice *device);
+    // Callback functions, each passed its registered context.
+    // Plain function pointers are stored as the context of a forwarding stub.
+    void (*_passkeyDisplayCallback)(void *ctx, uint32_t passkey);
+    void *_passkeyDisplayContext;
+    void (*_passkeyEntryCallback)(void *ctx);
+    void *_passkeyEntryContext;
+    void (*_pairingStatusCallback)(void *ctx, BLEPairingStatus status, BLEDevice *device);
+    void *_pairingStatusContext;
+    void (*_numericComparisonCallback)(void *ctx, uint32_t passkey, BLEDevice *device);
+    void *_numericComparisonContext;
+    void (*_pairingResultCallback)(void *ctx, const BLEPairingResult &result, BLEDevice *device);
+    void *_pairingResultContext;
+    BLEPairingResult _lastPairingResult;
+    void (*_pairingStepHook)(void *ctx, BLEPairingStep step, hci_con_handle_t handle, uint32_t value);
+    void *_pairingStepContext;
+
+    void notifyPairingStep(BLEPairingStep step, hci_con_handle_t handle, uint32_t value)
+    {
+        if (_pairingStepHook)
+        {
+            BLESecureCallbackScope profile;
+            _pairingStepHook(_pairingStepContext, step, handle, value);
+        }
+    }
 
     // Connection and disconnection callbacks
-    void (*_userConnectedCallback)(BLEStatus status, BLEDevice *device);
-    void (*_userDisconnectedCallback)(BLEDevice *device);
+    void (*_userConnectedCallback)(void *ctx, BLEStatus status, BLEDevice *device);
+    void *_userConnectedContext;
+    void (*_userDisconnectedCallback)(void *ctx, BLEDevice *device);
+    void *_userDisconnectedContext;
+
+    // Holds a plain callback for the context-carrying setters, ctx points to the holder
+    template <typename R, typename... Args>
+    struct PlainCallback
+    {
+        R (*fn)(Args...);
+
+        static R call(void *ctx, Args... args)
+        {
+            return static_cast<PlainCallback *>(ctx)->fn(args...);
+        }
+    };
 
     // Store the current device handle for callbacks
     hci_con_handle_t _currentDeviceHandle;
 
+    // SM event subscriptions, and the SM events they let through (bit n = SM_EVENT_JUST_WORKS_REQUEST + n)
+    uint8_t _subscriptions;
+    uint32_t _smEventMask;
+
+    static uint32_t smEventMaskFor(uint8_t subscriptions);
+
+    bool isSMEventSubscribed(uint8_t eventType) const
+    {
+        uint8_t bit = eventType - SM_EVENT_JUST_WORKS_REQUEST;
+        return bit < 32 && (_smEventMask & (1UL << bit));
+    }
+
+    // Call the pairing status callback if subscribed
+    void reportPairingStatus(hci_con_handle_t handle);
+
+    // Collect the outcome of a pairing or re-encryption, before endSecurityPhase()
+    BLEPairingResult buildPairingResult(hci_con_handle_t handle, bool reencryption, uint8_t status, uint8_t reason);
+
+    // Store the outcome and call the pairing result callback if subscribed
+    void reportPairingResult(hci_con_handle_t handle, const BLEPairingResult &result);
+
+    // Outcome counters and recent latencies
+    BLESecurityCounters _securityCounters;
+    uint32_t _latencySamples[BLESECURE_LATENCY_SAMPLES];
+    uint8_t _latencySampleCount;
+    uint8_t _latencySampleNext;
+
+    // Count a finished pairing or re-encryption
+    void recordSecurityOutcome(const BLEPairingResult &result);
+
+    // Remember which method the running pairing uses
+    void setPairingMethod(hci_con_handle_t handle, BLEPairingMethod method);
+
+    // Pairing admission control
+    BLESecureRateLimiter _rateLimiter;
+    bool _rateLimitEnabled;
+
+    // Kept apart from ConnectionState, a flooding peer may hold a link without a slot.
+    // When full the oldest entry is replaced.
+    hci_con_handle_t _rejectedHandles[BLESECURE_REJECTED_HANDLES];
+    uint8_t _rejectedNext;
+
+    // Per-connection security state
+    typedef struct
+    {
+        hci_con_handle_t handle;
+        uint8_t securityLevel; // BLESecurityLevel reached on this link
+        uint8_t keySize;       // Encryption key size, 0 if not encrypted
+        int8_t bondIndex;      // LE device DB index, -1 if not bonded
+        uint16_t connInterval; // Current connection interval (units of 1.25 ms)
+        uint16_t txOctets;
+        uint16_t rxOctets;
+        uint8_t txPhy;
+        uint8_t rxPhy;
+        uint8_t upgradesPending; // BLELinkUpgrade flags not yet sent
+        uint8_t pairingMethod;   // BLEPairingMethod of the running pairing
+        uint32_t pairingStartMs;
+        bool firstDataSeen;
+        bool recoveryAttempted; // Stale-bond recovery was tried on this link, cleared on disconnect
+        bool recoveryRunning;   // Its fresh pairing has not finished yet
+        uint32_t recoveryStartMs;
+        uint32_t connectedAtMs;
+        uint32_t firstDataLatencyMs;
+    } ConnectionState;
+
+    ConnectionState _connections[BLESECURE_MAX_CONNECTIONS];
+
+    // Required security per ATT handle, indexed by handle:
+    // bits 0-1 BLESecurityLevel, bits 2-6 minimum key size (0 = any)
+    uint8_t _attSecurity[BLESECURE_MAX_ATT_HANDLES];
+    bool _requestPairingOnAccess;
+
+    // GATT callbacks
+    int (*_userGattWriteCallback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size);
+    void *_userGattWriteContext;
+    uint16_t (*_userGattReadCallback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size);
+    void *_userGattReadContext;
+
+    // Library-owned characteristic read before the user callback
+    uint16_t _readHandlerHandle;
+    uint16_t (*_readHandler)(void *ctx, hci_con_handle_t con_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
+    void *_readHandlerContext;
+
+    ConnectionState *findConnection(hci_con_handle_t handle);
+
+    // Rate limiter rejections, the link is being dropped
+    void markPairingRejected(hci_con_handle_t handle);
+    bool isPairingRejected(hci_con_handle_t handle) const;
+    void clearPairingRejected(hci_con_handle_t handle);
+    ConnectionState *addConnection(hci_con_handle_t handle);
+    void removeConnection(hci_con_handle_t handle);
+
+    // Refresh the cached security level of a connection from GAP
+    void updateConnectionSecurity(hci_con_handle_t handle);
+
+    // Check a connection against an ATT handle, returns 0 or an ATT error code.
+    // Callers look the connection up by the handle of the link being served.
+    int checkAccess(const ConnectionState *conn, uint16_t attHandle) const;
+
+    // Check the connection that sent an ATT request. For an access (not a length query)
+    // also request pairing if enabled and record the first data access.
+    int checkCharacteristicAccess(hci_con_handle_t handle, uint16_t attHandle, bool access);
+
+    // Route all ATT reads and writes through attReadCallback/attWriteCallback (once)
+    void registerAttServiceHandler();
+
+    // att_server callbacks that enforce characteristic security, they receive the requesting connection
+    static uint16_t attReadCallback(hci_con_handle_t con_handle, uint16_t att_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
+    static int attWriteCallback(hci_con_handle_t con_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
+
+    // Link upgrades after securing a connection
+    uint8_t _linkUpgrades;
+
+    // Queue the configured link upgrades for a connection
+    void startLinkUpgrade(hci_con_handle_t handle);
+
+    // Send queued link upgrade commands as the HCI command queue allows
+    void processLinkUpgrades();
+
+    static void linkUpgradeGattHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+    // Security phase connection parameters
+    bool _phaseConnParamsEnabled;
+    BLEConnectionParams _pairingConnParams[4];
+    BLEConnectionParams _steadyConnParams;
+    BLEPairingTimingStats _pairingTiming[4];
+
+    // Switch a connection to the pairing or steady-state parameters
+    void requestConnectionParams(hci_con_handle_t handle, const BLEConnectionParams &params);
+
+    // Pairing or re-encryption started on a connection
+    void beginSecurityPhase(hci_con_handle_t handle);
+
+    // Pairing or re-encryption finished, record timing for successful pairings
+    void endSecurityPhase(hci_con_handle_t handle, bool pairing, bool success);
+
+    // Fast reconnect advertising
+    bool _fastReconnectEnabled;
+    BLEReconnectAdvConfig _reconnectConfig;
+    BLEReconnectStats _reconnectStats;
+    BLEReconnectAdvPhase _reconnectPhase;
+    BLEReconnectAdvPhase _reconnectPhaseAtConnect;
+    int _lastBondIndex;
+    uint32_t _disconnectedAtMs;
+    btstack_timer_source_t _reconnectTimer;
+
+    // Filter Accept List
+    bool _restrictToBonded;
+    int _acceptListSize;
+    uint8_t _advFilterPolicy;
+    uint16_t _advIntervalMin; // Undirected advertising interval in effect
+    uint16_t _advIntervalMax;
+    uint16_t _savedAdvIntervalMin; // Interval before the reconnect schedule, restored when it ends
+    uint16_t _savedAdvIntervalMax;
+
+    // Apply advertising parameters with the current filter policy, remembers an undirected interval
+    void setAdvertisingParams(uint16_t intervalMin, uint16_t intervalMax, uint8_t advType, uint8_t directAddrType, bd_addr_t directAddr);
+
+    // Rebuild the accept list from the bond DB without taking the lock, false if it stays open for RPAs
+    bool updateAcceptList();
+
+    // Controller address resolution
+    enum
+    {
+        RESOLUTION_CMD_SET_ENABLE = 0x01,     // LE Set Address Resolution Enable with _controllerResolution
+        RESOLUTION_CMD_READ_LIST_SIZE = 0x02, // LE Read Resolving List Size
+    };
+    bool _controllerResolution;
+    bool _resolutionDisabled;         // Turned off with enableControllerAddressResolution(false)
+    uint8_t _resolutionCommands;      // RESOLUTION_CMD flags not sent yet
+    bool _resolutionEnableSent;       // Our Set Address Resolution Enable awaits its command complete
+    bool _resolutionEnableDisallowed; // The controller refused it while advertising, retry when that stops
+    bool _readResolvingListSize;      // The list size read awaits its command complete
+    BLEAddressResolutionStats _resolutionStats;
+
+    // Reload the controller resolving list from the bond DB
+    void updateResolvingList();
+
+    // Count bonds with an IRK for getAddressResolutionStats()
+    void countBondsWithIrk();
+
+    // Send queued address resolution commands as the HCI command queue allows
+    void processResolutionCommands();
+
+    // Keep accept list and resolving list in sync after a bond was added or removed
+    void onBondsChanged();
+
+    // Fast startup and boot timeline
+    bool _startupDeferred; // Startup tasks wait for advertising
+    bool _irkCountDeferred; // countBondsWithIrk() runs with the startup tasks
+    uint8_t _startupTaskCount;
+    void (*_startupTasks[BLESECURE_STARTUP_TASKS])(void *ctx);
+    void *_startupTaskContexts[BLESECURE_STARTUP_TASKS];
+    btstack_timer_source_t _startupTimer;
+    uint32_t _bootTimelineUs[BOOT_MILESTONE_COUNT];
+
+    // Start the deferred startup work on the next run loop pass
+    void scheduleDeferredStartup();
+
+    // Runs the deferred library work, then one startup task per run loop pass
+    static void startupTimerHandler(btstack_timer_source_t *ts);
+
+    // Switch the advertising parameters to a reconnect phase
+    void enterReconnectPhase(BLEReconnectAdvPhase phase);
+
+    // Record the reconnect time once a bonded peer has re-encrypted
+    void recordReconnect(hci_con_handle_t handle);
+
+    // Starts the schedule after a disconnect, then moves it to the next phase
+    static void reconnectTimerHandler(btstack_timer_source_t *ts);
+
+    // Event-driven loop support, set from the BTstack context and cleared by waitForEvent()
+    volatile bool _eventPending;
+    volatile uint32_t _eventSignalUs; // time_us_32() of the first signal since the last wakeup
+    spin_lock_t *_eventLock;          // Guards both, signalEvent() may run on the other core
+    BLEEventWaitStats _eventWaitStats;
+
+    // Stale-bond recovery
+    BLEStaleBondPolicy _staleBondPolicy;
+    BLEStaleBondStats _staleBondStats;
+
+    // Delete the local bond entry of a connected device without disconnecting
+    bool deleteLocalBond(hci_con_handle_t handle);
+
+    // Apply the stale-bond policy, returns true if recovery was started
+    bool recoverStaleBond(hci_con_handle_t handle, uint8_t status);
+
+    // Close out the running stale-bond recovery of a connection, if any
+    void finishStaleBondRecovery(ConnectionState *conn, bool success);
+
     // Register for Security Manager events
     void setupSMEventHandler();
 
+    // Register for HCI events
+    void setupHCIEventHandler();
+
+    // Configure security from a compile-time policy, smHandler replaces handleSMEvent
+    void beginFixed(io_capability_t ioCapability, BLESecurityLevel level, bool enableBonding, uint8_t authReq, btstack_packet_handler_t smHandler);
+
+    // Shared by both SM event handlers: HCI events only, profiling, unsubscribed prompts
+    // declined and waitForEvent() woken, then dispatch() handles the event
+    void runSMEvent(uint8_t packet_type, uint8_t *packet, void (*dispatch)(uint8_t eventType, uint8_t *packet));
+
+    // Event dispatch of handleSMEvent()
+    static void dispatchSMEvent(uint8_t eventType, uint8_t *packet);
+
+    // Decline a pairing prompt event that SM_SUBSCRIBE_PAIRING_PROMPTS filtered out
+    static void declineUnsubscribedPrompt(uint8_t eventType, uint8_t *packet);
+
+    // Pairing method prompts
+    void handleJustWorksRequest(uint8_t *packet);
+    void handlePasskeyDisplay(uint8_t *packet);
+    void handlePasskeyInput(uint8_t *packet);
+    void handleNumericComparison(uint8_t *packet);
+
+    // Pairing and re-encryption lifecycle, shared by all pairing methods
+    void handlePairingEvent(uint8_t *packet);
+
+    template <class Policy>
+    friend class BLESecureFixed;
+
     // Internal connection callback that handles auto-pairing
     static void internalConnectionCallback(BLEStatus status, BLEDevice *device);
 
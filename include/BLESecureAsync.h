@@ -0,0 +1,182 @@
+/**
+ * BLESecureAsync.h - Awaitable pairing steps for C++20 coroutines
+ *
+ * Lets a pairing flow be written as one coroutine instead of flags set in
+ * callbacks and polled in loop():
+ *
+ *   BLESecureTask secureFlow(BLEDevice *device)
+ *   {
+ *       BLEPairingResult result = co_await BLESecureAsync.pair(device);
+ *       if (result.status != ERROR_CODE_SUCCESS)
+ *           co_return;
+ *       ...
+ *   }
+ *
+ * Coroutines are resumed directly from BLESecure's SM and HCI handlers, so
+ * code between two co_await expressions runs in the BTstack context and must
+ * not block. Coroutine frames come from a static pool, nothing is allocated
+ * on the heap. If no frame is free the coroutine does not run and the
+ * returned BLESecureTask reports started() == false.
+ *
+ * Needs C++20 coroutines (e.g. build_flags = -std=gnu++20 -fcoroutines);
+ * without them this header declares nothing.
+ */
+
+#ifndef BLE_SECURE_ASYNC_H
+#define BLE_SECURE_ASYNC_H
+
+#include "BLESecure.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+
+#define BLESECURE_HAS_COROUTINES 1
+
+// Number of coroutines that can be alive at the same time
+#ifndef BLESECURE_ASYNC_FRAMES
+#define BLESECURE_ASYNC_FRAMES 2
+#endif
+
+// Bytes per coroutine frame, check getLargestFrameRequest() when tuning
+#ifndef BLESECURE_ASYNC_FRAME_SIZE
+#define BLESECURE_ASYNC_FRAME_SIZE 256
+#endif
+
+// Number of co_await expressions that can be pending at the same time
+#ifndef BLESECURE_ASYNC_WAITERS
+#define BLESECURE_ASYNC_WAITERS 4
+#endif
+
+// Return type of pairing coroutines, frames come from the static pool
+class BLESecureTask
+{
+public:
+    struct promise_type
+    {
+        BLESecureTask get_return_object() { return BLESecureTask(true); }
+        static BLESecureTask get_return_object_on_allocation_failure() { return BLESecureTask(false); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+
+        static void *operator new(size_t size) noexcept;
+        static void operator delete(void *frame) noexcept;
+    };
+
+    // False if no frame was free and the coroutine never ran
+    bool started() const { return _started; }
+
+private:
+    explicit BLESecureTask(bool started) : _started(started) {}
+    bool _started;
+};
+
+// Common part of the awaitables: parks the coroutine until a matching pairing step
+class BLESecureAwaiter
+{
+public:
+    bool await_ready() const noexcept { return _ready; }
+    bool await_suspend(std::coroutine_handle<> coroutine);
+
+protected:
+    BLESecureAwaiter(BLEPairingStep step, hci_con_handle_t handle, bool requestPairing);
+
+    BLEPairingStep _step;
+    hci_con_handle_t _handle; // HCI_CON_HANDLE_INVALID matches any connection
+    bool _requestPairing;     // Call BLESecure.requestPairing() once parked
+    bool _ready;
+    std::coroutine_handle<> _coroutine;
+    BLEPairingResult _result;
+    int32_t _value;
+
+    friend class BLESecureAsyncClass;
+};
+
+// co_await yields the BLEPairingResult of the pairing or re-encryption
+class BLEPairingAwaiter : public BLESecureAwaiter
+{
+public:
+    BLEPairingAwaiter(hci_con_handle_t handle, bool requestPairing) : BLESecureAwaiter(PAIRING_STEP_RESULT, handle, requestPairing) {}
+    BLEPairingResult await_resume() const noexcept { return _result; }
+
+    // Complete without suspending
+    void finish(const BLEPairingResult &result)
+    {
+        _result = result;
+        _ready = true;
+    }
+};
+
+// co_await yields the passkey (or 0 for a request), -1 if the connection closed first
+class BLEPasskeyAwaiter : public BLESecureAwaiter
+{
+public:
+    BLEPasskeyAwaiter(BLEPairingStep step, hci_con_handle_t handle) : BLESecureAwaiter(step, handle, false) {}
+    int32_t await_resume() const noexcept { return _value; }
+};
+
+// Frame pool counters
+typedef struct
+{
+    uint8_t framesInUse;
+    uint8_t peakFramesInUse;
+    uint16_t largestFrameRequest; // Largest frame the compiler asked for, in bytes
+    uint32_t allocFailures;       // Coroutines not started: pool empty or frame too large
+    uint32_t waiterOverflows;     // co_await completed at once because all waiter slots were busy
+} BLEAsyncStats;
+
+class BLESecureAsyncClass
+{
+public:
+    BLESecureAsyncClass();
+
+    // Hook into BLESecure, call after BLESecure.begin()
+    void begin();
+
+    // Request pairing and wait for the outcome (completes at once if already encrypted)
+    BLEPairingAwaiter pair(BLEDevice *device);
+
+    // Ask a bonded peer to re-encrypt and wait for the outcome (fails at once if not bonded)
+    BLEPairingAwaiter reencrypt(BLEDevice *device);
+
+    // Wait for the next pairing or re-encryption outcome on a connection without requesting it
+    BLEPairingAwaiter pairingResult(BLEDevice *device);
+
+    // Wait until the SM asks for a passkey on a connection
+    BLEPasskeyAwaiter passkeyRequested(BLEDevice *device);
+
+    // Wait until setEnteredPasskey() hands a passkey to the SM (any connection if device is nullptr)
+    BLEPasskeyAwaiter passkeyEntered(BLEDevice *device = nullptr);
+
+    // Frame pool counters
+    BLEAsyncStats getStats();
+
+    // Frame pool used by BLESecureTask::promise_type
+    void *allocFrame(size_t size);
+    void freeFrame(void *frame);
+
+private:
+    alignas(8) uint8_t _frames[BLESECURE_ASYNC_FRAMES][BLESECURE_ASYNC_FRAME_SIZE];
+    bool _frameUsed[BLESECURE_ASYNC_FRAMES];
+    BLESecureAwaiter *_waiters[BLESECURE_ASYNC_WAITERS];
+    BLEAsyncStats _stats;
+
+    bool addWaiter(BLESecureAwaiter *waiter);
+
+    // Resume every coroutine waiting for this step
+    void handlePairingStep(BLEPairingStep step, hci_con_handle_t handle, uint32_t value);
+
+    // Outcome for a link that is already encrypted
+    static BLEPairingResult currentLinkResult(hci_con_handle_t handle);
+
+    static void pairingStepHook(void *ctx, BLEPairingStep step, hci_con_handle_t handle, uint32_t value);
+
+    friend class BLESecureAwaiter;
+};
+
+extern BLESecureAsyncClass BLESecureAsync;
+
+#endif // __cpp_impl_coroutine
+
+#endif // BLE_SECURE_ASYNC_H
@@ -0,0 +1,121 @@
+/**
+ * BLESecureChannel.h - Encrypted bulk transfer over an LE credit-based L2CAP channel
+ *
+ * Accepts one LE Credit-Based Flow Control channel on a fixed PSM, but only
+ * from connections that reached the configured BLESecurityLevel. Outgoing
+ * SDUs are written in place into a ring of statically allocated slots and
+ * handed to L2CAP without copying; incoming SDUs are delivered straight
+ * from the L2CAP receive buffer.
+ */
+
+#ifndef BLE_SECURE_CHANNEL_H
+#define BLE_SECURE_CHANNEL_H
+
+#include "BLESecure.h"
+
+// Largest SDU exchanged over the channel
+#ifndef BLESECURE_CHANNEL_MTU
+#define BLESECURE_CHANNEL_MTU 512
+#endif
+
+// Number of outgoing SDUs that can be queued
+#ifndef BLESECURE_CHANNEL_TX_SLOTS
+#define BLESECURE_CHANNEL_TX_SLOTS 4
+#endif
+
+// Number of full SDUs the peer may send ahead (sets the initial credits)
+#ifndef BLESECURE_CHANNEL_RX_WINDOW
+#define BLESECURE_CHANNEL_RX_WINDOW 4
+#endif
+
+// Channel counters
+typedef struct
+{
+    uint32_t bytesSent;
+    uint32_t bytesReceived;
+    uint32_t sdusSent;
+    uint32_t sdusReceived;
+    uint32_t sendQueueFull;    // acquireSendBuffer() calls that found no free slot
+    uint32_t sendErrors;       // SDUs L2CAP refused to send, retried on the next can-send-now
+    uint32_t rejectedInsecure; // Channel requests declined for insufficient security
+} BLEChannelStats;
+
+class BLESecureChannelClass
+{
+public:
+    BLESecureChannelClass();
+
+    // Listen for channel requests on a PSM, only accepted on links at minLevel or above
+    bool begin(uint16_t psm, BLESecurityLevel minLevel = SECURITY_MEDIUM);
+
+    // True while a channel is open
+    bool isOpen();
+
+    // Get a free slot to write the next SDU into, nullptr if the send ring is full
+    uint8_t *acquireSendBuffer(uint16_t *capacity);
+
+    // Queue the slot returned by acquireSendBuffer() with the given length
+    bool commitSendBuffer(uint16_t length);
+
+    // Copy data into the next free slot and queue it
+    bool send(const uint8_t *data, uint16_t length);
+
+    // Number of queued SDUs not yet handed to L2CAP
+    uint8_t getQueuedCount();
+
+    // Close the channel
+    void disconnect();
+
+    // Callback for received SDUs (data is only valid during the callback)
+    void setReceiveCallback(void (*callback)(const uint8_t *data, uint16_t length));
+
+    // Callbacks for channel open/close
+    void setOpenCallback(void (*callback)(BLEDevice *device, uint16_t remoteMtu));
+    void setClosedCallback(void (*callback)(void));
+
+    // Get transfer counters
+    BLEChannelStats getStats();
+    void resetStats();
+
+    // Process L2CAP events - registered by begin()
+    void handleL2CAPEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+private:
+    uint16_t _psm;
+    BLESecurityLevel _minLevel;
+    uint16_t _localCid;
+    hci_con_handle_t _handle;
+    uint16_t _remoteMtu;
+    uint16_t _initialCredits;
+    uint16_t _pendingCredits;
+    BLEChannelStats _stats;
+
+    // Send ring: slots [_txTail, _txHead) are queued, _txTail is in flight when _txSending
+    uint8_t _txBuffers[BLESECURE_CHANNEL_TX_SLOTS][BLESECURE_CHANNEL_MTU];
+    uint16_t _txLengths[BLESECURE_CHANNEL_TX_SLOTS];
+    uint8_t _txHead;
+    uint8_t _txTail;
+    uint8_t _txCount;
+    bool _txSending;
+
+    // L2CAP reassembles incoming SDUs here
+    uint8_t _rxBuffer[BLESECURE_CHANNEL_MTU];
+
+    void (*_receiveCallback)(const uint8_t *data, uint16_t length);
+    void (*_openCallback)(BLEDevice *device, uint16_t remoteMtu);
+    void (*_closedCallback)(void);
+
+    // PDUs needed to carry an SDU of this length
+    uint16_t pdusForSdu(uint16_t length);
+
+    // Ask L2CAP for a send opportunity if data is waiting
+    void scheduleSend();
+
+    void resetRing();
+
+    static void l2capPacketHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+};
+
+extern BLESecureChannelClass BLESecureChannel;
+
+#endif // BLE_SECURE_CHANNEL_H
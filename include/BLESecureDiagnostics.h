@@ -0,0 +1,86 @@
+/**
+ * BLESecureDiagnostics.h - Security metrics as a GATT diagnostics service
+ *
+ * Adds a service with one read-only characteristic that returns a packed
+ * BLEDiagnosticsRecord: pairing and re-encryption counts, failure reasons,
+ * latency percentiles, bond DB occupancy and lock statistics. The record is
+ * built when a central reads it, nothing is updated per event. The
+ * characteristic is protected with BLESecure.setCharacteristicSecurity(),
+ * so reading it fails until the link is encrypted.
+ *
+ *   BLESecure.begin(...);
+ *   BLESecureDiagnostics.begin();   // before BTstack.startAdvertising()
+ *
+ * The record is 44 bytes. Centrals read it in one request with an ATT MTU of
+ * at least 47 (BLESecure.setLinkUpgrade(LINK_UPGRADE_MTU) helps), otherwise
+ * with Read Blob requests served from a copy taken at offset 0.
+ */
+
+#ifndef BLE_SECURE_DIAGNOSTICS_H
+#define BLE_SECURE_DIAGNOSTICS_H
+
+#include "BLESecure.h"
+
+// Layout version in the first byte of the record
+#define BLESECURE_DIAGNOSTICS_VERSION 1
+
+// Diagnostics record, little endian. Counts saturate instead of wrapping.
+typedef struct __attribute__((packed))
+{
+    uint8_t version;              // BLESECURE_DIAGNOSTICS_VERSION
+    uint32_t uptimeS;
+    uint16_t pairings;
+    uint16_t pairingFailures;
+    uint16_t reencryptions;
+    uint16_t reencryptionFailures;
+    uint8_t failureReasons[BLESECURE_FAILURE_REASONS]; // Pairing failures by SM reason
+    uint16_t latencyP50Ms;        // Over the recent successful pairings and re-encryptions
+    uint16_t latencyP90Ms;
+    uint16_t latencyMaxMs;
+    uint8_t latencySamples;       // Number of durations the percentiles are based on
+    uint8_t bondCount;            // Entries in the LE device DB
+    uint8_t bondCapacity;
+    uint32_t lockAcquisitions;    // BluetoothLock acquisitions by BLESecure (needs BLESECURE_LOCK_PROFILING)
+    uint16_t lockMaxHoldUs;       // Longest hold over all call sites
+    uint8_t lockMaxHoldSite;      // BLELockSite of that hold
+} BLEDiagnosticsRecord;
+
+class BLESecureDiagnosticsClass
+{
+public:
+    BLESecureDiagnosticsClass();
+
+    // Add the diagnostics service, readable at level or above (at least SECURITY_MEDIUM).
+    // Call after BLESecure.begin() and before advertising starts. Returns the value handle.
+    uint16_t begin(BLESecurityLevel level = SECURITY_MEDIUM);
+
+    // Build the record a read would return now
+    BLEDiagnosticsRecord getRecord();
+
+    // Value handle of the diagnostics characteristic, 0 before begin()
+    uint16_t getHandle();
+
+    // Reads served so far
+    uint32_t getReadCount();
+
+private:
+    uint16_t _handle;
+    uint32_t _reads;
+
+    // Record served to the Read Blob requests that follow a read at offset 0
+    BLEDiagnosticsRecord _snapshot;
+    hci_con_handle_t _snapshotHandle;
+
+    // Fill the latency percentiles from BLESecure's recent samples
+    static void computeLatency(BLEDiagnosticsRecord &record);
+
+    // Fill the lock fields from the lock profiles
+    static void computeLockStats(BLEDiagnosticsRecord &record);
+
+    // BLESecure read handler, ctx is this object
+    static uint16_t readHandler(void *ctx, hci_con_handle_t con_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size);
+};
+
+extern BLESecureDiagnosticsClass BLESecureDiagnostics;
+
+#endif // BLE_SECURE_DIAGNOSTICS_H
@@ -0,0 +1,184 @@
+/**
+ * BLESecureDualCore.h - Run BLESecure and BTstack on one core, the application on the other
+ *
+ * On arduino-pico setup()/loop() run on core0 and setup1()/loop1() on
+ * core1. BTstack and BLESecure stay on the core that called BTstack.setup()
+ * and BLESecure.begin(). The application on the other core talks to them
+ * only through lock-free single-producer/single-consumer rings in shared
+ * memory, so heavy application work never holds BluetoothLock or delays
+ * the stack:
+ *
+ *   // core0
+ *   void setup()  { BTstack.setup(); BLESecure.begin(...); BLESecureDualCore.begin(); }
+ *   void loop()   { BLESecure.waitForEvent(100); BLESecureDualCore.poll(); }
+ *
+ *   // core1
+ *   void loop1()
+ *   {
+ *     BLESecurityEvent event;
+ *     while (BLESecureDualCore.receiveEvent(&event)) ...
+ *     runSensorFusion();
+ *   }
+ *
+ * Commands posted from the application core wake the stack core's
+ * waitForEvent(). Events posted from the BTstack context wake a
+ * receiveEvent() that is waiting with a timeout. The SIO FIFOs are left
+ * alone, arduino-pico uses them to pause the other core during flash
+ * writes (including bond DB updates).
+ */
+
+#ifndef BLE_SECURE_DUAL_CORE_H
+#define BLE_SECURE_DUAL_CORE_H
+
+#include "BLESecure.h"
+#include "BLESecureEvent.h"
+#include "hardware/sync.h"
+
+// Commands waiting for the stack core (power of two)
+#ifndef BLESECURE_DUALCORE_COMMAND_RING_LEN
+#define BLESECURE_DUALCORE_COMMAND_RING_LEN 8
+#endif
+
+// Security events waiting for the application core (power of two)
+#ifndef BLESECURE_DUALCORE_EVENT_RING_LEN
+#define BLESECURE_DUALCORE_EVENT_RING_LEN 16
+#endif
+
+// Pairing prompts waiting for the application core (power of two)
+#ifndef BLESECURE_DUALCORE_PROMPT_RING_LEN
+#define BLESECURE_DUALCORE_PROMPT_RING_LEN 4
+#endif
+
+// Ring counters. Each field is written by one core only and is at most 32 bits wide,
+// so the other core never reads a half-written value.
+typedef struct
+{
+    uint32_t commandsPosted;      // Application core
+    uint32_t commandsDropped;     // Command ring was full
+    uint32_t commandsExecuted;    // Stack core
+    uint32_t maxCommandLatencyUs; // Post-to-execute time
+    uint32_t eventsPosted;        // Stack core
+    uint32_t eventsDropped;       // Event or prompt ring was full, the application is too slow
+    uint32_t promptsDeclined;     // Prompts dropped that way, their pairing was declined
+    uint8_t peakEventsQueued;
+    uint32_t eventsReceived;      // Application core
+    uint32_t lastEventLatencyUs;  // Post-to-receive time of the last event
+    uint32_t maxEventLatencyUs;
+    uint32_t totalEventLatencyUs; // Sum over all received events (for the mean), wraps after 4295 s in total
+} BLEDualCoreStats;
+
+// Lock-free ring for exactly one producer and one consumer, which may run on different cores
+template <typename T, uint32_t N>
+class BLESecureSPSCRing
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring length must be a power of two");
+
+public:
+    BLESecureSPSCRing() : _head(0), _tail(0) {}
+
+    // Producer side
+    bool push(const T &item)
+    {
+        uint32_t head = _head;
+        if (head - _tail == N)
+            return false;
+        _slots[head & (N - 1)] = item;
+        // The slot must be visible before the consumer sees the new head
+        __dmb();
+        _head = head + 1;
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T *item)
+    {
+        uint32_t tail = _tail;
+        if (tail == _head)
+            return false;
+        __dmb();
+        *item = _slots[tail & (N - 1)];
+        // Finish reading the slot before the producer may reuse it
+        __dmb();
+        _tail = tail + 1;
+        return true;
+    }
+
+    uint32_t size() const
+    {
+        return _head - _tail;
+    }
+
+private:
+    T _slots[N];
+    volatile uint32_t _head; // Written by the producer only
+    volatile uint32_t _tail; // Written by the consumer only
+};
+
+class BLESecureDualCoreClass
+{
+public:
+    BLESecureDualCoreClass();
+
+    // Stack core: call after BLESecure.begin(), on the core that runs BTstack.
+    // Takes over BLESecure's pairing, connection and passkey callbacks.
+    bool begin();
+
+    // Stack core: execute queued commands, call from loop() after waitForEvent().
+    // Returns the number of commands executed.
+    int poll();
+
+    // Application core: next security event, waits in WFE up to timeoutMs for one.
+    // Pairing prompts are returned before other events.
+    bool receiveEvent(BLESecurityEvent *event, uint32_t timeoutMs = 0);
+
+    // Application core: commands executed by poll() on the stack core.
+    // Return false if the command ring is full.
+    bool requestPairing(BLEDevice *device);
+    bool removeBonding(BLEDevice *device);
+    bool clearAllBondings();
+    bool setEnteredPasskey(uint32_t passkey);
+    bool acceptNumericComparison(bool accept);
+
+    // Core BLESecure and BTstack are pinned to
+    uint8_t getStackCore();
+
+    // Get ring counters and latencies
+    BLEDualCoreStats getStats();
+
+private:
+    typedef struct
+    {
+        BLESecurityCommand command;
+        uint32_t postedUs;
+    } Command;
+
+    typedef struct
+    {
+        BLESecurityEvent event;
+        uint32_t postedUs;
+    } EventSlot;
+
+    BLESecureSPSCRing<Command, BLESECURE_DUALCORE_COMMAND_RING_LEN> _commands;
+    BLESecureSPSCRing<EventSlot, BLESECURE_DUALCORE_EVENT_RING_LEN> _events;
+    BLESecureSPSCRing<EventSlot, BLESECURE_DUALCORE_PROMPT_RING_LEN> _prompts;
+
+    bool _started;
+    uint8_t _stackCore;
+    BLEDualCoreStats _stats;
+    BLESecureEventRouter _router;
+
+    bool postCommand(uint8_t type, hci_con_handle_t handle, uint32_t value);
+
+    // Called from the BTstack context, prompts use their own ring
+    void postEvent(const BLESecurityEvent &event, bool prompt);
+
+    // Take the next prompt or event and record its latency
+    bool takeEvent(BLESecurityEvent *event);
+
+    // Router callback, ctx is this object
+    static void onEvent(void *ctx, const BLESecurityEvent &event, bool prompt);
+};
+
+extern BLESecureDualCoreClass BLESecureDualCore;
+
+#endif // BLE_SECURE_DUAL_CORE_H
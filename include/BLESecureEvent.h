@@ -0,0 +1,85 @@
+/**
+ * BLESecureEvent.h - Security events passed between execution contexts
+ *
+ * BLESecureRTOS (FreeRTOS tasks) and BLESecureDualCore (core0/core1) copy
+ * BLESecure's callbacks into these events so the application can handle
+ * them outside the BTstack context, and pass the application's commands
+ * back. BLESecureEventRouter holds the part both share.
+ */
+
+#ifndef BLE_SECURE_EVENT_H
+#define BLE_SECURE_EVENT_H
+
+#include "BLESecure.h"
+
+// Security events delivered to the application
+typedef enum
+{
+    SECURITY_EVENT_CONNECTED,          // status = BLEStatus of the connection
+    SECURITY_EVENT_DISCONNECTED,
+    SECURITY_EVENT_PASSKEY_DISPLAY,    // Show passkey to the user (prompt)
+    SECURITY_EVENT_PASSKEY_REQUEST,    // Answer with setEnteredPasskey() (prompt)
+    SECURITY_EVENT_NUMERIC_COMPARISON, // Answer with acceptNumericComparison() (prompt)
+    SECURITY_EVENT_PAIRING_STATUS,     // status = BLEPairingStatus
+    SECURITY_EVENT_PAIRING_RESULT      // result holds the outcome
+} BLESecurityEventType;
+
+typedef struct
+{
+    BLESecurityEventType type;
+    hci_con_handle_t handle; // Connection (BLEDevice(handle)), HCI_CON_HANDLE_INVALID if not reported
+    union
+    {
+        uint8_t status;
+        uint32_t passkey;
+        BLEPairingResult result;
+    };
+} BLESecurityEvent;
+
+// Commands the application posts, executed in BLESecure's context
+typedef enum
+{
+    SECURITY_COMMAND_REQUEST_PAIRING,
+    SECURITY_COMMAND_REMOVE_BONDING,
+    SECURITY_COMMAND_CLEAR_ALL_BONDINGS,
+    SECURITY_COMMAND_SET_ENTERED_PASSKEY,
+    SECURITY_COMMAND_ACCEPT_NUMERIC_COMPARISON
+} BLESecurityCommandType;
+
+typedef struct
+{
+    uint8_t type; // BLESecurityCommandType
+    hci_con_handle_t handle;
+    uint32_t value;
+} BLESecurityCommand;
+
+// Turns BLESecure's callbacks into events for one consumer
+class BLESecureEventRouter
+{
+public:
+    // post() gets ctx, the event and whether it is a prompt that needs an answer
+    typedef void (*PostFunction)(void *ctx, const BLESecurityEvent &event, bool prompt);
+
+    BLESecureEventRouter(PostFunction post, void *ctx);
+
+    // Take over BLESecure's pairing, connection and passkey callbacks
+    void attach();
+
+    // Execute one command with BluetoothLock held by BLESecure
+    static void runCommand(const BLESecurityCommand &command);
+
+private:
+    PostFunction _post;
+    void *_ctx;
+
+    // BLESecure callbacks, ctx is this router
+    static void onConnected(void *ctx, BLEStatus status, BLEDevice *device);
+    static void onDisconnected(void *ctx, BLEDevice *device);
+    static void onPasskeyDisplay(void *ctx, uint32_t passkey);
+    static void onPasskeyEntry(void *ctx);
+    static void onNumericComparison(void *ctx, uint32_t passkey, BLEDevice *device);
+    static void onPairingStatus(void *ctx, BLEPairingStatus status, BLEDevice *device);
+    static void onPairingResult(void *ctx, const BLEPairingResult &result, BLEDevice *device);
+};
+
+#endif // BLE_SECURE_EVENT_H
@@ -0,0 +1,161 @@
+/**
+ * BLESecureLock.h - BluetoothLock with optional hold and wait time profiling
+ *
+ * BLESecure takes BluetoothLock through BLESecureLock, tagged with the API
+ * that takes it. With BLESECURE_LOCK_PROFILING set to 1, every acquisition
+ * records how long the caller waited for the lock and how long it was held,
+ * per call site, using BLESecureProfiler's clock. Without it
+ * BLESecureLock is a plain BluetoothLock.
+ *
+ * Acquisitions while the lock is already held (an API called from a
+ * BLESecure callback, or requestPairing() on access) are not recorded: they
+ * neither wait nor add hold time of their own. BTstack callbacks run with
+ * the lock held, so BLESecure marks them with BLESecureLockHeldScope.
+ */
+
+#ifndef BLE_SECURE_LOCK_H
+#define BLE_SECURE_LOCK_H
+
+#include <Arduino.h>
+#include "BluetoothLock.h"
+#include "BLESecureProfiler.h"
+
+// Record lock hold and wait times (build_flags = -DBLESECURE_LOCK_PROFILING=1)
+#ifndef BLESECURE_LOCK_PROFILING
+#define BLESECURE_LOCK_PROFILING 0
+#endif
+
+// Hold time histogram: bucket 0 is < 1 us, bucket n is [2^(n-1), 2^n) us, the last is open
+#define BLESECURE_LOCK_HISTOGRAM_BUCKETS 12
+
+// BLESecure APIs that take BluetoothLock, one site per API
+typedef enum
+{
+    LOCK_SITE_BEGIN,                           // begin()
+    LOCK_SITE_SET_SECURITY_LEVEL,              // setSecurityLevel()
+    LOCK_SITE_ALLOW_RECONNECTION,              // allowReconnectionWithoutDatabaseEntry()
+    LOCK_SITE_SET_FIXED_PASSKEY,               // setFixedPasskey()
+    LOCK_SITE_REQUEST_PAIRING,                 // requestPairing()
+    LOCK_SITE_REMOVE_BONDING,                  // removeBonding()
+    LOCK_SITE_CLEAR_ALL_BONDINGS,              // clearAllBondings()
+    LOCK_SITE_SET_PASSKEY_DISPLAY_CALLBACK,    // setPasskeyDisplayCallback()
+    LOCK_SITE_SET_PASSKEY_ENTRY_CALLBACK,      // setPasskeyEntryCallback()
+    LOCK_SITE_SET_ENTERED_PASSKEY,             // setEnteredPasskey()
+    LOCK_SITE_SET_PAIRING_STATUS_CALLBACK,     // setPairingStatusCallback()
+    LOCK_SITE_SET_PAIRING_RESULT_CALLBACK,     // setPairingResultCallback()
+    LOCK_SITE_GET_LAST_PAIRING_RESULT,         // getLastPairingResult()
+    LOCK_SITE_SET_PAIRING_STEP_HOOK,           // setPairingStepHook()
+    LOCK_SITE_SET_NUMERIC_COMPARISON_CALLBACK, // setNumericComparisonCallback()
+    LOCK_SITE_ACCEPT_NUMERIC_COMPARISON,       // acceptNumericComparison()
+    LOCK_SITE_DECLINE_PAIRING,                 // declinePairing()
+    LOCK_SITE_IS_ENCRYPTED,                    // isEncrypted()
+    LOCK_SITE_SET_CONNECTED_CALLBACK,          // setBLEDeviceConnectedCallback()
+    LOCK_SITE_SET_DISCONNECTED_CALLBACK,       // setBLEDeviceDisconnectedCallback()
+    LOCK_SITE_SET_PAIRING_RATE_LIMIT,          // setPairingRateLimit()
+    LOCK_SITE_GET_PAIRING_RATE_LIMIT_STATS,    // getPairingRateLimitStats()
+    LOCK_SITE_RESET_PAIRING_RATE_LIMIT,        // resetPairingRateLimit()
+    LOCK_SITE_IS_ACCESS_ALLOWED,               // isAccessAllowed()
+    LOCK_SITE_SET_GATT_WRITE,                  // setGATTCharacteristicWrite()
+    LOCK_SITE_SET_GATT_READ,                   // setGATTCharacteristicRead()
+    LOCK_SITE_GET_SECURITY_LEVEL,              // getSecurityLevel()
+    LOCK_SITE_GET_FIRST_DATA_LATENCY,          // getFirstDataLatency()
+    LOCK_SITE_GET_SECURITY_COUNTERS,           // getSecurityCounters()
+    LOCK_SITE_GET_SECURITY_LATENCY_SAMPLES,    // getSecurityLatencySamples()
+    LOCK_SITE_SET_READ_HANDLER,                // setReadHandler()
+    LOCK_SITE_GET_LINK_INFO,                   // getLinkInfo()
+    LOCK_SITE_GET_PAIRING_TIMING_STATS,        // getPairingTimingStats()
+    LOCK_SITE_START_RECONNECT_ADVERTISING,     // startReconnectAdvertising()
+    LOCK_SITE_GET_RECONNECT_STATS,             // getReconnectStats()
+    LOCK_SITE_RESTRICT_TO_BONDED_DEVICES,      // restrictToBondedDevices()
+    LOCK_SITE_REFRESH_ACCEPT_LIST,             // refreshAcceptList()
+    LOCK_SITE_ENABLE_ADDRESS_RESOLUTION,       // enableControllerAddressResolution()
+    LOCK_SITE_GET_ADDRESS_RESOLUTION_STATS,    // getAddressResolutionStats()
+    LOCK_SITE_SET_FAST_STARTUP,                // setFastStartup()
+    LOCK_SITE_DEFER_STARTUP_TASK,              // deferStartupTask()
+    LOCK_SITE_GET_STALE_BOND_STATS,            // getStaleBondStats()
+    LOCK_SITE_SET_EVENT_SUBSCRIPTIONS,         // setEventSubscriptions()
+    LOCK_SITE_COUNT
+} BLELockSite;
+
+// Lock timing of one call site, times in nanoseconds
+typedef struct
+{
+    uint32_t acquisitions;
+    uint32_t maxHoldNs;
+    uint64_t totalHoldNs; // Sum over all acquisitions (for the mean)
+    uint32_t maxWaitNs;
+    uint64_t totalWaitNs; // Sum over all acquisitions (for the mean)
+    uint32_t holdHistogram[BLESECURE_LOCK_HISTOGRAM_BUCKETS];
+} BLELockProfile;
+
+class BLESecureLock
+{
+public:
+#if BLESECURE_LOCK_PROFILING
+    explicit BLESecureLock(BLELockSite site) : _site(site), _requested(BLESecureProfiler::ticks()), _lock()
+    {
+        _acquired = BLESecureProfiler::ticks();
+        _nested = _depth++ > 0;
+    }
+
+    // Runs before _lock is released, so the profile is updated under the lock
+    ~BLESecureLock()
+    {
+        _depth--;
+        if (!_nested)
+            record(_site, _acquired - _requested, BLESecureProfiler::ticks() - _acquired);
+    }
+#else
+    explicit BLESecureLock(BLELockSite site)
+    {
+        (void)site;
+    }
+#endif
+
+    // Copy of one call site's timing (zero when profiling is compiled out)
+    static BLELockProfile getProfile(BLELockSite site);
+
+    // Clear all call sites
+    static void resetProfiles();
+
+    // Short name of a call site for reports
+    static const char *siteName(BLELockSite site);
+
+private:
+    friend class BLESecureLockHeldScope;
+
+#if BLESECURE_LOCK_PROFILING
+    uint8_t _site;
+    bool _nested;
+    uint32_t _requested; // Profiling clock ticks, must be initialised before _lock
+    uint32_t _acquired;
+
+    // Lock holders that know of each other, only changed with the lock held
+    static uint8_t _depth;
+
+    static void record(uint8_t site, uint32_t waitTicks, uint32_t holdTicks);
+#endif
+
+    BluetoothLock _lock;
+};
+
+// Marks a BTstack callback, which runs with BluetoothLock already held
+class BLESecureLockHeldScope
+{
+public:
+#if BLESECURE_LOCK_PROFILING
+    BLESecureLockHeldScope()
+    {
+        BLESecureLock::_depth++;
+    }
+
+    ~BLESecureLockHeldScope()
+    {
+        BLESecureLock::_depth--;
+    }
+#else
+    BLESecureLockHeldScope() {}
+#endif
+};
+
+#endif // BLE_SECURE_LOCK_H
@@ -0,0 +1,54 @@
+/**
+ * BLESecureNoHeap.h - Compile-time guard against heap use in the library
+ *
+ * With BLESECURE_NO_HEAP=1 in build_flags the library must not allocate:
+ *
+ * - The library sources include this header after all other headers, so a
+ *   later use of String or of the C allocators fails to compile.
+ * - BLESecureNoHeapFunctor() rejects functors that std::function would store
+ *   on the heap instead of in its small local buffer.
+ *
+ * The footprint report (examples/FootprintReport) also checks the linked
+ * firmware for library objects that reference malloc or operator new.
+ */
+
+#ifndef BLE_SECURE_NO_HEAP_H
+#define BLE_SECURE_NO_HEAP_H
+
+#include <functional>
+#include <type_traits>
+
+#ifndef BLESECURE_NO_HEAP
+#define BLESECURE_NO_HEAP 0
+#endif
+
+// libstdc++ keeps a functor inside std::function only if it is trivially copyable
+// and fits _Any_data (two pointers' worth of storage)
+template <typename F>
+struct BLESecureFunctorIsLocal
+{
+#if defined(__GLIBCXX__)
+    static constexpr bool value = std::is_trivially_copyable<F>::value &&
+                                  sizeof(F) <= sizeof(std::_Any_data) &&
+                                  alignof(std::_Any_data) % alignof(F) == 0;
+#else
+    static constexpr bool value = true;
+#endif
+};
+
+// Pass a functor through on its way into a std::function
+template <typename F>
+inline F BLESecureNoHeapFunctor(F functor)
+{
+#if BLESECURE_NO_HEAP
+    static_assert(BLESecureFunctorIsLocal<F>::value, "BLESECURE_NO_HEAP: std::function would allocate this functor on the heap");
+#endif
+    return functor;
+}
+
+#if BLESECURE_NO_HEAP
+// String allocates on construction and on every concatenation
+#pragma GCC poison String malloc calloc realloc strdup
+#endif
+
+#endif // BLE_SECURE_NO_HEAP_H
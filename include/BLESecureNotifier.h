@@ -0,0 +1,90 @@
+/**
+ * BLESecureNotifier.h - Queued notifications gated on link security
+ *
+ * Notifications are queued per connection and held until the link reaches
+ * the security level configured for the characteristic with
+ * BLESecure.setCharacteristicSecurity(). The queue is drained when ATT can
+ * send, and each pass sends as many notifications as the controller has
+ * buffers for, so several go out in the same connection event.
+ */
+
+#ifndef BLE_SECURE_NOTIFIER_H
+#define BLE_SECURE_NOTIFIER_H
+
+#include "BLESecure.h"
+#include "ble/att_server.h"
+
+// Bytes of queued notifications per connection (3 bytes of overhead per notification)
+#ifndef BLESECURE_NOTIFY_QUEUE_SIZE
+#define BLESECURE_NOTIFY_QUEUE_SIZE 1024
+#endif
+
+// Notification queue counters for one connection
+typedef struct
+{
+    uint16_t queuedBytes;     // Payload bytes currently waiting
+    uint16_t queuedCount;     // Notifications currently waiting
+    uint16_t peakQueuedBytes; // Highest queuedBytes seen
+    uint16_t maxBurst;        // Most notifications sent in one drain pass
+    uint32_t sentCount;       // Notifications handed to the controller
+    uint32_t sentBytes;
+    uint32_t droppedCount; // Rejected because the queue was full or too long for the MTU
+    uint32_t droppedBytes;
+} BLENotifyQueueStats;
+
+class BLESecureNotifierClass
+{
+public:
+    BLESecureNotifierClass();
+
+    // Register for the events that release held notifications
+    void begin();
+
+    // Queue a notification, returns false (and counts a drop) if the queue is full
+    bool notify(BLEDevice *device, uint16_t attHandle, const void *data, uint16_t length);
+
+    // Free space in the connection's queue, usable for back-pressure
+    uint16_t getFreeSpace(BLEDevice *device);
+
+    // Discard everything queued for a connection
+    void clear(BLEDevice *device);
+
+    // Get queue counters for a connection
+    BLENotifyQueueStats getStats(BLEDevice *device);
+
+    // Process HCI and SM events - registered by begin()
+    void handleEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+private:
+    // Records are stored back to back as [attHandle:2][length:2][data]
+    typedef struct
+    {
+        hci_con_handle_t handle;
+        uint8_t buffer[BLESECURE_NOTIFY_QUEUE_SIZE];
+        uint16_t head; // Offset of the oldest record
+        uint16_t tail; // Offset past the newest record
+        bool drainPending;
+        btstack_context_callback_registration_t sendRequest;
+        BLENotifyQueueStats stats;
+    } NotifyQueue;
+
+    NotifyQueue _queues[BLESECURE_MAX_CONNECTIONS];
+    bool _registered;
+
+    NotifyQueue *findQueue(hci_con_handle_t handle);
+    NotifyQueue *allocQueue(hci_con_handle_t handle);
+    void releaseQueue(NotifyQueue *queue);
+
+    // Ask ATT for a send opportunity if the head record may be sent
+    void scheduleDrain(NotifyQueue *queue);
+
+    // Send queued notifications until the queue is empty or the controller is out of buffers
+    void drain(NotifyQueue *queue);
+
+    static void eventHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+    static void sendRequestHandler(void *context);
+};
+
+extern BLESecureNotifierClass BLESecureNotifier;
+
+#endif // BLE_SECURE_NOTIFIER_H
@@ -0,0 +1,161 @@
+/**
+ * BLESecurePolicy.h - Compile-time security policy for BLESecure
+ *
+ * BLESecureFixed<Policy> configures BLESecure from a policy whose security
+ * level, bonding, IO capability and pairing methods are constants. Its SM
+ * event handler only contains the prompts of the enabled pairing methods,
+ * requests for any other method are declined. Use it instead of
+ * BLESecure.begin() and BLESecure.setSecurityLevel(): the runtime setup
+ * path and the unused prompt handlers are then never referenced, so a
+ * build with --gc-sections can discard them (see the FootprintReport
+ * example to measure it).
+ *
+ *   using AppSecurity = BLESecureFixed<BLESecurityPolicy<SECURITY_HIGH_SC, true, IO_CAPABILITY_DISPLAY_YES_NO>>;
+ *   AppSecurity::begin();
+ *   AppSecurity::setNumericComparisonCallback(onNumericComparison);
+ */
+
+#ifndef BLE_SECURE_POLICY_H
+#define BLE_SECURE_POLICY_H
+
+#include "BLESecure.h"
+
+// Pairing methods an IO capability can complete at a security level
+constexpr uint8_t blesecurePairingMethods(io_capability_t io, BLESecurityLevel level)
+{
+    return level == SECURITY_LOW
+               ? PAIRING_METHOD_NONE
+               : ((level < SECURITY_HIGH ? PAIRING_METHOD_JUST_WORKS : 0) |
+                  ((io == IO_CAPABILITY_DISPLAY_ONLY || io == IO_CAPABILITY_DISPLAY_YES_NO || io == IO_CAPABILITY_KEYBOARD_DISPLAY) ? PAIRING_METHOD_PASSKEY_DISPLAY : 0) |
+                  ((io == IO_CAPABILITY_KEYBOARD_ONLY || io == IO_CAPABILITY_KEYBOARD_DISPLAY) ? PAIRING_METHOD_PASSKEY_ENTRY : 0) |
+                  ((level == SECURITY_HIGH_SC && (io == IO_CAPABILITY_DISPLAY_YES_NO || io == IO_CAPABILITY_KEYBOARD_DISPLAY)) ? PAIRING_METHOD_NUMERIC_COMPARISON : 0));
+}
+
+// Security policy, Methods defaults to every method the IO capability can use at Level
+template <BLESecurityLevel Level, bool Bonding, io_capability_t IoCapability,
+          uint8_t Methods = blesecurePairingMethods(IoCapability, Level)>
+struct BLESecurityPolicy
+{
+    static constexpr BLESecurityLevel level = Level;
+    static constexpr bool bonding = Bonding;
+    static constexpr io_capability_t ioCapability = IoCapability;
+    static constexpr uint8_t methods = Methods;
+    static constexpr uint8_t authReq = blesecureAuthReq(Level, Bonding);
+
+    static_assert(Level == SECURITY_LOW || Methods != PAIRING_METHOD_NONE,
+                  "No enabled pairing method can reach this security level with this IO capability");
+    static_assert((Methods & PAIRING_METHOD_NUMERIC_COMPARISON) == 0 || Level == SECURITY_HIGH_SC,
+                  "Numeric comparison needs Secure Connections (SECURITY_HIGH_SC)");
+};
+
+template <class Policy>
+class BLESecureFixed
+{
+public:
+    static constexpr BLESecurityLevel level = Policy::level;
+    static constexpr uint8_t methods = Policy::methods;
+
+    // Replaces BLESecure.begin() and BLESecure.setSecurityLevel()
+    static void begin()
+    {
+        BLESecure.beginFixed(Policy::ioCapability, Policy::level, Policy::bonding, Policy::authReq, smEventHandler);
+    }
+
+    // Pairing callbacks only exist for the methods the policy enables
+    static void setPasskeyDisplayCallback(void (*callback)(uint32_t passkey))
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_PASSKEY_DISPLAY, "Passkey display is not enabled by this policy");
+        BLESecure.setPasskeyDisplayCallback(callback);
+    }
+
+    static void setPasskeyDisplayCallback(void (*callback)(void *ctx, uint32_t passkey), void *ctx)
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_PASSKEY_DISPLAY, "Passkey display is not enabled by this policy");
+        BLESecure.setPasskeyDisplayCallback(callback, ctx);
+    }
+
+    static void setPasskeyEntryCallback(void (*callback)(void))
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_PASSKEY_ENTRY, "Passkey entry is not enabled by this policy");
+        BLESecure.setPasskeyEntryCallback(callback);
+    }
+
+    static void setPasskeyEntryCallback(void (*callback)(void *ctx), void *ctx)
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_PASSKEY_ENTRY, "Passkey entry is not enabled by this policy");
+        BLESecure.setPasskeyEntryCallback(callback, ctx);
+    }
+
+    static void setEnteredPasskey(uint32_t passkey)
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_PASSKEY_ENTRY, "Passkey entry is not enabled by this policy");
+        BLESecure.setEnteredPasskey(passkey);
+    }
+
+    static void setNumericComparisonCallback(void (*callback)(uint32_t passkey, BLEDevice *device))
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_NUMERIC_COMPARISON, "Numeric comparison is not enabled by this policy");
+        BLESecure.setNumericComparisonCallback(callback);
+    }
+
+    static void setNumericComparisonCallback(void (*callback)(void *ctx, uint32_t passkey, BLEDevice *device), void *ctx)
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_NUMERIC_COMPARISON, "Numeric comparison is not enabled by this policy");
+        BLESecure.setNumericComparisonCallback(callback, ctx);
+    }
+
+    static void acceptNumericComparison(bool accept)
+    {
+        static_assert(Policy::methods & PAIRING_METHOD_NUMERIC_COMPARISON, "Numeric comparison is not enabled by this policy");
+        BLESecure.acceptNumericComparison(accept);
+    }
+
+private:
+    static void smEventHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+    {
+        (void)channel;
+        (void)size;
+        BLESecure.runSMEvent(packet_type, packet, dispatch);
+    }
+
+    // Only the prompts of enabled methods reach their handlers
+    static void dispatch(uint8_t eventType, uint8_t *packet)
+    {
+        switch (eventType)
+        {
+        case SM_EVENT_JUST_WORKS_REQUEST:
+            if constexpr ((Policy::methods & PAIRING_METHOD_JUST_WORKS) != 0)
+                BLESecure.handleJustWorksRequest(packet);
+            else
+                sm_bonding_decline(sm_event_just_works_request_get_handle(packet));
+            break;
+
+        case SM_EVENT_PASSKEY_DISPLAY_NUMBER:
+            if constexpr ((Policy::methods & PAIRING_METHOD_PASSKEY_DISPLAY) != 0)
+                BLESecure.handlePasskeyDisplay(packet);
+            else
+                sm_bonding_decline(sm_event_passkey_display_number_get_handle(packet));
+            break;
+
+        case SM_EVENT_PASSKEY_INPUT_NUMBER:
+            if constexpr ((Policy::methods & PAIRING_METHOD_PASSKEY_ENTRY) != 0)
+                BLESecure.handlePasskeyInput(packet);
+            else
+                sm_bonding_decline(sm_event_passkey_input_number_get_handle(packet));
+            break;
+
+        case SM_EVENT_NUMERIC_COMPARISON_REQUEST:
+            if constexpr ((Policy::methods & PAIRING_METHOD_NUMERIC_COMPARISON) != 0)
+                BLESecure.handleNumericComparison(packet);
+            else
+                sm_bonding_decline(sm_event_numeric_comparison_request_get_handle(packet));
+            break;
+
+        default:
+            BLESecure.handlePairingEvent(packet);
+            break;
+        }
+    }
+};
+
+#endif // BLE_SECURE_POLICY_H
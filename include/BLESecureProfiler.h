@@ -0,0 +1,120 @@
+/**
+ * BLESecureProfiler.h - Cost of SM events inside BLESecure and inside user callbacks
+ *
+ * With BLESECURE_EVENT_PROFILING set to 1, handleSMEvent() timestamps the
+ * entry and exit of every SM event, and every user callback it calls is
+ * timed separately. Per SM event type the profiler keeps the time spent in
+ * the library (total minus callbacks) and the time spent in callbacks.
+ * Without it the scopes are empty and compile away.
+ *
+ * The profiling clock is also used by BLESecureLock: the microsecond timer
+ * on RP2040 and the DWT cycle counter on RP2350 (Arm cores).
+ */
+
+#ifndef BLE_SECURE_PROFILER_H
+#define BLE_SECURE_PROFILER_H
+
+#include <Arduino.h>
+
+// Time SM events and user callbacks (build_flags = -DBLESECURE_EVENT_PROFILING=1)
+#ifndef BLESECURE_EVENT_PROFILING
+#define BLESECURE_EVENT_PROFILING 0
+#endif
+
+// SM event types profiled, starting at SM_EVENT_JUST_WORKS_REQUEST
+#define BLESECURE_PROFILED_SM_EVENTS 24
+
+// Cost of one SM event type, times in nanoseconds
+typedef struct
+{
+    uint32_t events;            // handleSMEvent() calls for this type
+    uint32_t libraryMaxNs;      // Time in BLESecure, callbacks excluded
+    uint64_t libraryTotalNs;    // Sum over all events (for the mean)
+    uint32_t callbacks;         // User callbacks called while handling it
+    uint32_t callbackMaxNs;     // Longest single callback
+    uint64_t callbackTotalNs;   // Sum over all callbacks (for the mean)
+} BLEEventProfile;
+
+class BLESecureProfiler
+{
+public:
+    // Profiling clock ticks: microseconds on RP2040, CPU cycles on RP2350
+    static uint32_t ticks();
+    static uint32_t ticksToNs(uint32_t ticks);
+
+    // Start the cycle counter if the clock needs one, called by BLESecure.begin()
+    static void startClock();
+
+    // Copy of one SM event type's profile (zero when profiling is compiled out)
+    static BLEEventProfile getEventProfile(uint8_t smEventType);
+
+    // Clear all SM event types
+    static void resetEventProfiles();
+
+    // Write all SM event types that occurred as CSV, with a header line
+    static void printEventProfileCSV(Print &out);
+
+private:
+    friend class BLESecureEventScope;
+    friend class BLESecureCallbackScope;
+
+#if BLESECURE_EVENT_PROFILING
+    static void recordEvent(uint8_t smEventType, uint32_t totalTicks, uint32_t callbackTicks);
+    static void recordCallback(uint32_t ticks);
+
+    // Callback time of the SM event being handled, only touched from the BTstack context
+    static bool _inEvent;
+    static uint8_t _eventType;
+    static uint32_t _callbackTicks;
+#endif
+};
+
+// Times one handleSMEvent() call
+class BLESecureEventScope
+{
+public:
+#if BLESECURE_EVENT_PROFILING
+    explicit BLESecureEventScope(uint8_t smEventType) : _eventType(smEventType), _start(BLESecureProfiler::ticks())
+    {
+        BLESecureProfiler::_inEvent = true;
+        BLESecureProfiler::_eventType = smEventType;
+        BLESecureProfiler::_callbackTicks = 0;
+    }
+
+    ~BLESecureEventScope()
+    {
+        BLESecureProfiler::recordEvent(_eventType, BLESecureProfiler::ticks() - _start, BLESecureProfiler::_callbackTicks);
+        BLESecureProfiler::_inEvent = false;
+    }
+
+private:
+    uint8_t _eventType;
+    uint32_t _start;
+#else
+    explicit BLESecureEventScope(uint8_t smEventType)
+    {
+        (void)smEventType;
+    }
+#endif
+};
+
+// Times one user callback, counted against the SM event being handled
+class BLESecureCallbackScope
+{
+public:
+#if BLESECURE_EVENT_PROFILING
+    BLESecureCallbackScope() : _start(BLESecureProfiler::ticks()) {}
+
+    ~BLESecureCallbackScope()
+    {
+        BLESecureProfiler::recordCallback(BLESecureProfiler::ticks() - _start);
+    }
+
+private:
+    uint32_t _start;
+#else
+    BLESecureCallbackScope() {}
+#endif
+};
+
+#endif // BLE_SECURE_PROFILER_H
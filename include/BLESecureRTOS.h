@@ -0,0 +1,129 @@
+/**
+ * BLESecureRTOS.h - FreeRTOS integration for BLESecure
+ *
+ * With FreeRTOS enabled in arduino-pico, BLESecureRTOS gives BLESecure a
+ * dedicated high-priority owner task. Application tasks do not call
+ * BLESecure or take BluetoothLock themselves. They post commands
+ * (requestPairing, removeBonding, setEnteredPasskey, ...) to the owner
+ * task, and they receive security events (connections, passkey prompts,
+ * pairing status and results) from a queue at their own priority:
+ *
+ *   BLESecure.begin(IO_CAPABILITY_DISPLAY_YES_NO);
+ *   BLESecureRTOS.begin();
+ *
+ *   // In an application task
+ *   BLESecurityEvent event;
+ *   if (BLESecureRTOS.receiveEvent(&event, portMAX_DELAY)) ...
+ *
+ * Pairing prompts keep their order in the event queue, and the last
+ * BLESECURE_RTOS_PROMPT_SLOTS slots are kept free for them. A prompt that
+ * still finds the queue full declines the pairing, since the Security
+ * Manager would only time out waiting for an answer. All tasks, queues and
+ * stacks are allocated statically.
+ *
+ * Needs FreeRTOS (build_flags = -DPIO_FRAMEWORK_ARDUINO_ENABLE_FREERTOS);
+ * without it this header declares nothing.
+ */
+
+#ifndef BLE_SECURE_RTOS_H
+#define BLE_SECURE_RTOS_H
+
+#include "BLESecure.h"
+#include "BLESecureEvent.h"
+
+#ifdef __FREERTOS
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+
+// Priority of the owner task, above normal application tasks
+#ifndef BLESECURE_RTOS_PRIORITY
+#define BLESECURE_RTOS_PRIORITY (configMAX_PRIORITIES - 2)
+#endif
+
+// Owner task stack, in words
+#ifndef BLESECURE_RTOS_STACK_SIZE
+#define BLESECURE_RTOS_STACK_SIZE 1024
+#endif
+
+// Commands waiting for the owner task
+#ifndef BLESECURE_RTOS_COMMAND_QUEUE_LEN
+#define BLESECURE_RTOS_COMMAND_QUEUE_LEN 8
+#endif
+
+// Security events waiting for the application
+#ifndef BLESECURE_RTOS_EVENT_QUEUE_LEN
+#define BLESECURE_RTOS_EVENT_QUEUE_LEN 8
+#endif
+
+// Event queue slots only pairing prompts may take
+#ifndef BLESECURE_RTOS_PROMPT_SLOTS
+#define BLESECURE_RTOS_PROMPT_SLOTS 2
+#endif
+
+// Queue counters
+typedef struct
+{
+    uint32_t commandsPosted;
+    uint32_t commandsDropped; // Command queue was full
+    uint32_t eventsPosted;
+    uint32_t eventsDropped;   // Event queue was full, the application is too slow
+    uint32_t promptsDeclined; // Prompts dropped that way, their pairing was declined
+    uint8_t peakEventsQueued;
+} BLERTOSStats;
+
+class BLESecureRTOSClass
+{
+public:
+    BLESecureRTOSClass();
+
+    // Create the owner task and queues, call after BLESecure.begin().
+    // Takes over BLESecure's pairing, connection and passkey callbacks.
+    bool begin();
+
+    // Wait up to timeout ticks for the next security event
+    bool receiveEvent(BLESecurityEvent *event, TickType_t timeout);
+
+    // Thread-safe commands, executed by the owner task.
+    // Return false if the command queue stays full for timeout ticks.
+    bool requestPairing(BLEDevice *device, TickType_t timeout = 0);
+    bool removeBonding(BLEDevice *device, TickType_t timeout = 0);
+    bool clearAllBondings(TickType_t timeout = 0);
+    bool setEnteredPasskey(uint32_t passkey, TickType_t timeout = 0);
+    bool acceptNumericComparison(bool accept, TickType_t timeout = 0);
+
+    // Get queue counters
+    BLERTOSStats getStats();
+
+private:
+    StaticTask_t _taskBuffer;
+    StackType_t _taskStack[BLESECURE_RTOS_STACK_SIZE];
+    TaskHandle_t _task;
+
+    StaticQueue_t _commandQueueBuffer;
+    uint8_t _commandStorage[BLESECURE_RTOS_COMMAND_QUEUE_LEN * sizeof(BLESecurityCommand)];
+    QueueHandle_t _commandQueue;
+
+    StaticQueue_t _eventQueueBuffer;
+    uint8_t _eventStorage[BLESECURE_RTOS_EVENT_QUEUE_LEN * sizeof(BLESecurityEvent)];
+    QueueHandle_t _eventQueue;
+
+    BLERTOSStats _stats;
+    BLESecureEventRouter _router;
+
+    bool postCommand(uint8_t type, hci_con_handle_t handle, uint32_t value, TickType_t timeout);
+
+    // Called from the BTstack context, declines the pairing if a prompt is dropped
+    void postEvent(const BLESecurityEvent &event, bool prompt);
+
+    static void ownerTask(void *param);
+
+    // Router callback, ctx is this object
+    static void onEvent(void *ctx, const BLESecurityEvent &event, bool prompt);
+};
+
+extern BLESecureRTOSClass BLESecureRTOS;
+
+#endif // __FREERTOS
+
+#endif // BLE_SECURE_RTOS_H
@@ -0,0 +1,105 @@
+/**
+ * BLESecureRateLimiter.h - Pairing admission control for BLESecure
+ *
+ * Token-bucket rate limiting of new pairing attempts, both globally and
+ * per peer address, plus a temporary deny list with exponential backoff.
+ *
+ * The limiter is plain logic with no BTstack calls: time is passed in by
+ * the caller, so BLESecure decides what to do with a rejected attempt.
+ */
+
+#ifndef BLE_SECURE_RATE_LIMITER_H
+#define BLE_SECURE_RATE_LIMITER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Number of peers tracked individually (least recently seen is replaced)
+#ifndef BLESECURE_RATE_LIMIT_PEERS
+#define BLESECURE_RATE_LIMIT_PEERS 8
+#endif
+
+// Result of an admission check
+typedef enum
+{
+    PAIRING_ADMITTED = 0,
+    PAIRING_REJECTED_GLOBAL = 1, // Global bucket empty
+    PAIRING_REJECTED_PEER = 2,   // Peer bucket empty, peer is now deny-listed
+    PAIRING_REJECTED_DENIED = 3  // Peer is on the deny list
+} BLEPairingAdmission;
+
+// Rate limiter configuration
+typedef struct
+{
+    uint8_t globalBurst;       // Global bucket size
+    uint32_t globalRefillMs;   // Time to refill one global token
+    uint8_t peerBurst;         // Per-peer bucket size
+    uint32_t peerRefillMs;     // Time to refill one per-peer token
+    uint32_t denyBaseMs;       // First deny period, doubled on every strike
+    uint32_t denyMaxMs;        // Upper bound for the deny period
+} BLEPairingRateLimitConfig;
+
+// Counters for rejected and admitted attempts
+typedef struct
+{
+    uint32_t admitted;
+    uint32_t rejectedGlobal;
+    uint32_t rejectedPeer;
+    uint32_t rejectedDenied;
+    uint32_t denyListed; // Number of times a peer was put on the deny list
+} BLEPairingRateLimitStats;
+
+class BLESecureRateLimiter
+{
+public:
+    BLESecureRateLimiter();
+
+    // Replace the configuration and refill all buckets
+    void configure(const BLEPairingRateLimitConfig &config);
+
+    // Check whether a new pairing from this peer may proceed (consumes tokens)
+    BLEPairingAdmission admit(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs);
+
+    // Add a strike for a peer after a failed pairing
+    void recordFailure(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs);
+
+    // Clear strikes and deny state for a peer after a successful pairing
+    void recordSuccess(uint8_t addrType, const uint8_t addr[6]);
+
+    // True if the peer is currently deny-listed
+    bool isDenied(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs) const;
+
+    // Forget all peers and refill the global bucket
+    void reset();
+
+    const BLEPairingRateLimitStats &getStats() const { return _stats; }
+    void resetStats() { memset(&_stats, 0, sizeof(_stats)); }
+
+private:
+    typedef struct
+    {
+        uint8_t addr[6];
+        uint8_t addrType;
+        uint8_t used;
+        uint8_t tokens;
+        uint8_t strikes;
+        uint32_t lastRefillMs;
+        uint32_t lastSeenMs;
+        uint32_t deniedUntilMs;
+    } PeerEntry;
+
+    BLEPairingRateLimitConfig _config;
+    BLEPairingRateLimitStats _stats;
+    PeerEntry _peers[BLESECURE_RATE_LIMIT_PEERS];
+    uint8_t _globalTokens;
+    uint32_t _globalLastRefillMs;
+
+    PeerEntry *findPeer(uint8_t addrType, const uint8_t addr[6]);
+    const PeerEntry *findPeer(uint8_t addrType, const uint8_t addr[6]) const;
+    PeerEntry *findOrAllocPeer(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs);
+    void strike(PeerEntry *peer, uint32_t nowMs);
+
+    static void refill(uint8_t &tokens, uint32_t &lastRefillMs, uint8_t burst, uint32_t refillMs, uint32_t nowMs);
+};
+
+#endif // BLE_SECURE_RATE_LIMITER_H
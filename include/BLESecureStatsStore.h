@@ -0,0 +1,136 @@
+/**
+ * BLESecureStatsStore.h - Security statistics that survive reboots
+ *
+ * Keeps cumulative pairing counts, failures by reason, evicted bonds and
+ * pairing time in a journal of two flash sectors. Records are appended,
+ * each one a CRC-protected snapshot of the totals, so a reset during a
+ * write loses at most the last record. When a sector is full the latest
+ * totals are written to the other sector after erasing it, which is the
+ * only erase the journal does. getStats() adds BLESecure's RAM counters
+ * since boot to the totals loaded from flash.
+ *
+ * All flash work runs from poll(), called from loop(), never from the
+ * BTstack context. A record is appended only after
+ * BLESECURE_STATS_FLUSH_EVENTS new events and at least
+ * BLESECURE_STATS_MIN_WRITE_MS after the previous one. A sector holds 64
+ * records, so a sector erase happens at most once per
+ * BLESECURE_STATS_FLUSH_EVENTS * 64 events (2048 by default) and at most
+ * once per 64 minutes. Events not yet written are lost on a crash, call
+ * flush() before a planned reboot.
+ *
+ *   BLESecure.begin(...);
+ *   BLESecureStatsStore.begin();   // loads the totals
+ *
+ *   void loop() { ...; BLESecureStatsStore.poll(); }
+ *
+ * With BLESecure.setFastStartup(true), begin() only checks the region and
+ * the journal scan runs once advertising is up. Until then poll(), flush()
+ * and reset() do nothing and getStats() returns zeros.
+ *
+ * By default the journal takes the first two sectors of the filesystem
+ * region (board_build.filesystem_size). Pass another offset to begin() if
+ * the sketch uses LittleFS.
+ */
+
+#ifndef BLE_SECURE_STATS_STORE_H
+#define BLE_SECURE_STATS_STORE_H
+
+#include "BLESecure.h"
+
+// New events (pairings, re-encryptions, failures, evicted bonds) per appended record
+#ifndef BLESECURE_STATS_FLUSH_EVENTS
+#define BLESECURE_STATS_FLUSH_EVENTS 32
+#endif
+
+// Minimum time between two appended records
+#ifndef BLESECURE_STATS_MIN_WRITE_MS
+#define BLESECURE_STATS_MIN_WRITE_MS 60000
+#endif
+
+// Cumulative statistics since the journal was created
+typedef struct
+{
+    uint32_t pairings;
+    uint32_t pairingFailures;
+    uint32_t reencryptions;
+    uint32_t reencryptionFailures;
+    uint32_t failureReasons[BLESECURE_FAILURE_REASONS]; // Pairing failures by SM reason
+    uint32_t bondsEvicted;
+    uint32_t averagePairingMs;
+    uint32_t recordsWritten; // Journal records appended since boot
+    uint32_t sectorErases;   // Sector erases since boot
+} BLEPersistentStats;
+
+class BLESecureStatsStoreClass
+{
+public:
+    BLESecureStatsStoreClass();
+
+    // Load the totals from the journal at flashOffset (two sectors, sector aligned).
+    // 0 uses the start of the filesystem region. Returns false if the region is unusable.
+    // With fast startup the load is deferred until advertising runs.
+    bool begin(uint32_t flashOffset = 0);
+
+    // Append a record if enough events have accumulated and the last one is old enough, call from loop()
+    void poll();
+
+    // Append a record now regardless of both bounds (e.g. before a planned reboot)
+    bool flush();
+
+    // Flash totals merged with the RAM counters since boot
+    BLEPersistentStats getStats();
+
+    // Erase the journal and start counting from zero
+    void reset();
+
+private:
+    // One journal entry, 64 bytes so a sector holds 64 of them
+    typedef struct __attribute__((packed))
+    {
+        uint32_t magic;
+        uint32_t sequence;
+        uint32_t pairings;
+        uint32_t pairingFailures;
+        uint32_t reencryptions;
+        uint32_t reencryptionFailures;
+        uint32_t bondsEvicted;
+        uint32_t totalPairingMs;
+        uint16_t failureReasons[BLESECURE_FAILURE_REASONS]; // Saturate at 65535
+        uint16_t crc;                                       // CRC-16/CCITT over the bytes above
+    } Record;
+
+    bool _started;
+    uint32_t _offset;     // Flash offset of sector 0
+    uint8_t _sector;      // Sector records are appended to
+    uint16_t _nextSlot;   // First erased slot in that sector
+    uint32_t _sequence;   // Sequence number of the newest record
+    Record _base;         // Totals loaded at boot
+    BLESecurityCounters _ramOffset; // RAM counters at the last reset()
+    uint32_t _flushedEvents; // RAM event count covered by the newest record
+    uint32_t _lastAppendMs;  // millis() of the newest record
+    uint32_t _recordsWritten;
+    uint32_t _sectorErases;
+
+    // Scan both sectors for the newest record and take its totals
+    void load();
+    static void loadTask(void *ctx);
+
+    // Combine the boot totals with BLESecure's RAM counters
+    void buildRecord(Record &record, const BLESecurityCounters &counters);
+
+    // Write a record to the next slot, erasing the other sector when this one is full
+    bool append(const BLESecurityCounters &counters);
+
+    const Record *slotAt(uint8_t sector, uint16_t slot) const;
+    static bool isValid(const Record *record);
+    static bool isErased(const Record *record);
+    static uint16_t crc16(const uint8_t *data, size_t length);
+    static uint32_t eventCount(const BLESecurityCounters &counters);
+
+    void programSlot(uint8_t sector, uint16_t slot, const Record &record);
+    void eraseSector(uint8_t sector);
+};
+
+extern BLESecureStatsStoreClass BLESecureStatsStore;
+
+#endif // BLE_SECURE_STATS_STORE_H
@@ -11,6 +11,10 @@
 #include "ble/le_device_db.h" 
 // #include "gap.h" // included in BLESecure.h              
 #include "hci.h" // For hci_con_handle_t
+#include "ble/att_server.h"
+#include "ble/gatt_client.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
 
 // Fallback if NVM_NUM_DEVICE_DB_ENTRIES is not directly available here.
 // It's defined in btstack_config.h as 16.
@@ -27,34 +31,160 @@
 #define CCALLBACKNAME _BLESECURECB
 #include <ctocppcallback.h>
 
-#define SMEVENTCB(class, cbFcn)                                                                                                                                                                                   \
-    (_BLESECURECB<void(uint8_t, uint16_t, uint8_t *, uint16_t), __COUNTER__>::func = std::bind(&class ::cbFcn, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4), \
+// Last include, it poisons String and the allocators with BLESECURE_NO_HEAP
+#include "BLESecureNoHeap.h"
+
+// The lambda only captures this, so std::function stores it without allocating (std::bind's object does not fit)
+#define SMEVENTCB(class, cbFcn)                                                                          \
+    (_BLESECURECB<void(uint8_t, uint16_t, uint8_t *, uint16_t), __COUNTER__>::func =                     \
+         BLESecureNoHeapFunctor([this](uint8_t type, uint16_t channel, uint8_t *packet, uint16_t size) \
+                                { this->class ::cbFcn(type, channel, packet, size); }),                  \
      static_cast<btstack_packet_handler_t>(_BLESECURECB<void(uint8_t, uint16_t, uint8_t *, uint16_t), __COUNTER__ - 1>::callback))
 
+// Default reconnect schedule: 20-30 ms for 30 s, then 152.5 ms
+static const BLEReconnectAdvConfig kDefaultReconnectConfig = {
+    true,   // directed
+    0x0020, // fastIntervalMin (20 ms)
+    0x0030, // fastIntervalMax (30 ms)
+    30000,  // fastDurationMs
+    0x00F4, // slowIntervalMin (152.5 ms)
+    0x00F4  // slowIntervalMax
+};
+
+// Advertising interval set by BTstackLib's setup() (30 ms), in effect until BLESecure changes it
+static const uint16_t kBTstackLibAdvInterval = 0x0030;
+
+// Pairing: 7.5-15 ms, no latency, 2 s supervision timeout
+static const BLEConnectionParams kDefaultPairingConnParams = {0x0006, 0x000C, 0, 200};
+
+// Steady state: 30-50 ms, no latency, 4 s supervision timeout
+static const BLEConnectionParams kDefaultSteadyConnParams = {0x0018, 0x0028, 0, 400};
+
+// Largest LE Data Length Extension payload and its transmit time on 1M PHY
+#define LINK_MAX_TX_OCTETS 251
+#define LINK_MAX_TX_TIME 2120
+
+// LE PHY preference bits for gap_le_set_phy()
+#define LINK_PHY_2M 0x02
+
+// Advertising types for gap_advertisements_set_params()
+#define ADV_TYPE_IND 0x00
+#define ADV_TYPE_DIRECT_IND_HIGH_DUTY 0x01
+
+// Advertising filter policies
+#define ADV_FILTER_ALLOW_ALL 0x00
+#define ADV_FILTER_CONNECT_ACCEPT_LIST 0x02
+
+// High-duty directed advertising is limited to 1.28 s by the controller
+#define RECONNECT_DIRECTED_TIMEOUT_MS 1280
+
 // BLESecureClass implementation
-BLESecureClass::BLESecureClass() : _pairingStatus(PAIRING_IDLE),
+BLESecureClass::BLESecureClass() : _requestPairingOnConnect(false),
+                                   _pairingStatus(PAIRING_IDLE),
                                    _securityLevel(SECURITY_MEDIUM),
                                    _ioCapability(IO_CAPABILITY_DISPLAY_YES_NO),
                                    _fixedPasskey(0),
                                    _useFixedPasskey(false),
-                                   _requestPairingOnConnect(false),
+                                   _bondingEnabled(true),
                                    _passkeyDisplayCallback(nullptr),
+                                   _passkeyDisplayContext(nullptr),
                                    _passkeyEntryCallback(nullptr),
+                                   _passkeyEntryContext(nullptr),
                                    _pairingStatusCallback(nullptr),
+                                   _pairingStatusContext(nullptr),
                                    _numericComparisonCallback(nullptr),
+                                   _numericComparisonContext(nullptr),
+                                   _pairingResultCallback(nullptr),
+                                   _pairingResultContext(nullptr),
+                                   _lastPairingResult(),
+                                   _pairingStepHook(nullptr),
+                                   _pairingStepContext(nullptr),
                                    _userConnectedCallback(nullptr),
+                                   _userConnectedContext(nullptr),
                                    _userDisconnectedCallback(nullptr),
+                                   _userDisconnectedContext(nullptr),
                                    _currentDeviceHandle(HCI_CON_HANDLE_INVALID),
-                                   _bondingEnabled(true)
+                                   _subscriptions(SM_SUBSCRIBE_ALL),
+                                   _smEventMask(smEventMaskFor(SM_SUBSCRIBE_ALL)),
+                                   _securityCounters(),
+                                   _latencySamples(),
+                                   _latencySampleCount(0),
+                                   _latencySampleNext(0),
+                                   _rateLimitEnabled(false),
+                                   _rejectedNext(0),
+                                   _connections(),
+                                   _attSecurity(),
+                                   _requestPairingOnAccess(false),
+                                   _userGattWriteCallback(nullptr),
+                                   _userGattWriteContext(nullptr),
+                                   _userGattReadCallback(nullptr),
+                                   _userGattReadContext(nullptr),
+                                   _readHandlerHandle(0),
+                                   _readHandler(nullptr),
+                                   _readHandlerContext(nullptr),
+                                   _linkUpgrades(LINK_UPGRADE_NONE),
+                                   _phaseConnParamsEnabled(false),
+                                   _steadyConnParams(kDefaultSteadyConnParams),
+                                   _pairingTiming(),
+                                   _fastReconnectEnabled(false),
+                                   _reconnectConfig(kDefaultReconnectConfig),
+                                   _reconnectStats(),
+                                   _reconnectPhase(RECONNECT_ADV_IDLE),
+                                   _reconnectPhaseAtConnect(RECONNECT_ADV_IDLE),
+                                   _lastBondIndex(-1),
+                                   _disconnectedAtMs(0),
+                                   _reconnectTimer(),
+                                   _restrictToBonded(false),
+                                   _acceptListSize(0),
+                                   _advFilterPolicy(ADV_FILTER_ALLOW_ALL),
+                                   _advIntervalMin(kBTstackLibAdvInterval),
+                                   _advIntervalMax(kBTstackLibAdvInterval),
+                                   _savedAdvIntervalMin(kBTstackLibAdvInterval),
+                                   _savedAdvIntervalMax(kBTstackLibAdvInterval),
+                                   _controllerResolution(false),
+                                   _resolutionDisabled(false),
+                                   _resolutionCommands(0),
+                                   _resolutionEnableSent(false),
+                                   _resolutionEnableDisallowed(false),
+                                   _readResolvingListSize(false),
+                                   _resolutionStats(),
+                                   _startupDeferred(false),
+                                   _irkCountDeferred(false),
+                                   _startupTaskCount(0),
+                                   _startupTasks(),
+                                   _startupTaskContexts(),
+                                   _startupTimer(),
+                                   _bootTimelineUs(),
+                                   _eventPending(false),
+                                   _eventSignalUs(0),
+                                   _eventLock(spin_lock_instance(next_striped_spin_lock_num())),
+                                   _eventWaitStats(),
+                                   _staleBondPolicy(STALE_BOND_REPORT),
+                                   _staleBondStats()
 {
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
+    {
+        _connections[i].handle = HCI_CON_HANDLE_INVALID;
+    }
+    for (int i = 0; i < BLESECURE_REJECTED_HANDLES; ++i)
+    {
+        _rejectedHandles[i] = HCI_CON_HANDLE_INVALID;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        _pairingConnParams[i] = kDefaultPairingConnParams;
+    }
 }
 
 void BLESecureClass::begin(io_capability_t ioCapability)
 {
+    markBootMilestone(BOOT_MILESTONE_BEGIN);
+
     // Store the IO capability
     _ioCapability = ioCapability;
 
-    BluetoothLock b;
+    BLESecureProfiler::startClock();
+    BLESecureLock b(LOCK_SITE_BEGIN);
 
     // Initialize Security Manager
     // sm_init(); // Unnecessary for arduino-pico, already done in BTstackLib
@@ -68,47 +198,46 @@ void BLESecureClass::begin(io_capability_t ioCapability)
 
     // Register for Security Manager events
     setupSMEventHandler();
+
+    markBootMilestone(BOOT_MILESTONE_BEGIN_DONE);
 }
 
-void BLESecureClass::setSecurityLevel(BLESecurityLevel level, bool enableBonding)
+void BLESecureClass::beginFixed(io_capability_t ioCapability, BLESecurityLevel level, bool enableBonding, uint8_t authReq, btstack_packet_handler_t smHandler)
 {
+    _ioCapability = ioCapability;
     _securityLevel = level;
     _bondingEnabled = enableBonding;
+    markBootMilestone(BOOT_MILESTONE_BEGIN);
 
-    BluetoothLock b;
+    BLESecureProfiler::startClock();
+    BLESecureLock b(LOCK_SITE_BEGIN);
 
-    uint8_t auth_req = 0;
+    sm_set_io_capabilities(ioCapability);
+    sm_set_authentication_requirements(authReq);
 
-    switch (level)
-    {
-    case SECURITY_LOW:
-        // No authentication or encryption
-        break;
+    static btstack_packet_callback_registration_t sm_fixed_callback_registration;
+    sm_fixed_callback_registration.callback = smHandler;
+    sm_add_event_handler(&sm_fixed_callback_registration);
 
-    case SECURITY_MEDIUM:
-        // Encryption, no MITM
-        auth_req = enableBonding ? SM_AUTHREQ_BONDING : 0;
-        break;
+    setupHCIEventHandler();
+    markBootMilestone(BOOT_MILESTONE_BEGIN_DONE);
+}
 
-    case SECURITY_HIGH:
-        // Encryption with MITM
-        auth_req = SM_AUTHREQ_MITM_PROTECTION | (enableBonding ? SM_AUTHREQ_BONDING : 0);
-        break;
+void BLESecureClass::setSecurityLevel(BLESecurityLevel level, bool enableBonding)
+{
+    _securityLevel = level;
+    _bondingEnabled = enableBonding;
 
-    case SECURITY_HIGH_SC:
-        // Encryption with MITM and SC
-        auth_req = SM_AUTHREQ_MITM_PROTECTION |
-                   SM_AUTHREQ_SECURE_CONNECTION |
-                   (enableBonding ? SM_AUTHREQ_BONDING : 0);
-        break;
-    }
+    BLESecureLock b(LOCK_SITE_SET_SECURITY_LEVEL);
+
+    uint8_t auth_req = blesecureAuthReq(level, enableBonding);
 
     sm_set_authentication_requirements(auth_req);
 }
 
 void BLESecureClass::allowReconnectionWithoutDatabaseEntry(bool allow)
 {
-    BluetoothLock b;
+    BLESecureLock b(LOCK_SITE_ALLOW_RECONNECTION);
     sm_allow_ltk_reconstruction_without_le_device_db_entry(allow ? 1 : 0);
 }
 
@@ -116,7 +245,7 @@ void BLESecureClass::setFixedPasskey(uint32_t passkey)
 {
     if (passkey <= 999999)
     {
-        BluetoothLock b;
+        BLESecureLock b(LOCK_SITE_SET_FIXED_PASSKEY);
         _fixedPasskey = passkey;
         _useFixedPasskey = true;
         sm_use_fixed_passkey_in_display_role(_fixedPasskey);
@@ -141,17 +270,14 @@ bool BLESecureClass::requestPairing(BLEDevice *device)
     if (handle == HCI_CON_HANDLE_INVALID)
         return false;
 
-    BluetoothLock b;
+    BLESecureLock b(LOCK_SITE_REQUEST_PAIRING);
 
     // Update pairing status
     _pairingStatus = PAIRING_STARTED;
     _currentDeviceHandle = handle;
 
     // Callback if registered
-    if (_pairingStatusCallback)
-    {
-        _pairingStatusCallback(_pairingStatus, device);
-    }
+    reportPairingStatus(handle);
 
     // Request pairing
     sm_request_pairing(handle);
@@ -199,7 +325,7 @@ bool BLESecureClass::removeBonding(BLEDevice *device) {
     }
 
     Serial.println("Attempting to remove bonding for specific device.");
-    BluetoothLock b;
+    BLESecureLock b(LOCK_SITE_REMOVE_BONDING);
 
     int device_db_index = sm_le_device_index(handle);
 
@@ -225,6 +351,8 @@ bool BLESecureClass::removeBonding(BLEDevice *device) {
         Serial.println(bd_addr_to_str(addr));
 
         gap_delete_bonding(current_addr_type, addr); 
+        _securityCounters.bondsEvicted++;
+        onBondsChanged();
 
         Serial.println("removeBonding: gap_delete_bonding called. Verifying DB state:");
         le_device_db_dump(); 
@@ -248,7 +376,7 @@ bool BLESecureClass::removeBonding(BLEDevice *device) {
 
 void BLESecureClass::clearAllBondings() {
     Serial.println(">>> Using gap_delete_bonding w/ Dumps <<<"); 
-    BluetoothLock b;
+    BLESecureLock b(LOCK_SITE_CLEAR_ALL_BONDINGS);
 
     Serial.println("Initial LE Device DB Dump (before any deletions):");
     le_device_db_dump(); // DUMP 1: See initial state
@@ -278,6 +406,7 @@ void BLESecureClass::clearAllBondings() {
 
                 gap_delete_bonding(current_addr_type, addr);
                 bonds_deleted_count++;
+                _securityCounters.bondsEvicted++;
                 Serial.println("Called gap_delete_bonding(). DB state after this call (dump may not reflect immediate flash change):");
                 le_device_db_dump(); // DUMP 2: Inside loop, after a gap_delete_bonding call
             }
@@ -289,6 +418,8 @@ void BLESecureClass::clearAllBondings() {
         Serial.println("No bonds reported by le_device_db_count() initially.");
     }
 
+    onBondsChanged();
+
     Serial.println("Final LE Device DB Dump (after all gap_delete_bonding attempts):");
     le_device_db_dump(); // DUMP 3: After the loop
 
@@ -298,7 +429,8 @@ void BLESecureClass::clearAllBondings() {
     } else {
         Serial.print("INFO: After all attempts, ");
         Serial.print(final_count);
-        Serial.println(" bond(s) still reported by le_device_db_count. Initial count was " + String(initial_bond_count));
+        Serial.print(" bond(s) still reported by le_device_db_count. Initial count was ");
+        Serial.println(initial_bond_count);
         Serial.println("This might indicate that gap_delete_bonding did not fully clear all entries from SM perspective or TLV backend.");
     }
     // The re-application of SM settings will be handled by BLESecure.begin()/setSecurityLevel()
@@ -307,41 +439,120 @@ void BLESecureClass::clearAllBondings() {
 
 void BLESecureClass::setPasskeyDisplayCallback(void (*callback)(uint32_t passkey))
 {
+    typedef PlainCallback<void, uint32_t> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setPasskeyDisplayCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setPasskeyDisplayCallback(void (*callback)(void *ctx, uint32_t passkey), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_PASSKEY_DISPLAY_CALLBACK);
     _passkeyDisplayCallback = callback;
+    _passkeyDisplayContext = ctx;
 }
 
 void BLESecureClass::setPasskeyEntryCallback(void (*callback)(void))
 {
+    typedef PlainCallback<void> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setPasskeyEntryCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setPasskeyEntryCallback(void (*callback)(void *ctx), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_PASSKEY_ENTRY_CALLBACK);
     _passkeyEntryCallback = callback;
+    _passkeyEntryContext = ctx;
 }
 
 void BLESecureClass::setEnteredPasskey(uint32_t passkey)
 {
     if (_pairingStatus == PAIRING_STARTED && _currentDeviceHandle != HCI_CON_HANDLE_INVALID)
     {
-        BluetoothLock b;
+        BLESecureLock b(LOCK_SITE_SET_ENTERED_PASSKEY);
         sm_passkey_input(_currentDeviceHandle, passkey);
+        notifyPairingStep(PAIRING_STEP_PASSKEY_ENTERED, _currentDeviceHandle, passkey);
     }
 }
 
 void BLESecureClass::setPairingStatusCallback(void (*callback)(BLEPairingStatus status, BLEDevice *device))
 {
+    typedef PlainCallback<void, BLEPairingStatus, BLEDevice *> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setPairingStatusCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setPairingStatusCallback(void (*callback)(void *ctx, BLEPairingStatus status, BLEDevice *device), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_PAIRING_STATUS_CALLBACK);
     _pairingStatusCallback = callback;
+    _pairingStatusContext = ctx;
+}
+
+void BLESecureClass::setPairingResultCallback(void (*callback)(const BLEPairingResult &result, BLEDevice *device))
+{
+    typedef PlainCallback<void, const BLEPairingResult &, BLEDevice *> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setPairingResultCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setPairingResultCallback(void (*callback)(void *ctx, const BLEPairingResult &result, BLEDevice *device), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_PAIRING_RESULT_CALLBACK);
+    _pairingResultCallback = callback;
+    _pairingResultContext = ctx;
+}
+
+BLEPairingResult BLESecureClass::getLastPairingResult()
+{
+    BLESecureLock b(LOCK_SITE_GET_LAST_PAIRING_RESULT);
+    return _lastPairingResult;
+}
+
+void BLESecureClass::setPairingStepHook(void (*hook)(void *ctx, BLEPairingStep step, hci_con_handle_t handle, uint32_t value), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_PAIRING_STEP_HOOK);
+    _pairingStepHook = hook;
+    _pairingStepContext = ctx;
 }
 
 void BLESecureClass::setNumericComparisonCallback(void (*callback)(uint32_t passkey, BLEDevice *device))
 {
+    typedef PlainCallback<void, uint32_t, BLEDevice *> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setNumericComparisonCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setNumericComparisonCallback(void (*callback)(void *ctx, uint32_t passkey, BLEDevice *device), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_NUMERIC_COMPARISON_CALLBACK);
     _numericComparisonCallback = callback;
+    _numericComparisonContext = ctx;
 }
 
 void BLESecureClass::acceptNumericComparison(bool accept)
 {
     if (_pairingStatus == PAIRING_STARTED && _currentDeviceHandle != HCI_CON_HANDLE_INVALID)
     {
-        BluetoothLock b;
-        // The arduino-pico implementation accepts only the connection handle
-        // The 'accept' parameter is ignored as the implementation always confirms
-        sm_numeric_comparison_confirm(_currentDeviceHandle);
+        BLESecureLock b(LOCK_SITE_ACCEPT_NUMERIC_COMPARISON);
+        if (accept)
+            sm_numeric_comparison_confirm(_currentDeviceHandle);
+        else
+            sm_bonding_decline(_currentDeviceHandle);
+    }
+}
+
+void BLESecureClass::declinePairing()
+{
+    if (_pairingStatus == PAIRING_STARTED && _currentDeviceHandle != HCI_CON_HANDLE_INVALID)
+    {
+        BLESecureLock b(LOCK_SITE_DECLINE_PAIRING);
+        sm_bonding_decline(_currentDeviceHandle);
     }
 }
 
@@ -359,7 +570,7 @@ bool BLESecureClass::isEncrypted(BLEDevice *device)
     if (handle == HCI_CON_HANDLE_INVALID)
         return false;
 
-    BluetoothLock b;
+    BLESecureLock b(LOCK_SITE_IS_ENCRYPTED);
     return gap_encryption_key_size(handle) > 0;
 }
 
@@ -369,209 +580,1873 @@ void BLESecureClass::setupSMEventHandler()
     static btstack_packet_callback_registration_t sm_event_callback_registration;
     sm_event_callback_registration.callback = SMEVENTCB(BLESecureClass, handleSMEvent);
     sm_add_event_handler(&sm_event_callback_registration);
+
+    setupHCIEventHandler();
+}
+
+void BLESecureClass::setupHCIEventHandler()
+{
+    // HCI events are needed to track connections independently of BTstackLib callbacks
+    static btstack_packet_callback_registration_t hci_event_callback_registration;
+    hci_event_callback_registration.callback = SMEVENTCB(BLESecureClass, handleHCIEvent);
+    hci_add_event_handler(&hci_event_callback_registration);
 }
 
 // New methods for connection/disconnection handling with auto-pairing
 void BLESecureClass::setBLEDeviceConnectedCallback(void (*callback)(BLEStatus status, BLEDevice *device))
 {
+    typedef PlainCallback<void, BLEStatus, BLEDevice *> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setBLEDeviceConnectedCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setBLEDeviceConnectedCallback(void (*callback)(void *ctx, BLEStatus status, BLEDevice *device), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_CONNECTED_CALLBACK);
     _userConnectedCallback = callback;
+    _userConnectedContext = ctx;
     BTstack.setBLEDeviceConnectedCallback(internalConnectionCallback);
 }
 
 void BLESecureClass::setBLEDeviceDisconnectedCallback(void (*callback)(BLEDevice *device))
 {
+    typedef PlainCallback<void, BLEDevice *> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setBLEDeviceDisconnectedCallback(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setBLEDeviceDisconnectedCallback(void (*callback)(void *ctx, BLEDevice *device), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_DISCONNECTED_CALLBACK);
     _userDisconnectedCallback = callback;
+    _userDisconnectedContext = ctx;
     BTstack.setBLEDeviceDisconnectedCallback(internalDisconnectionCallback);
 }
 
-// Internal connection callback that handles auto-pairing
-void BLESecureClass::internalConnectionCallback(BLEStatus status, BLEDevice *device)
+void BLESecureClass::enablePairingRateLimit(bool enable)
 {
-    // Auto-request pairing if enabled
-    if (status == BLE_STATUS_OK && BLESecure._requestPairingOnConnect)
-    {
-        Serial.println("Auto-requesting pairing as configured in BLESecure");
-        BLESecure.requestPairing(device);
-    }
+    _rateLimitEnabled = enable;
+}
 
-    // Call the user's callback if registered
-    if (BLESecure._userConnectedCallback)
+void BLESecureClass::setPairingRateLimit(const BLEPairingRateLimitConfig &config)
+{
+    BLESecureLock b(LOCK_SITE_SET_PAIRING_RATE_LIMIT);
+    _rateLimiter.configure(config);
+}
+
+BLEPairingRateLimitStats BLESecureClass::getPairingRateLimitStats()
+{
+    BLESecureLock b(LOCK_SITE_GET_PAIRING_RATE_LIMIT_STATS);
+    return _rateLimiter.getStats();
+}
+
+void BLESecureClass::resetPairingRateLimit()
+{
+    BLESecureLock b(LOCK_SITE_RESET_PAIRING_RATE_LIMIT);
+    _rateLimiter.reset();
+    _rateLimiter.resetStats();
+}
+
+void BLESecureClass::setCharacteristicSecurity(uint16_t attHandle, BLESecurityLevel level, uint8_t minKeySize)
+{
+    if (attHandle >= BLESECURE_MAX_ATT_HANDLES)
     {
-        BLESecure._userConnectedCallback(status, device);
+        Serial.println("setCharacteristicSecurity: handle exceeds BLESECURE_MAX_ATT_HANDLES");
+        return;
     }
+    if (minKeySize > 16)
+        minKeySize = 16;
+    _attSecurity[attHandle] = (uint8_t)((minKeySize << 2) | (level & 0x03));
 }
 
-// Internal disconnection callback
-void BLESecureClass::internalDisconnectionCallback(BLEDevice *device)
+bool BLESecureClass::isAccessAllowed(BLEDevice *device, uint16_t attHandle)
 {
-    // Reset pairing status if this was the device we were pairing with
-    if (BLESecure._currentDeviceHandle == device->getHandle())
+    if (!device)
+        return false;
+
+    BLESecureLock b(LOCK_SITE_IS_ACCESS_ALLOWED);
+    return checkAccess(findConnection(device->getHandle()), attHandle) == 0;
+}
+
+void BLESecureClass::requestPairingOnAccess(bool enable)
+{
+    _requestPairingOnAccess = enable;
+}
+
+void BLESecureClass::setGATTCharacteristicWrite(int (*callback)(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size))
+{
+    typedef PlainCallback<int, uint16_t, uint8_t *, uint16_t> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setGATTCharacteristicWrite(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setGATTCharacteristicWrite(int (*callback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_GATT_WRITE);
+    _userGattWriteCallback = callback;
+    _userGattWriteContext = ctx;
+    registerAttServiceHandler();
+}
+
+void BLESecureClass::setGATTCharacteristicRead(uint16_t (*callback)(uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size))
+{
+    typedef PlainCallback<uint16_t, uint16_t, uint8_t *, uint16_t> Plain;
+    static Plain plain;
+    plain.fn = callback;
+    setGATTCharacteristicRead(callback ? Plain::call : nullptr, &plain);
+}
+
+void BLESecureClass::setGATTCharacteristicRead(uint16_t (*callback)(void *ctx, uint16_t characteristic_id, uint8_t *buffer, uint16_t buffer_size), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_GATT_READ);
+    _userGattReadCallback = callback;
+    _userGattReadContext = ctx;
+    registerAttServiceHandler();
+}
+
+BLESecurityLevel BLESecureClass::getSecurityLevel(BLEDevice *device)
+{
+    if (!device)
+        return SECURITY_LOW;
+
+    BLESecureLock b(LOCK_SITE_GET_SECURITY_LEVEL);
+    ConnectionState *conn = findConnection(device->getHandle());
+    return conn ? (BLESecurityLevel)conn->securityLevel : SECURITY_LOW;
+}
+
+uint32_t BLESecureClass::getFirstDataLatency(BLEDevice *device)
+{
+    if (!device)
+        return 0;
+
+    BLESecureLock b(LOCK_SITE_GET_FIRST_DATA_LATENCY);
+    ConnectionState *conn = findConnection(device->getHandle());
+    return (conn && conn->firstDataSeen) ? conn->firstDataLatencyMs : 0;
+}
+
+BLESecureClass::ConnectionState *BLESecureClass::findConnection(hci_con_handle_t handle)
+{
+    if (handle == HCI_CON_HANDLE_INVALID)
+        return nullptr;
+
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
     {
-        BLESecure._pairingStatus = PAIRING_IDLE;
-        BLESecure._currentDeviceHandle = HCI_CON_HANDLE_INVALID;
+        if (_connections[i].handle == handle)
+            return &_connections[i];
     }
+    return nullptr;
+}
 
-    // Call the user's callback if registered
-    if (BLESecure._userDisconnectedCallback)
+BLESecureClass::ConnectionState *BLESecureClass::addConnection(hci_con_handle_t handle)
+{
+    // A reused handle is a new link. The old one's rejection stays until now, the SM may
+    // still report its pairing after the disconnect.
+    clearPairingRejected(handle);
+
+    ConnectionState *conn = findConnection(handle);
+    if (!conn)
     {
-        BLESecure._userDisconnectedCallback(device);
+        // Take a free slot
+        for (int i = 0; i < BLESECURE_MAX_CONNECTIONS && !conn; ++i)
+        {
+            if (_connections[i].handle == HCI_CON_HANDLE_INVALID)
+                conn = &_connections[i];
+        }
     }
+    if (!conn)
+        return nullptr;
+
+    memset(conn, 0, sizeof(*conn));
+    conn->handle = handle;
+    conn->securityLevel = SECURITY_LOW;
+    conn->keySize = 0;
+    conn->bondIndex = -1;
+    conn->txOctets = 27;
+    conn->rxOctets = 27;
+    conn->txPhy = 1;
+    conn->rxPhy = 1;
+    conn->connectedAtMs = millis();
+    return conn;
 }
 
-void BLESecureClass::handleSMEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+void BLESecureClass::removeConnection(hci_con_handle_t handle)
 {
-    (void)channel;
-    (void)size;
+    ConnectionState *conn = findConnection(handle);
+    if (conn)
+        conn->handle = HCI_CON_HANDLE_INVALID;
+}
 
-    if (packet_type != HCI_EVENT_PACKET)
+void BLESecureClass::markPairingRejected(hci_con_handle_t handle)
+{
+    if (isPairingRejected(handle))
         return;
 
-    switch (hci_event_packet_get_type(packet))
-    {
-    case SM_EVENT_JUST_WORKS_REQUEST:
+    _rejectedHandles[_rejectedNext] = handle;
+    _rejectedNext = (_rejectedNext + 1) % BLESECURE_REJECTED_HANDLES;
+}
+
+bool BLESecureClass::isPairingRejected(hci_con_handle_t handle) const
+{
+    for (int i = 0; i < BLESECURE_REJECTED_HANDLES; ++i)
     {
-        // Just Works request - auto-confirm if that's our capability
-        hci_con_handle_t handle = sm_event_just_works_request_get_handle(packet);
-        sm_just_works_confirm(handle);
-        Serial.println("Accepting Just Works pairing request");
-        break;
+        if (_rejectedHandles[i] == handle)
+            return true;
     }
+    return false;
+}
 
-    case SM_EVENT_PASSKEY_DISPLAY_NUMBER:
+void BLESecureClass::clearPairingRejected(hci_con_handle_t handle)
+{
+    for (int i = 0; i < BLESECURE_REJECTED_HANDLES; ++i)
     {
-        // Passkey display - pass to callback if registered
-        uint32_t passkey = sm_event_passkey_display_number_get_passkey(packet);
-        hci_con_handle_t handle = sm_event_passkey_display_number_get_handle(packet);
-
-        if (_passkeyDisplayCallback)
-        {
-            _passkeyDisplayCallback(passkey);
-        }
-        Serial.print("Please enter passkey on other device: ");
-        Serial.println(passkey);
-        break;
+        if (_rejectedHandles[i] == handle)
+            _rejectedHandles[i] = HCI_CON_HANDLE_INVALID;
     }
+}
 
-    case SM_EVENT_PASSKEY_INPUT_NUMBER:
+void BLESecureClass::updateConnectionSecurity(hci_con_handle_t handle)
+{
+    ConnectionState *conn = findConnection(handle);
+    if (!conn)
+        return;
+
+    BLESecurityLevel level = SECURITY_LOW;
+    int key_size = gap_encryption_key_size(handle);
+    if (key_size > 0)
     {
-        // Passkey input - pass to callback if registered
-        if (_passkeyEntryCallback)
-        {
-            _passkeyEntryCallback();
-        }
-        Serial.println("Passkey entry requested - use setEnteredPasskey() to provide the value");
-        break;
+        if (!gap_authenticated(handle))
+            level = SECURITY_MEDIUM;
+        else if (gap_secure_connection(handle))
+            level = SECURITY_HIGH_SC;
+        else
+            level = SECURITY_HIGH;
     }
+    conn->securityLevel = (uint8_t)level;
+    conn->keySize = (uint8_t)key_size;
+    conn->bondIndex = (int8_t)sm_le_device_index(handle);
+}
 
-    case SM_EVENT_NUMERIC_COMPARISON_REQUEST:
+int BLESecureClass::checkAccess(const ConnectionState *conn, uint16_t attHandle) const
+{
+    // Handles outside the table are public
+    if (attHandle >= BLESECURE_MAX_ATT_HANDLES)
+        return 0;
+
+    uint8_t entry = _attSecurity[attHandle];
+    uint8_t required = entry & 0x03;
+    uint8_t minKeySize = entry >> 2;
+    if (required == SECURITY_LOW && minKeySize == 0)
+        return 0;
+
+    if (!conn || conn->securityLevel < required)
+        return ATT_ERROR_INSUFFICIENT_AUTHENTICATION;
+    if (conn->keySize < minKeySize)
+        return ATT_ERROR_INSUFFICIENT_ENCRYPTION_KEY_SIZE;
+    return 0;
+}
+
+int BLESecureClass::checkCharacteristicAccess(hci_con_handle_t handle, uint16_t attHandle, bool access)
+{
+    ConnectionState *conn = findConnection(handle);
+
+    int err = checkAccess(conn, attHandle);
+    if (err)
     {
-        // Numeric comparison - pass to callback if registered
-        uint32_t passkey = sm_event_numeric_comparison_request_get_passkey(packet);
-        hci_con_handle_t handle = sm_event_numeric_comparison_request_get_handle(packet);
-        BLEDevice device(handle);
+        if (!conn)
+            return err;
 
-        Serial.print("Numeric comparison requested. Does this match? ");
-        Serial.println(passkey);
+        // A bonded peer only needs to re-encrypt, anyone else has to pair
+        bool bonded = sm_le_device_index(conn->handle) >= 0;
+        bool encrypted = conn->securityLevel != SECURITY_LOW;
 
-        if (_numericComparisonCallback)
-        {
-            _numericComparisonCallback(passkey, &device);
-        }
-        else
+        if (access && _requestPairingOnAccess && _pairingStatus != PAIRING_STARTED)
         {
-            // Auto-accept if no callback
-            sm_numeric_comparison_confirm(handle);
+            Serial.println("Protected characteristic accessed - requesting pairing");
+            BLEDevice device(conn->handle);
+            requestPairing(&device);
         }
-        break;
+
+        // The central completes security and retries the request
+        if (bonded && !encrypted)
+            return ATT_ERROR_INSUFFICIENT_ENCRYPTION;
+        return err;
     }
 
-    case SM_EVENT_PAIRING_STARTED:
+    if (access && conn && !conn->firstDataSeen)
     {
-        // Pairing started
-        _pairingStatus = PAIRING_STARTED;
-        hci_con_handle_t handle = sm_event_pairing_started_get_handle(packet);
-        _currentDeviceHandle = handle;
+        conn->firstDataSeen = true;
+        conn->firstDataLatencyMs = millis() - conn->connectedAtMs;
+    }
+    return 0;
+}
 
-        Serial.println("Pairing started");
+// Registered with att_server for every handle. BTstackLib's own callbacks drop the
+// connection handle, so they cannot tell which of several links sent a request.
+static att_service_handler_t attServiceHandler;
 
-        if (_pairingStatusCallback)
-        {
-            BLEDevice device(handle);
-            _pairingStatusCallback(_pairingStatus, &device);
-        }
-        break;
+void BLESecureClass::registerAttServiceHandler()
+{
+    if (attServiceHandler.read_callback)
+        return;
+
+    attServiceHandler.start_handle = 1;
+    attServiceHandler.end_handle = 0xffff;
+    attServiceHandler.read_callback = attReadCallback;
+    attServiceHandler.write_callback = attWriteCallback;
+    att_server_register_service_handler(&attServiceHandler);
+}
+
+uint16_t BLESecureClass::attReadCallback(hci_con_handle_t con_handle, uint16_t att_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size)
+{
+    BLESecureLockHeldScope held;
+
+    BLESecure.signalEvent();
+
+    // ATT asks for the length (buffer NULL) before every read, and for each attribute of a
+    // Read By Type request, so only the copy counts as an access that may request pairing
+    int err = BLESecure.checkCharacteristicAccess(con_handle, att_handle, buffer != NULL);
+    if (err)
+    {
+#ifdef ATT_READ_ERROR_CODE_OFFSET
+        // The error answers the read, the central pairs and retries
+        return buffer ? 0 : (uint16_t)(ATT_READ_ERROR_CODE_OFFSET + err);
+#else
+        // Older BTstack cannot fail a read, the value reads as empty
+        return 0;
+#endif
     }
 
-    case SM_EVENT_PAIRING_COMPLETE:
+    if (BLESecure._readHandler && att_handle == BLESecure._readHandlerHandle)
     {
-        // Pairing completed
-        hci_con_handle_t handle = sm_event_pairing_complete_get_handle(packet);
-        BLEDevice device(handle);
+        return BLESecure._readHandler(BLESecure._readHandlerContext, con_handle, offset, buffer, buffer_size);
+    }
 
-        if (sm_event_pairing_complete_get_status(packet) == ERROR_CODE_SUCCESS)
-        {
-            _pairingStatus = PAIRING_COMPLETE;
-            Serial.println("Pairing complete - success");
-        }
-        else
-        {
-            _pairingStatus = PAIRING_FAILED;
-            Serial.print("Pairing failed, status: ");
-            Serial.print(sm_event_pairing_complete_get_status(packet));
-            Serial.print(", reason: ");
-            Serial.println(sm_event_pairing_complete_get_reason(packet));
-        }
+    // Like BTstackLib, the read callback gets no offset and returns the value from its start
+    if (BLESecure._userGattReadCallback)
+    {
+        return BLESecure._userGattReadCallback(BLESecure._userGattReadContext, att_handle, buffer, buffer_size);
+    }
+    return 0;
+}
 
-        if (_pairingStatusCallback)
-        {
-            _pairingStatusCallback(_pairingStatus, &device);
-        }
+int BLESecureClass::attWriteCallback(hci_con_handle_t con_handle, uint16_t att_handle, uint16_t transaction_mode, uint16_t offset, uint8_t *buffer, uint16_t buffer_size)
+{
+    BLESecureLockHeldScope held;
 
-        _currentDeviceHandle = HCI_CON_HANDLE_INVALID;
-        break;
+    // Execute or cancel of prepared writes, none are queued here
+    if (transaction_mode == ATT_TRANSACTION_MODE_EXECUTE || transaction_mode == ATT_TRANSACTION_MODE_CANCEL)
+        return 0;
+
+    BLESecure.signalEvent();
+
+    // Reject before the application sees the data
+    int err = BLESecure.checkCharacteristicAccess(con_handle, att_handle, true);
+    if (err)
+        return err;
+
+    // The write callback has no offset, so prepared (long) writes are refused
+    if (transaction_mode != ATT_TRANSACTION_MODE_NONE || offset)
+        return ATT_ERROR_REQUEST_NOT_SUPPORTED;
+
+    if (BLESecure._userGattWriteCallback)
+    {
+        return BLESecure._userGattWriteCallback(BLESecure._userGattWriteContext, att_handle, buffer, buffer_size);
     }
+    return 0;
+}
 
-    case SM_EVENT_REENCRYPTION_STARTED:
+void BLESecureClass::signalEvent()
+{
+    // Keep the time of the oldest unhandled event, that is the latency the loop sees.
+    // Disabling interrupts does not stop the other core, the spin lock does.
+    uint32_t irq = spin_lock_blocking(_eventLock);
+    if (!_eventPending)
     {
-        // Re-encryption with previously bonded device
-        // This happens when reconnecting to a bonded device
-        _pairingStatus = PAIRING_STARTED;
-        hci_con_handle_t handle = sm_event_reencryption_started_get_handle(packet);
-        _currentDeviceHandle = handle;
+        _eventSignalUs = time_us_32();
+        _eventPending = true;
+    }
+    spin_unlock(_eventLock, irq);
+    __sev();
+}
 
-        Serial.println("Re-encryption started with bonded device");
+bool BLESecureClass::waitForEvent(uint32_t timeoutMs)
+{
+    absolute_time_t deadline = make_timeout_time_ms(timeoutMs);
 
-        if (_pairingStatusCallback)
-        {
-            BLEDevice device(handle);
-            _pairingStatusCallback(_pairingStatus, &device);
-        }
-        break;
+    // Interrupts (BTstack runs from them) end the WFE early, the flag tells us if it was ours
+    while (!_eventPending)
+    {
+        if (best_effort_wfe_or_timeout(deadline))
+            break;
     }
 
-    case SM_EVENT_REENCRYPTION_COMPLETE:
+    uint32_t irq = spin_lock_blocking(_eventLock);
+    bool event = _eventPending;
+    uint32_t signalUs = _eventSignalUs;
+    _eventPending = false;
+    spin_unlock(_eventLock, irq);
+
+    if (!event)
     {
-        // Re-encryption complete
-        hci_con_handle_t handle = sm_event_reencryption_complete_get_handle(packet);
-        BLEDevice device(handle);
+        _eventWaitStats.timeouts++;
+        return false;
+    }
 
-        if (sm_event_reencryption_complete_get_status(packet) == ERROR_CODE_SUCCESS)
-        {
-            _pairingStatus = PAIRING_COMPLETE;
-            Serial.println("Re-encryption complete - success");
-        }
-        else
+    uint32_t latency = time_us_32() - signalUs;
+    _eventWaitStats.wakeups++;
+    _eventWaitStats.lastLatencyUs = latency;
+    _eventWaitStats.totalLatencyUs += latency;
+    if (latency > _eventWaitStats.maxLatencyUs)
+        _eventWaitStats.maxLatencyUs = latency;
+    return true;
+}
+
+BLEEventWaitStats BLESecureClass::getEventWaitStats()
+{
+    // Only waitForEvent() writes these, from the same loop
+    return _eventWaitStats;
+}
+
+BLESecurityCounters BLESecureClass::getSecurityCounters()
+{
+    BLESecureLock b(LOCK_SITE_GET_SECURITY_COUNTERS);
+    return _securityCounters;
+}
+
+uint8_t BLESecureClass::getSecurityLatencySamples(uint32_t *samples, uint8_t maxSamples)
+{
+    if (!samples)
+        return 0;
+
+    BLESecureLock b(LOCK_SITE_GET_SECURITY_LATENCY_SAMPLES);
+    uint8_t count = _latencySampleCount < maxSamples ? _latencySampleCount : maxSamples;
+    memcpy(samples, _latencySamples, count * sizeof(uint32_t));
+    return count;
+}
+
+void BLESecureClass::setReadHandler(uint16_t attHandle, uint16_t (*handler)(void *ctx, hci_con_handle_t con_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size), void *ctx)
+{
+    BLESecureLock b(LOCK_SITE_SET_READ_HANDLER);
+    _readHandlerHandle = attHandle;
+    _readHandler = handler;
+    _readHandlerContext = ctx;
+    registerAttServiceHandler();
+}
+
+void BLESecureClass::recordSecurityOutcome(const BLEPairingResult &result)
+{
+    if (!(_subscriptions & SM_SUBSCRIBE_STATS))
+        return;
+
+    bool success = result.status == ERROR_CODE_SUCCESS;
+    if (result.reencryption)
+    {
+        if (success)
+            _securityCounters.reencryptions++;
+        else
+            _securityCounters.reencryptionFailures++;
+    }
+    else if (success)
+    {
+        _securityCounters.pairings++;
+        _securityCounters.totalPairingMs += result.elapsedMs;
+    }
+    else
+    {
+        _securityCounters.pairingFailures++;
+        _securityCounters.failureReasons[result.reason < BLESECURE_FAILURE_REASONS ? result.reason : 0]++;
+    }
+
+    if (success && result.elapsedMs != 0)
+    {
+        _latencySamples[_latencySampleNext] = result.elapsedMs;
+        _latencySampleNext = (_latencySampleNext + 1) % BLESECURE_LATENCY_SAMPLES;
+        if (_latencySampleCount < BLESECURE_LATENCY_SAMPLES)
+            _latencySampleCount++;
+    }
+}
+
+BLELockProfile BLESecureClass::getLockProfile(BLELockSite site)
+{
+    return BLESecureLock::getProfile(site);
+}
+
+void BLESecureClass::resetLockProfile()
+{
+    BLESecureLock::resetProfiles();
+}
+
+BLEEventProfile BLESecureClass::getEventProfile(uint8_t smEventType)
+{
+    return BLESecureProfiler::getEventProfile(smEventType);
+}
+
+void BLESecureClass::resetEventProfile()
+{
+    BLESecureProfiler::resetEventProfiles();
+}
+
+void BLESecureClass::printEventProfileCSV(Print &out)
+{
+    BLESecureProfiler::printEventProfileCSV(out);
+}
+
+void BLESecureClass::setLinkUpgrade(uint8_t upgrades)
+{
+    _linkUpgrades = upgrades & LINK_UPGRADE_ALL;
+}
+
+BLELinkInfo BLESecureClass::getLinkInfo(BLEDevice *device)
+{
+    BLELinkInfo info;
+    memset(&info, 0, sizeof(info));
+    if (!device)
+        return info;
+
+    BLESecureLock b(LOCK_SITE_GET_LINK_INFO);
+    ConnectionState *conn = findConnection(device->getHandle());
+    if (!conn)
+        return info;
+
+    info.mtu = att_server_get_mtu(conn->handle);
+    info.txOctets = conn->txOctets;
+    info.rxOctets = conn->rxOctets;
+    info.txPhy = conn->txPhy;
+    info.rxPhy = conn->rxPhy;
+    info.connInterval = conn->connInterval;
+    return info;
+}
+
+uint16_t BLESecureClass::getMaxNotificationPayload(BLEDevice *device)
+{
+    // 3 bytes of every ATT PDU are opcode and handle
+    uint16_t mtu = getLinkInfo(device).mtu;
+    return mtu > 3 ? mtu - 3 : 0;
+}
+
+void BLESecureClass::startLinkUpgrade(hci_con_handle_t handle)
+{
+    ConnectionState *conn = findConnection(handle);
+    if (!conn || _linkUpgrades == LINK_UPGRADE_NONE)
+        return;
+
+    conn->upgradesPending = _linkUpgrades;
+
+    // The MTU exchange is an ATT request and doesn't use the HCI command queue
+    if (conn->upgradesPending & LINK_UPGRADE_MTU)
+    {
+        gatt_client_send_mtu_negotiation(linkUpgradeGattHandler, handle);
+        conn->upgradesPending &= ~LINK_UPGRADE_MTU;
+    }
+    processLinkUpgrades();
+}
+
+void BLESecureClass::processLinkUpgrades()
+{
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
+    {
+        ConnectionState &conn = _connections[i];
+        if (conn.handle == HCI_CON_HANDLE_INVALID || conn.upgradesPending == 0)
+            continue;
+
+        // One HCI command at a time, the next HCI event retries
+        if (!hci_can_send_command_packet_now())
+            return;
+
+        if (conn.upgradesPending & LINK_UPGRADE_DATA_LENGTH)
+        {
+            hci_send_cmd(&hci_le_set_data_length, conn.handle, LINK_MAX_TX_OCTETS, LINK_MAX_TX_TIME);
+            conn.upgradesPending &= ~LINK_UPGRADE_DATA_LENGTH;
+            return;
+        }
+
+        if (conn.upgradesPending & LINK_UPGRADE_PHY_2M)
+        {
+            gap_le_set_phy(conn.handle, 0, LINK_PHY_2M, LINK_PHY_2M, 0);
+            conn.upgradesPending &= ~LINK_UPGRADE_PHY_2M;
+            return;
+        }
+    }
+}
+
+void BLESecureClass::linkUpgradeGattHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    // The new MTU is read back through att_server_get_mtu()
+    (void)packet_type;
+    (void)channel;
+    (void)packet;
+    (void)size;
+}
+
+void BLESecureClass::enableSecurityPhaseConnectionParams(bool enable)
+{
+    _phaseConnParamsEnabled = enable;
+}
+
+void BLESecureClass::setPairingConnectionParams(BLESecurityLevel level, const BLEConnectionParams &params)
+{
+    _pairingConnParams[level & 0x03] = params;
+}
+
+void BLESecureClass::setSteadyConnectionParams(const BLEConnectionParams &params)
+{
+    _steadyConnParams = params;
+}
+
+BLEPairingTimingStats BLESecureClass::getPairingTimingStats(BLESecurityLevel level)
+{
+    BLESecureLock b(LOCK_SITE_GET_PAIRING_TIMING_STATS);
+    return _pairingTiming[level & 0x03];
+}
+
+void BLESecureClass::requestConnectionParams(hci_con_handle_t handle, const BLEConnectionParams &params)
+{
+    gap_request_connection_parameter_update(handle, params.intervalMin, params.intervalMax, params.latency, params.supervisionTimeout);
+}
+
+void BLESecureClass::beginSecurityPhase(hci_con_handle_t handle)
+{
+    ConnectionState *conn = findConnection(handle);
+    if (conn)
+    {
+        conn->pairingStartMs = millis();
+        conn->pairingMethod = PAIRING_METHOD_NONE;
+    }
+
+    if (_phaseConnParamsEnabled)
+        requestConnectionParams(handle, _pairingConnParams[_securityLevel & 0x03]);
+}
+
+void BLESecureClass::endSecurityPhase(hci_con_handle_t handle, bool pairing, bool success)
+{
+    ConnectionState *conn = findConnection(handle);
+    if (conn && pairing && success && conn->pairingStartMs != 0 && (_subscriptions & SM_SUBSCRIBE_STATS))
+    {
+        uint32_t elapsed = millis() - conn->pairingStartMs;
+        BLEPairingTimingStats &timing = _pairingTiming[_securityLevel & 0x03];
+        timing.pairings++;
+        timing.lastMs = elapsed;
+        timing.totalMs += elapsed;
+        if (elapsed > timing.maxMs)
+            timing.maxMs = elapsed;
+        timing.lastInterval = conn->connInterval;
+    }
+    if (conn)
+        conn->pairingStartMs = 0;
+
+    if (_phaseConnParamsEnabled)
+        requestConnectionParams(handle, _steadyConnParams);
+}
+
+void BLESecureClass::enableFastReconnect(bool enable)
+{
+    _fastReconnectEnabled = enable;
+}
+
+void BLESecureClass::setReconnectAdvertising(const BLEReconnectAdvConfig &config)
+{
+    _reconnectConfig = config;
+}
+
+void BLESecureClass::startReconnectAdvertising()
+{
+    BLESecureLock b(LOCK_SITE_START_RECONNECT_ADVERTISING);
+    enterReconnectPhase((_reconnectConfig.directed && _lastBondIndex >= 0) ? RECONNECT_ADV_DIRECTED : RECONNECT_ADV_FAST);
+}
+
+BLEReconnectStats BLESecureClass::getReconnectStats()
+{
+    BLESecureLock b(LOCK_SITE_GET_RECONNECT_STATS);
+    return _reconnectStats;
+}
+
+void BLESecureClass::enterReconnectPhase(BLEReconnectAdvPhase phase)
+{
+    btstack_run_loop_remove_timer(&_reconnectTimer);
+    BLEReconnectAdvPhase previous = _reconnectPhase;
+    _reconnectPhase = phase;
+
+    bd_addr_t direct_addr;
+    memset(direct_addr, 0, sizeof(direct_addr));
+
+    // Remember the interval the schedule replaces, BTstackLib's unless BLESecure changed it
+    if (previous == RECONNECT_ADV_IDLE && phase != RECONNECT_ADV_IDLE)
+    {
+        _savedAdvIntervalMin = _advIntervalMin;
+        _savedAdvIntervalMax = _advIntervalMax;
+    }
+
+    switch (phase)
+    {
+    case RECONNECT_ADV_IDLE:
+        // The schedule ended, advertising started later (BTstack.startAdvertising()) gets the old interval back
+        if (previous != RECONNECT_ADV_IDLE)
+            setAdvertisingParams(_savedAdvIntervalMin, _savedAdvIntervalMax, ADV_TYPE_IND, 0, direct_addr);
+        return;
+
+    case RECONNECT_ADV_DIRECTED:
+    {
+        int addr_type_int;
+        le_device_db_info(_lastBondIndex, &addr_type_int, direct_addr, NULL /* irk */);
+        if (addr_type_int != BD_ADDR_TYPE_LE_PUBLIC && addr_type_int != BD_ADDR_TYPE_LE_RANDOM)
+        {
+            // Bond is gone, go straight to undirected advertising
+            enterReconnectPhase(RECONNECT_ADV_FAST);
+            return;
+        }
+        Serial.print("Directed advertising to bonded peer ");
+        Serial.println(bd_addr_to_str(direct_addr));
+        gap_advertisements_enable(0);
+        setAdvertisingParams(0x0020, 0x0020, ADV_TYPE_DIRECT_IND_HIGH_DUTY, (uint8_t)addr_type_int, direct_addr);
+        gap_advertisements_enable(1);
+        btstack_run_loop_set_timer(&_reconnectTimer, RECONNECT_DIRECTED_TIMEOUT_MS);
+        break;
+    }
+
+    case RECONNECT_ADV_FAST:
+        gap_advertisements_enable(0);
+        setAdvertisingParams(_reconnectConfig.fastIntervalMin, _reconnectConfig.fastIntervalMax, ADV_TYPE_IND, 0, direct_addr);
+        gap_advertisements_enable(1);
+        btstack_run_loop_set_timer(&_reconnectTimer, _reconnectConfig.fastDurationMs);
+        break;
+
+    case RECONNECT_ADV_SLOW:
+        gap_advertisements_enable(0);
+        setAdvertisingParams(_reconnectConfig.slowIntervalMin, _reconnectConfig.slowIntervalMax, ADV_TYPE_IND, 0, direct_addr);
+        gap_advertisements_enable(1);
+        // Slow advertising runs until a central connects
+        return;
+    }
+
+    btstack_run_loop_set_timer_handler(&_reconnectTimer, reconnectTimerHandler);
+    btstack_run_loop_add_timer(&_reconnectTimer);
+}
+
+void BLESecureClass::setAdvertisingParams(uint16_t intervalMin, uint16_t intervalMax, uint8_t advType, uint8_t directAddrType, bd_addr_t directAddr)
+{
+    // Directed advertising already targets a single peer
+    uint8_t filter_policy = (advType == ADV_TYPE_IND) ? _advFilterPolicy : ADV_FILTER_ALLOW_ALL;
+    if (advType == ADV_TYPE_IND)
+    {
+        _advIntervalMin = intervalMin;
+        _advIntervalMax = intervalMax;
+    }
+    gap_advertisements_set_params(intervalMin, intervalMax, advType, directAddrType, directAddr, 0x07, filter_policy);
+}
+
+bool BLESecureClass::restrictToBondedDevices(bool enable)
+{
+    BLESecureLock b(LOCK_SITE_RESTRICT_TO_BONDED_DEVICES);
+    _restrictToBonded = enable;
+    return updateAcceptList();
+}
+
+bool BLESecureClass::refreshAcceptList()
+{
+    BLESecureLock b(LOCK_SITE_REFRESH_ACCEPT_LIST);
+    return updateAcceptList();
+}
+
+int BLESecureClass::getAcceptListSize()
+{
+    return _acceptListSize;
+}
+
+bool BLESecureClass::updateAcceptList()
+{
+    gap_whitelist_clear();
+    _acceptListSize = 0;
+
+    uint16_t bonds_with_irk = 0;
+    if (_restrictToBonded)
+    {
+        for (int slot_index = 0; slot_index < NVM_NUM_DEVICE_DB_ENTRIES; ++slot_index)
+        {
+            int addr_type_int;
+            bd_addr_t addr;
+            sm_key_t irk;
+            memset(irk, 0, sizeof(irk));
+            le_device_db_info(slot_index, &addr_type_int, addr, irk);
+            bd_addr_type_t addr_type = (bd_addr_type_t)addr_type_int;
+
+            if (addr_type == BD_ADDR_TYPE_LE_PUBLIC || addr_type == BD_ADDR_TYPE_LE_RANDOM)
+            {
+                gap_whitelist_add(addr_type, addr);
+                _acceptListSize++;
+                if (!btstack_is_null(irk, sizeof(irk)))
+                    bonds_with_irk++;
+            }
+        }
+    }
+
+    // Peers with an IRK connect from RPAs, which only match their identity address in the
+    // accept list once the controller has resolved them. Restricting without that would
+    // lock out the bonded peers, so advertising stays open instead.
+    uint16_t capacity = _resolutionStats.resolvingListSize;
+    bool resolvable = bonds_with_irk == 0 || (_controllerResolution && (capacity == 0 || bonds_with_irk <= capacity));
+    if (!resolvable)
+    {
+        gap_whitelist_clear();
+        _acceptListSize = 0;
+        Serial.println("Filter Accept List: bonded peers use private addresses, enable controller address resolution first");
+    }
+
+    // With no bonds yet, stay open so a first device can pair
+    uint8_t policy = (_acceptListSize > 0) ? ADV_FILTER_CONNECT_ACCEPT_LIST : ADV_FILTER_ALLOW_ALL;
+    if (policy == _advFilterPolicy)
+        return resolvable;
+    _advFilterPolicy = policy;
+
+    // Re-apply the undirected parameters so the new policy takes effect, keeping the
+    // interval in effect. Directed advertising picks the policy up when it falls back.
+    bd_addr_t no_addr;
+    memset(no_addr, 0, sizeof(no_addr));
+    if (_reconnectPhase != RECONNECT_ADV_DIRECTED)
+        setAdvertisingParams(_advIntervalMin, _advIntervalMax, ADV_TYPE_IND, 0, no_addr);
+
+    Serial.print("Filter Accept List: ");
+    Serial.print(_acceptListSize);
+    Serial.println(_advFilterPolicy == ADV_FILTER_ALLOW_ALL ? " device(s), accepting all connections" : " bonded device(s), accepting only these");
+    return resolvable;
+}
+
+bool BLESecureClass::enableControllerAddressResolution(bool enable)
+{
+#ifdef ENABLE_LE_PRIVACY_ADDRESS_RESOLUTION
+    BLESecureLock b(LOCK_SITE_ENABLE_ADDRESS_RESOLUTION);
+    _controllerResolution = enable;
+    _resolutionDisabled = !enable;
+    _resolutionCommands |= RESOLUTION_CMD_SET_ENABLE;
+
+    // Capacity is reported in the command complete event
+    if (enable)
+    {
+        _resolutionCommands |= RESOLUTION_CMD_READ_LIST_SIZE;
+        updateResolvingList();
+    }
+
+    // Sent now if the HCI command queue has room, otherwise after the next HCI event
+    processResolutionCommands();
+
+    // Whether bonded peers with RPAs can be restricted to the accept list depends on this
+    if (_restrictToBonded)
+        updateAcceptList();
+    return true;
+#else
+    (void)enable;
+    Serial.println("Controller address resolution needs ENABLE_LE_PRIVACY_ADDRESS_RESOLUTION, using host resolution");
+    return false;
+#endif
+}
+
+BLEAddressResolutionStats BLESecureClass::getAddressResolutionStats()
+{
+    BLESecureLock b(LOCK_SITE_GET_ADDRESS_RESOLUTION_STATS);
+    return _resolutionStats;
+}
+
+void BLESecureClass::updateResolvingList()
+{
+#ifdef ENABLE_LE_PRIVACY_ADDRESS_RESOLUTION
+    // BTstack loads as many entries as the controller holds and keeps the
+    // remaining IRKs for host resolution in the Security Manager
+    gap_load_resolving_list_from_le_device_db();
+#endif
+
+    // Only a statistic, it can wait for the startup work
+    if (_startupDeferred)
+    {
+        _irkCountDeferred = true;
+        return;
+    }
+    countBondsWithIrk();
+}
+
+void BLESecureClass::countBondsWithIrk()
+{
+    // Count bonds the controller could resolve (the rest fall back to the SM)
+    uint16_t bonds_with_irk = 0;
+    for (int slot_index = 0; slot_index < NVM_NUM_DEVICE_DB_ENTRIES; ++slot_index)
+    {
+        int addr_type_int;
+        bd_addr_t addr;
+        sm_key_t irk;
+        memset(irk, 0, sizeof(irk));
+        le_device_db_info(slot_index, &addr_type_int, addr, irk);
+        if (addr_type_int != BD_ADDR_TYPE_LE_PUBLIC && addr_type_int != BD_ADDR_TYPE_LE_RANDOM)
+            continue;
+
+        for (unsigned i = 0; i < sizeof(irk); ++i)
+        {
+            if (irk[i])
+            {
+                bonds_with_irk++;
+                break;
+            }
+        }
+    }
+    _resolutionStats.bondsWithIrk = bonds_with_irk;
+}
+
+void BLESecureClass::processResolutionCommands()
+{
+#ifdef ENABLE_LE_PRIVACY_ADDRESS_RESOLUTION
+    // One HCI command at a time, the next HCI event retries
+    if (_resolutionCommands == 0 || !hci_can_send_command_packet_now())
+        return;
+
+    if ((_resolutionCommands & RESOLUTION_CMD_SET_ENABLE) && !_resolutionEnableDisallowed)
+    {
+        hci_send_cmd(&hci_le_set_address_resolution_enable, _controllerResolution ? 1 : 0);
+        _resolutionCommands &= ~RESOLUTION_CMD_SET_ENABLE;
+        _resolutionEnableSent = true;
+        return;
+    }
+
+    if (_resolutionCommands & RESOLUTION_CMD_READ_LIST_SIZE)
+    {
+        hci_send_cmd(&hci_le_read_resolving_list_size);
+        _resolutionCommands &= ~RESOLUTION_CMD_READ_LIST_SIZE;
+        _readResolvingListSize = true;
+    }
+#endif
+}
+
+void BLESecureClass::onBondsChanged()
+{
+    if (_restrictToBonded)
+        updateAcceptList();
+    if (_controllerResolution)
+        updateResolvingList();
+
+    // BTstack turns address resolution back on when it adds a new bond's IRK to the list
+    if (_resolutionDisabled)
+    {
+        _resolutionCommands |= RESOLUTION_CMD_SET_ENABLE;
+        processResolutionCommands();
+    }
+}
+
+void BLESecureClass::setFastStartup(bool enable)
+{
+    // The accept list, resolving list and filter policy decide who may connect, so they are
+    // always built at once, and begin() still sets up the SM right away
+    BLESecureLock b(LOCK_SITE_SET_FAST_STARTUP);
+    if (enable)
+    {
+        _startupDeferred = true;
+        return;
+    }
+
+    // Whatever was deferred runs on the next run loop pass
+    scheduleDeferredStartup();
+}
+
+bool BLESecureClass::deferStartupTask(void (*task)(void *ctx), void *ctx)
+{
+    if (!task)
+        return false;
+
+    {
+        BLESecureLock b(LOCK_SITE_DEFER_STARTUP_TASK);
+        if (_startupDeferred)
+        {
+            if (_startupTaskCount >= BLESECURE_STARTUP_TASKS)
+                return false;
+            _startupTasks[_startupTaskCount] = task;
+            _startupTaskContexts[_startupTaskCount] = ctx;
+            _startupTaskCount++;
+            return true;
+        }
+    }
+
+    task(ctx);
+    return true;
+}
+
+bool BLESecureClass::isStartupDeferred()
+{
+    return _startupDeferred;
+}
+
+void BLESecureClass::markBootMilestone(BLEBootMilestone milestone)
+{
+    if (milestone >= BOOT_MILESTONE_COUNT || _bootTimelineUs[milestone] != 0)
+        return;
+
+    // time_us_64() starts at reset, 0 marks a milestone as not reached
+    uint64_t now = time_us_64();
+    _bootTimelineUs[milestone] = now > 0 ? (uint32_t)now : 1;
+}
+
+uint32_t BLESecureClass::getBootMilestoneUs(BLEBootMilestone milestone)
+{
+    if (milestone >= BOOT_MILESTONE_COUNT)
+        return 0;
+    return _bootTimelineUs[milestone];
+}
+
+void BLESecureClass::printBootTimeline(Print &out)
+{
+    static const char *const names[BOOT_MILESTONE_COUNT] = {
+        "begin",
+        "begin done",
+        "stack working",
+        "advertising",
+        "deferred done",
+        "first connection",
+        "first encryption",
+        "app ready"};
+
+    for (int i = 0; i < BOOT_MILESTONE_COUNT; ++i)
+    {
+        if (_bootTimelineUs[i] == 0)
+            continue;
+        out.print(names[i]);
+        out.print(": ");
+        out.print(_bootTimelineUs[i]);
+        out.println(" us");
+    }
+}
+
+void BLESecureClass::scheduleDeferredStartup()
+{
+    if (!_startupDeferred)
+        return;
+
+    btstack_run_loop_remove_timer(&_startupTimer);
+    btstack_run_loop_set_timer_handler(&_startupTimer, startupTimerHandler);
+    btstack_run_loop_set_timer(&_startupTimer, 0);
+    btstack_run_loop_add_timer(&_startupTimer);
+}
+
+void BLESecureClass::startupTimerHandler(btstack_timer_source_t *ts)
+{
+    BLESecureLockHeldScope held;
+
+    if (BLESecure._irkCountDeferred)
+    {
+        // Library work first, then the application's tasks
+        BLESecure._irkCountDeferred = false;
+        BLESecure.countBondsWithIrk();
+    }
+    else if (BLESecure._startupTaskCount > 0)
+    {
+        // Tasks run oldest first
+        void (*task)(void *ctx) = BLESecure._startupTasks[0];
+        void *ctx = BLESecure._startupTaskContexts[0];
+        BLESecure._startupTaskCount--;
+        for (uint8_t i = 0; i < BLESecure._startupTaskCount; ++i)
+        {
+            BLESecure._startupTasks[i] = BLESecure._startupTasks[i + 1];
+            BLESecure._startupTaskContexts[i] = BLESecure._startupTaskContexts[i + 1];
+        }
+        task(ctx);
+    }
+
+    if (BLESecure._startupTaskCount > 0)
+    {
+        // One piece of work per pass, so HCI and SM events are handled in between
+        btstack_run_loop_set_timer(ts, 0);
+        btstack_run_loop_add_timer(ts);
+        return;
+    }
+
+    BLESecure._startupDeferred = false;
+    BLESecure.markBootMilestone(BOOT_MILESTONE_DEFERRED_DONE);
+}
+
+void BLESecureClass::reconnectTimerHandler(btstack_timer_source_t *ts)
+{
+    BLESecureLockHeldScope held;
+
+    (void)ts;
+    if (BLESecure._reconnectPhase == RECONNECT_ADV_IDLE)
+        BLESecure.enterReconnectPhase((BLESecure._reconnectConfig.directed && BLESecure._lastBondIndex >= 0) ? RECONNECT_ADV_DIRECTED : RECONNECT_ADV_FAST);
+    else if (BLESecure._reconnectPhase == RECONNECT_ADV_DIRECTED)
+        BLESecure.enterReconnectPhase(RECONNECT_ADV_FAST);
+    else if (BLESecure._reconnectPhase == RECONNECT_ADV_FAST)
+        BLESecure.enterReconnectPhase(RECONNECT_ADV_SLOW);
+}
+
+void BLESecureClass::recordReconnect(hci_con_handle_t handle)
+{
+    if (!(_subscriptions & SM_SUBSCRIBE_STATS))
+        return;
+
+    if (_disconnectedAtMs == 0 || _lastBondIndex < 0 || sm_le_device_index(handle) != _lastBondIndex)
+        return;
+
+    uint32_t elapsed = millis() - _disconnectedAtMs;
+    _disconnectedAtMs = 0;
+
+    _reconnectStats.reconnects++;
+    _reconnectStats.lastReconnectMs = elapsed;
+    _reconnectStats.totalReconnectMs += elapsed;
+    if (elapsed > _reconnectStats.maxReconnectMs)
+        _reconnectStats.maxReconnectMs = elapsed;
+
+    switch (_reconnectPhaseAtConnect)
+    {
+    case RECONNECT_ADV_DIRECTED:
+        _reconnectStats.viaDirected++;
+        break;
+    case RECONNECT_ADV_FAST:
+        _reconnectStats.viaFast++;
+        break;
+    case RECONNECT_ADV_SLOW:
+        _reconnectStats.viaSlow++;
+        break;
+    default:
+        break;
+    }
+}
+
+void BLESecureClass::setStaleBondPolicy(BLEStaleBondPolicy policy)
+{
+    _staleBondPolicy = policy;
+}
+
+BLEStaleBondStats BLESecureClass::getStaleBondStats()
+{
+    BLESecureLock b(LOCK_SITE_GET_STALE_BOND_STATS);
+    return _staleBondStats;
+}
+
+bool BLESecureClass::deleteLocalBond(hci_con_handle_t handle)
+{
+    int device_db_index = sm_le_device_index(handle);
+    if (device_db_index < 0)
+        return false;
+
+    int addr_type_int;
+    bd_addr_t addr;
+    le_device_db_info(device_db_index, &addr_type_int, addr, NULL /* irk */);
+    bd_addr_type_t addr_type = (bd_addr_type_t)addr_type_int;
+
+    if (addr_type != BD_ADDR_TYPE_LE_PUBLIC && addr_type != BD_ADDR_TYPE_LE_RANDOM)
+        return false;
+
+    gap_delete_bonding(addr_type, addr);
+    _securityCounters.bondsEvicted++;
+    onBondsChanged();
+    return true;
+}
+
+bool BLESecureClass::recoverStaleBond(hci_con_handle_t handle, uint8_t status)
+{
+    _staleBondStats.reencryptionFailures++;
+
+    if (_staleBondPolicy == STALE_BOND_REPORT)
+        return false;
+
+    // Only one recovery attempt per connection, a second failure is reported. The flag lives
+    // until the disconnect, so it also holds after the first recovery has finished.
+    ConnectionState *conn = findConnection(handle);
+    if (!conn || conn->recoveryAttempted)
+    {
+        finishStaleBondRecovery(conn, false);
+        return false;
+    }
+    conn->recoveryAttempted = true;
+
+    if (_staleBondPolicy == STALE_BOND_DROP_AND_REPAIR && deleteLocalBond(handle))
+    {
+        _staleBondStats.bondsDropped++;
+        Serial.println("Dropped stale local bond entry");
+    }
+
+    // A MIC failure terminates the link, so there is nothing left to pair on
+    if (status == ERROR_CODE_CONNECTION_TERMINATED_DUE_TO_MIC_FAILURE)
+        return false;
+
+    conn->recoveryRunning = true;
+    conn->recoveryStartMs = millis();
+    _staleBondStats.recoveriesStarted++;
+
+    Serial.println("Re-encryption failed - requesting fresh pairing on the same connection");
+    sm_request_pairing(handle);
+    return true;
+}
+
+void BLESecureClass::finishStaleBondRecovery(ConnectionState *conn, bool success)
+{
+    if (!conn || !conn->recoveryRunning)
+        return;
+
+    if (success)
+    {
+        uint32_t elapsed = millis() - conn->recoveryStartMs;
+        _staleBondStats.recoveriesSucceeded++;
+        _staleBondStats.lastRecoveryMs = elapsed;
+        _staleBondStats.totalRecoveryMs += elapsed;
+        if (elapsed > _staleBondStats.maxRecoveryMs)
+            _staleBondStats.maxRecoveryMs = elapsed;
+    }
+    else
+    {
+        _staleBondStats.recoveriesFailed++;
+    }
+
+    conn->recoveryRunning = false;
+}
+
+// Internal connection callback that handles auto-pairing
+void BLESecureClass::internalConnectionCallback(BLEStatus status, BLEDevice *device)
+{
+    // Auto-request pairing if enabled
+    if (status == BLE_STATUS_OK && BLESecure._requestPairingOnConnect)
+    {
+        Serial.println("Auto-requesting pairing as configured in BLESecure");
+        BLESecure.requestPairing(device);
+    }
+
+    // Call the user's callback if registered
+    if (BLESecure._userConnectedCallback)
+    {
+        BLESecure._userConnectedCallback(BLESecure._userConnectedContext, status, device);
+    }
+}
+
+// Internal disconnection callback
+void BLESecureClass::internalDisconnectionCallback(BLEDevice *device)
+{
+    // Reset pairing status if this was the device we were pairing with
+    if (BLESecure._currentDeviceHandle == device->getHandle())
+    {
+        BLESecure._pairingStatus = PAIRING_IDLE;
+        BLESecure._currentDeviceHandle = HCI_CON_HANDLE_INVALID;
+    }
+
+    // Call the user's callback if registered
+    if (BLESecure._userDisconnectedCallback)
+    {
+        BLESecure._userDisconnectedCallback(BLESecure._userDisconnectedContext, device);
+    }
+}
+
+void BLESecureClass::handleHCIEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    BLESecureLockHeldScope held;
+
+    (void)channel;
+    (void)size;
+
+    if (packet_type != HCI_EVENT_PACKET)
+        return;
+
+    // Completed-packet reports arrive for every ACL packet sent, they would wake the loop constantly
+    if (hci_event_packet_get_type(packet) != HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS)
+        signalEvent();
+
+    switch (hci_event_packet_get_type(packet))
+    {
+    case HCI_EVENT_LE_META:
+    {
+        switch (hci_event_le_meta_get_subevent_code(packet))
+        {
+        case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
+        {
+            uint8_t status = hci_subevent_le_connection_complete_get_status(packet);
+            if (status != ERROR_CODE_SUCCESS)
+            {
+                // High-duty directed advertising ended without a connection
+                if (status == ERROR_CODE_ADVERTISING_TIMEOUT && _reconnectPhase == RECONNECT_ADV_DIRECTED)
+                    enterReconnectPhase(RECONNECT_ADV_FAST);
+                break;
+            }
+            hci_con_handle_t handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+            markBootMilestone(BOOT_MILESTONE_FIRST_CONNECTION);
+            scheduleDeferredStartup();
+            ConnectionState *conn = addConnection(handle);
+            if (conn)
+                conn->connInterval = hci_subevent_le_connection_complete_get_conn_interval(packet);
+            _reconnectPhaseAtConnect = _reconnectPhase;
+            enterReconnectPhase(RECONNECT_ADV_IDLE);
+            _resolutionEnableDisallowed = false; // Connectable advertising stopped with the connection
+            break;
+        }
+        case HCI_SUBEVENT_LE_ENHANCED_CONNECTION_COMPLETE:
+        {
+            uint8_t status = hci_subevent_le_enhanced_connection_complete_get_status(packet);
+            if (status != ERROR_CODE_SUCCESS)
+            {
+                if (status == ERROR_CODE_ADVERTISING_TIMEOUT && _reconnectPhase == RECONNECT_ADV_DIRECTED)
+                    enterReconnectPhase(RECONNECT_ADV_FAST);
+                break;
+            }
+            hci_con_handle_t handle = hci_subevent_le_enhanced_connection_complete_get_connection_handle(packet);
+
+            // Peer address types 0x02/0x03 mean the controller resolved an RPA to an identity
+            if (hci_subevent_le_enhanced_connection_complete_get_peer_address_type(packet) >= BD_ADDR_TYPE_LE_PUBLIC_IDENTITY)
+                _resolutionStats.controllerResolved++;
+
+            markBootMilestone(BOOT_MILESTONE_FIRST_CONNECTION);
+            scheduleDeferredStartup();
+            ConnectionState *conn = addConnection(handle);
+            if (conn)
+                conn->connInterval = hci_subevent_le_enhanced_connection_complete_get_conn_interval(packet);
+            _reconnectPhaseAtConnect = _reconnectPhase;
+            enterReconnectPhase(RECONNECT_ADV_IDLE);
+            _resolutionEnableDisallowed = false; // Connectable advertising stopped with the connection
+            break;
+        }
+        case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+        {
+            ConnectionState *conn = findConnection(hci_subevent_le_data_length_change_get_connection_handle(packet));
+            if (conn)
+            {
+                conn->txOctets = hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+                conn->rxOctets = hci_subevent_le_data_length_change_get_max_rx_octets(packet);
+            }
+            break;
+        }
+        case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+        {
+            if (hci_subevent_le_phy_update_complete_get_status(packet) != ERROR_CODE_SUCCESS)
+                break;
+            ConnectionState *conn = findConnection(hci_subevent_le_phy_update_complete_get_connection_handle(packet));
+            if (conn)
+            {
+                conn->txPhy = hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+                conn->rxPhy = hci_subevent_le_phy_update_complete_get_rx_phy(packet);
+            }
+            break;
+        }
+        case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
+        {
+            ConnectionState *conn = findConnection(hci_subevent_le_connection_update_complete_get_connection_handle(packet));
+            if (conn)
+                conn->connInterval = hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+            break;
+        }
+        }
+        break;
+    }
+
+    case BTSTACK_EVENT_STATE:
+    {
+        if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING)
+            markBootMilestone(BOOT_MILESTONE_STACK_WORKING);
+        break;
+    }
+
+    case HCI_EVENT_COMMAND_COMPLETE:
+    {
+        uint16_t opcode = hci_event_command_complete_get_command_opcode(packet);
+#ifdef ENABLE_LE_EXTENDED_ADVERTISING
+        bool advertisingEnable = opcode == HCI_OPCODE_HCI_LE_SET_ADVERTISE_ENABLE || opcode == HCI_OPCODE_HCI_LE_SET_EXTENDED_ADVERTISING_ENABLE;
+#else
+        bool advertisingEnable = opcode == HCI_OPCODE_HCI_LE_SET_ADVERTISE_ENABLE;
+#endif
+        if (advertisingEnable && _bootTimelineUs[BOOT_MILESTONE_ADVERTISING] == 0 &&
+            hci_event_command_complete_get_return_parameters(packet)[0] == ERROR_CODE_SUCCESS)
+        {
+            // The first advertising set is on air, the deferred startup work can run now
+            markBootMilestone(BOOT_MILESTONE_ADVERTISING);
+            scheduleDeferredStartup();
+        }
+
+        // Address resolution cannot be switched while advertising, a refused command waits for it to stop
+        if (advertisingEnable)
+            _resolutionEnableDisallowed = false;
+
+#ifdef ENABLE_LE_PRIVACY_ADDRESS_RESOLUTION
+        if (_resolutionEnableSent && opcode == HCI_OPCODE_HCI_LE_SET_ADDRESS_RESOLUTION_ENABLE)
+        {
+            _resolutionEnableSent = false;
+            if (hci_event_command_complete_get_return_parameters(packet)[0] == ERROR_CODE_COMMAND_DISALLOWED)
+            {
+                _resolutionEnableDisallowed = true;
+                _resolutionCommands |= RESOLUTION_CMD_SET_ENABLE;
+            }
+        }
+#endif
+
+        if (_readResolvingListSize && opcode == HCI_OPCODE_HCI_LE_READ_RESOLVING_LIST_SIZE)
+        {
+            const uint8_t *params = hci_event_command_complete_get_return_parameters(packet);
+            if (params[0] == ERROR_CODE_SUCCESS)
+                _resolutionStats.resolvingListSize = params[1];
+            _readResolvingListSize = false;
+
+            // Bonds beyond the capacity cannot be matched in the accept list
+            if (_restrictToBonded)
+                updateAcceptList();
+        }
+        break;
+    }
+
+    case HCI_EVENT_ENCRYPTION_CHANGE:
+    {
+        if (hci_event_encryption_change_get_status(packet) == ERROR_CODE_SUCCESS && hci_event_encryption_change_get_encryption_enabled(packet))
+            markBootMilestone(BOOT_MILESTONE_FIRST_ENCRYPTION);
+        updateConnectionSecurity(hci_event_encryption_change_get_connection_handle(packet));
+        break;
+    }
+
+    case HCI_EVENT_DISCONNECTION_COMPLETE:
+    {
+        hci_con_handle_t handle = hci_event_disconnection_complete_get_connection_handle(packet);
+
+        // Remember the bonded peer so reconnect advertising can be directed at it
+        ConnectionState *conn = findConnection(handle);
+        if (conn)
+        {
+            _lastBondIndex = conn->bondIndex;
+            _disconnectedAtMs = millis();
+        }
+
+        // A recovery cut short by a disconnect counts as failed
+        finishStaleBondRecovery(conn, false);
+        removeConnection(handle);
+        notifyPairingStep(PAIRING_STEP_DISCONNECTED, handle, hci_event_disconnection_complete_get_reason(packet));
+
+        // The schedule starts on the next run loop pass, after the application's disconnect
+        // callback. Its parameters then replace whatever BTstack.startAdvertising() set there.
+        if (_fastReconnectEnabled)
+        {
+            btstack_run_loop_remove_timer(&_reconnectTimer);
+            btstack_run_loop_set_timer_handler(&_reconnectTimer, reconnectTimerHandler);
+            btstack_run_loop_set_timer(&_reconnectTimer, 0);
+            btstack_run_loop_add_timer(&_reconnectTimer);
+        }
+        break;
+    }
+    }
+
+    // Any HCI event may have freed the command queue
+    processLinkUpgrades();
+    processResolutionCommands();
+}
+
+void BLESecureClass::setEventSubscriptions(uint8_t subscriptions)
+{
+    BLESecureLock b(LOCK_SITE_SET_EVENT_SUBSCRIPTIONS);
+    _subscriptions = subscriptions;
+    _smEventMask = smEventMaskFor(subscriptions);
+}
+
+uint8_t BLESecureClass::getEventSubscriptions()
+{
+    return _subscriptions;
+}
+
+#define SM_EVENT_BIT(event) (1UL << ((event) - SM_EVENT_JUST_WORKS_REQUEST))
+
+uint32_t BLESecureClass::smEventMaskFor(uint8_t subscriptions)
+{
+    // Security state depends on these, they are never filtered
+    uint32_t mask = SM_EVENT_BIT(SM_EVENT_PAIRING_STARTED) |
+                    SM_EVENT_BIT(SM_EVENT_PAIRING_COMPLETE) |
+                    SM_EVENT_BIT(SM_EVENT_REENCRYPTION_STARTED) |
+                    SM_EVENT_BIT(SM_EVENT_REENCRYPTION_COMPLETE);
+
+    if (subscriptions & SM_SUBSCRIBE_PAIRING_PROMPTS)
+    {
+        mask |= SM_EVENT_BIT(SM_EVENT_JUST_WORKS_REQUEST) |
+                SM_EVENT_BIT(SM_EVENT_PASSKEY_DISPLAY_NUMBER) |
+                SM_EVENT_BIT(SM_EVENT_PASSKEY_INPUT_NUMBER) |
+                SM_EVENT_BIT(SM_EVENT_NUMERIC_COMPARISON_REQUEST);
+    }
+    if (subscriptions & SM_SUBSCRIBE_ADDRESS_RESOLUTION)
+    {
+        mask |= SM_EVENT_BIT(SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED) |
+                SM_EVENT_BIT(SM_EVENT_IDENTITY_RESOLVING_FAILED);
+    }
+    return mask;
+}
+
+void BLESecureClass::reportPairingStatus(hci_con_handle_t handle)
+{
+    if (!(_subscriptions & SM_SUBSCRIBE_PAIRING_STATUS) || !_pairingStatusCallback)
+        return;
+
+    BLEDevice device(handle);
+    BLESecureCallbackScope profile;
+    _pairingStatusCallback(_pairingStatusContext, _pairingStatus, &device);
+}
+
+BLEPairingResult BLESecureClass::buildPairingResult(hci_con_handle_t handle, bool reencryption, uint8_t status, uint8_t reason)
+{
+    BLEPairingResult result = {};
+    ConnectionState *conn = findConnection(handle);
+
+    if (conn && conn->pairingStartMs != 0)
+    {
+        uint32_t elapsed = millis() - conn->pairingStartMs;
+        result.elapsedMs = elapsed > 0x7FFFF ? 0x7FFFF : elapsed;
+    }
+    if (conn && !reencryption)
+        result.method = conn->pairingMethod;
+
+    int key_size = gap_encryption_key_size(handle);
+    if (status == ERROR_CODE_SUCCESS && key_size > 0)
+    {
+        result.keySize = key_size;
+        result.authenticated = gap_authenticated(handle) ? 1 : 0;
+        result.secureConnections = gap_secure_connection(handle) ? 1 : 0;
+        result.bonded = sm_le_device_index(handle) >= 0 ? 1 : 0;
+    }
+    result.reencryption = reencryption ? 1 : 0;
+    result.status = status;
+    result.reason = reason;
+    return result;
+}
+
+void BLESecureClass::reportPairingResult(hci_con_handle_t handle, const BLEPairingResult &result)
+{
+    _lastPairingResult = result;
+    notifyPairingStep(PAIRING_STEP_RESULT, handle, 0);
+
+    if (!(_subscriptions & SM_SUBSCRIBE_PAIRING_STATUS) || !_pairingResultCallback)
+        return;
+
+    BLEDevice device(handle);
+    BLESecureCallbackScope profile;
+    _pairingResultCallback(_pairingResultContext, result, &device);
+}
+
+void BLESecureClass::setPairingMethod(hci_con_handle_t handle, BLEPairingMethod method)
+{
+    ConnectionState *conn = findConnection(handle);
+    if (conn)
+        conn->pairingMethod = method;
+}
+
+void BLESecureClass::handleSMEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    (void)channel;
+    (void)size;
+    runSMEvent(packet_type, packet, dispatchSMEvent);
+}
+
+void BLESecureClass::dispatchSMEvent(uint8_t eventType, uint8_t *packet)
+{
+    switch (eventType)
+    {
+    case SM_EVENT_JUST_WORKS_REQUEST:
+        BLESecure.handleJustWorksRequest(packet);
+        break;
+
+    case SM_EVENT_PASSKEY_DISPLAY_NUMBER:
+        BLESecure.handlePasskeyDisplay(packet);
+        break;
+
+    case SM_EVENT_PASSKEY_INPUT_NUMBER:
+        BLESecure.handlePasskeyInput(packet);
+        break;
+
+    case SM_EVENT_NUMERIC_COMPARISON_REQUEST:
+        BLESecure.handleNumericComparison(packet);
+        break;
+
+    default:
+        BLESecure.handlePairingEvent(packet);
+        break;
+    }
+}
+
+void BLESecureClass::runSMEvent(uint8_t packet_type, uint8_t *packet, void (*dispatch)(uint8_t eventType, uint8_t *packet))
+{
+    BLESecureLockHeldScope held;
+
+    if (packet_type != HCI_EVENT_PACKET)
+        return;
+
+    uint8_t eventType = hci_event_packet_get_type(packet);
+    BLESecureEventScope profile(eventType);
+    if (!isSMEventSubscribed(eventType))
+    {
+        declineUnsubscribedPrompt(eventType, packet);
+        return;
+    }
+
+    signalEvent();
+    dispatch(eventType, packet);
+}
+
+void BLESecureClass::declineUnsubscribedPrompt(uint8_t eventType, uint8_t *packet)
+{
+    // Nobody answers the prompt, so fail the pairing now instead of at the SM timeout
+    switch (eventType)
+    {
+    case SM_EVENT_JUST_WORKS_REQUEST:
+    case SM_EVENT_PASSKEY_DISPLAY_NUMBER:
+    case SM_EVENT_PASSKEY_INPUT_NUMBER:
+    case SM_EVENT_NUMERIC_COMPARISON_REQUEST:
+        // The prompt events all carry the connection handle at the same offset
+        sm_bonding_decline(sm_event_just_works_request_get_handle(packet));
+        break;
+
+    default:
+        break;
+    }
+}
+
+void BLESecureClass::handleJustWorksRequest(uint8_t *packet)
+{
+    // Just Works request - auto-confirm if that's our capability
+    hci_con_handle_t handle = sm_event_just_works_request_get_handle(packet);
+    if (isPairingRejected(handle))
+    {
+        sm_bonding_decline(handle);
+        return;
+    }
+    setPairingMethod(handle, PAIRING_METHOD_JUST_WORKS);
+    sm_just_works_confirm(handle);
+    Serial.println("Accepting Just Works pairing request");
+}
+
+void BLESecureClass::handlePasskeyDisplay(uint8_t *packet)
+{
+    // Passkey display - pass to callback if registered
+    uint32_t passkey = sm_event_passkey_display_number_get_passkey(packet);
+    hci_con_handle_t handle = sm_event_passkey_display_number_get_handle(packet);
+    if (isPairingRejected(handle))
+    {
+        sm_bonding_decline(handle);
+        return;
+    }
+    setPairingMethod(handle, PAIRING_METHOD_PASSKEY_DISPLAY);
+
+    if (_passkeyDisplayCallback)
+    {
+        BLESecureCallbackScope profile;
+        _passkeyDisplayCallback(_passkeyDisplayContext, passkey);
+    }
+    Serial.print("Please enter passkey on other device: ");
+    Serial.println(passkey);
+}
+
+void BLESecureClass::handlePasskeyInput(uint8_t *packet)
+{
+    // Passkey input - pass to callback if registered
+    hci_con_handle_t handle = sm_event_passkey_input_number_get_handle(packet);
+    if (isPairingRejected(handle))
+    {
+        sm_bonding_decline(handle);
+        return;
+    }
+    setPairingMethod(handle, PAIRING_METHOD_PASSKEY_ENTRY);
+    notifyPairingStep(PAIRING_STEP_PASSKEY_REQUESTED, handle, 0);
+
+    if (_passkeyEntryCallback)
+    {
+        BLESecureCallbackScope profile;
+        _passkeyEntryCallback(_passkeyEntryContext);
+    }
+    Serial.println("Passkey entry requested - use setEnteredPasskey() to provide the value");
+}
+
+void BLESecureClass::handleNumericComparison(uint8_t *packet)
+{
+    // Numeric comparison - pass to callback if registered
+    uint32_t passkey = sm_event_numeric_comparison_request_get_passkey(packet);
+    hci_con_handle_t handle = sm_event_numeric_comparison_request_get_handle(packet);
+    if (isPairingRejected(handle))
+    {
+        sm_bonding_decline(handle);
+        return;
+    }
+    setPairingMethod(handle, PAIRING_METHOD_NUMERIC_COMPARISON);
+    BLEDevice device(handle);
+
+    Serial.print("Numeric comparison requested. Does this match? ");
+    Serial.println(passkey);
+
+    if (_numericComparisonCallback)
+    {
+        BLESecureCallbackScope profile;
+        _numericComparisonCallback(_numericComparisonContext, passkey, &device);
+    }
+    else
+    {
+        // Auto-accept if no callback
+        sm_numeric_comparison_confirm(handle);
+    }
+}
+
+// Random addresses with 0b01 in the two most significant bits (bd_addr_t is stored MSB first)
+static bool isResolvablePrivateAddress(uint8_t addrType, const bd_addr_t addr)
+{
+    return addrType == BD_ADDR_TYPE_LE_RANDOM && (addr[0] & 0xC0) == 0x40;
+}
+
+void BLESecureClass::handlePairingEvent(uint8_t *packet)
+{
+    switch (hci_event_packet_get_type(packet))
+    {
+    case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+    {
+        // The SM also looks up public and identity addresses, including the identity
+        // address of a link the controller resolved, only count RPAs it had to resolve
+        bd_addr_t addr;
+        sm_event_identity_resolving_succeeded_get_address(packet, addr);
+        if (isResolvablePrivateAddress(sm_event_identity_resolving_succeeded_get_address_type(packet), addr))
+            _resolutionStats.hostResolved++;
+        break;
+    }
+
+    case SM_EVENT_IDENTITY_RESOLVING_FAILED:
+    {
+        // Unbonded peers with public or static addresses fail the lookup as well
+        bd_addr_t addr;
+        sm_event_identity_resolving_failed_get_address(packet, addr);
+        if (isResolvablePrivateAddress(sm_event_identity_resolving_failed_get_address_type(packet), addr))
+            _resolutionStats.hostFailed++;
+        break;
+    }
+
+    case SM_EVENT_PAIRING_STARTED:
+    {
+        hci_con_handle_t handle = sm_event_pairing_started_get_handle(packet);
+
+        // Admission control runs before any pairing crypto is done
+        if (_rateLimitEnabled)
+        {
+            bd_addr_t addr;
+            sm_event_pairing_started_get_address(packet, addr);
+            uint8_t addr_type = sm_event_pairing_started_get_addr_type(packet);
+
+            BLEPairingAdmission admission = _rateLimiter.admit(addr_type, addr, millis());
+            if (admission != PAIRING_ADMITTED)
+            {
+                // Only log when a peer is newly deny-listed so floods don't fill the log
+                if (admission == PAIRING_REJECTED_PEER)
+                {
+                    Serial.print("Pairing rate limit exceeded, deny-listing ");
+                    Serial.println(bd_addr_to_str(addr));
+                }
+                markPairingRejected(handle);
+                gap_disconnect(handle);
+                break;
+            }
+        }
+
+        // Pairing started
+        _pairingStatus = PAIRING_STARTED;
+        _currentDeviceHandle = handle;
+        beginSecurityPhase(handle);
+
+        if (_subscriptions & SM_SUBSCRIBE_TRACE)
+            Serial.println("Pairing started");
+
+        reportPairingStatus(handle);
+        break;
+    }
+
+    case SM_EVENT_PAIRING_COMPLETE:
+    {
+        // Pairing completed
+        hci_con_handle_t handle = sm_event_pairing_complete_get_handle(packet);
+
+        // Rejected attempts were never reported as started
+        if (isPairingRejected(handle))
+            break;
+
+        bd_addr_t addr;
+        sm_event_pairing_complete_get_address(packet, addr);
+        uint8_t addr_type = sm_event_pairing_complete_get_addr_type(packet);
+        BLEPairingResult result = buildPairingResult(handle, false,
+                                                     sm_event_pairing_complete_get_status(packet),
+                                                     sm_event_pairing_complete_get_reason(packet));
+        recordSecurityOutcome(result);
+
+        if (sm_event_pairing_complete_get_status(packet) == ERROR_CODE_SUCCESS)
+        {
+            _pairingStatus = PAIRING_COMPLETE;
+            if (_rateLimitEnabled)
+                _rateLimiter.recordSuccess(addr_type, addr);
+            finishStaleBondRecovery(findConnection(handle), true);
+            updateConnectionSecurity(handle);
+            onBondsChanged();
+            endSecurityPhase(handle, true, true);
+            startLinkUpgrade(handle);
+            if (_subscriptions & SM_SUBSCRIBE_TRACE)
+                Serial.println("Pairing complete - success");
+        }
+        else
         {
             _pairingStatus = PAIRING_FAILED;
-            Serial.print("Re-encryption failed, status: ");
-            Serial.println(sm_event_reencryption_complete_get_status(packet));
+            if (_rateLimitEnabled)
+                _rateLimiter.recordFailure(addr_type, addr, millis());
+            finishStaleBondRecovery(findConnection(handle), false);
+            endSecurityPhase(handle, true, false);
+            if (_subscriptions & SM_SUBSCRIBE_TRACE)
+            {
+                Serial.print("Pairing failed, status: ");
+                Serial.print(sm_event_pairing_complete_get_status(packet));
+                Serial.print(", reason: ");
+                Serial.println(sm_event_pairing_complete_get_reason(packet));
+            }
         }
 
-        if (_pairingStatusCallback)
+        reportPairingResult(handle, result);
+        reportPairingStatus(handle);
+
+        _currentDeviceHandle = HCI_CON_HANDLE_INVALID;
+        break;
+    }
+
+    case SM_EVENT_REENCRYPTION_STARTED:
+    {
+        // Re-encryption with previously bonded device
+        // This happens when reconnecting to a bonded device
+        _pairingStatus = PAIRING_STARTED;
+        hci_con_handle_t handle = sm_event_reencryption_started_get_handle(packet);
+        _currentDeviceHandle = handle;
+        beginSecurityPhase(handle);
+
+        if (_subscriptions & SM_SUBSCRIBE_TRACE)
+            Serial.println("Re-encryption started with bonded device");
+
+        reportPairingStatus(handle);
+        break;
+    }
+
+    case SM_EVENT_REENCRYPTION_COMPLETE:
+    {
+        // Re-encryption complete
+        hci_con_handle_t handle = sm_event_reencryption_complete_get_handle(packet);
+        uint8_t status = sm_event_reencryption_complete_get_status(packet);
+        BLEPairingResult result = buildPairingResult(handle, true, status, 0);
+        recordSecurityOutcome(result);
+
+        if (status == ERROR_CODE_SUCCESS)
+        {
+            _pairingStatus = PAIRING_COMPLETE;
+            updateConnectionSecurity(handle);
+            recordReconnect(handle);
+            endSecurityPhase(handle, false, true);
+            startLinkUpgrade(handle);
+            if (_subscriptions & SM_SUBSCRIBE_TRACE)
+                Serial.println("Re-encryption complete - success");
+        }
+        else
         {
-            _pairingStatusCallback(_pairingStatus, &device);
+            if (_subscriptions & SM_SUBSCRIBE_TRACE)
+            {
+                Serial.print("Re-encryption failed, status: ");
+                Serial.println(status);
+            }
+
+            // Recovery keeps the pairing in progress, the fresh pairing reports the outcome
+            if (recoverStaleBond(handle, status))
+            {
+                _currentDeviceHandle = handle;
+                break;
+            }
+            _pairingStatus = PAIRING_FAILED;
+            endSecurityPhase(handle, false, false);
         }
 
+        reportPairingResult(handle, result);
+        reportPairingStatus(handle);
+
         _currentDeviceHandle = HCI_CON_HANDLE_INVALID;
         break;
     }
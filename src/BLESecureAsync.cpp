@@ -0,0 +1,244 @@
+/**
+ * BLESecureAsync.cpp - Awaitable pairing steps for C++20 coroutines
+ */
+
+#include "BLESecureAsync.h"
+
+#ifdef BLESECURE_HAS_COROUTINES
+
+#include "BluetoothLock.h"
+#include "BLESecureNoHeap.h"
+
+void *BLESecureTask::promise_type::operator new(size_t size) noexcept
+{
+    return BLESecureAsync.allocFrame(size);
+}
+
+void BLESecureTask::promise_type::operator delete(void *frame) noexcept
+{
+    BLESecureAsync.freeFrame(frame);
+}
+
+BLESecureAwaiter::BLESecureAwaiter(BLEPairingStep step, hci_con_handle_t handle, bool requestPairing) : _step(step),
+                                                                                                        _handle(handle),
+                                                                                                        _requestPairing(requestPairing),
+                                                                                                        _ready(false),
+                                                                                                        _coroutine(),
+                                                                                                        _result(),
+                                                                                                        _value(-1)
+{
+}
+
+bool BLESecureAwaiter::await_suspend(std::coroutine_handle<> coroutine)
+{
+    BluetoothLock b;
+    _coroutine = coroutine;
+
+    // Park before requesting, so a result produced right away is not missed
+    if (!BLESecureAsync.addWaiter(this))
+    {
+        _result.status = ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES;
+        return false;
+    }
+
+    if (_requestPairing)
+    {
+        BLEDevice device(_handle);
+        BLESecure.requestPairing(&device);
+    }
+    return true;
+}
+
+BLESecureAsyncClass::BLESecureAsyncClass() : _frameUsed(),
+                                             _waiters(),
+                                             _stats()
+{
+}
+
+void BLESecureAsyncClass::begin()
+{
+    BLESecure.setPairingStepHook(pairingStepHook, this);
+}
+
+BLEPairingAwaiter BLESecureAsyncClass::pair(BLEDevice *device)
+{
+    hci_con_handle_t handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    BLEPairingAwaiter awaiter(handle, true);
+
+    if (handle == HCI_CON_HANDLE_INVALID)
+    {
+        BLEPairingResult result = {};
+        result.status = ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+        awaiter.finish(result);
+    }
+    else if (BLESecure.isEncrypted(device))
+    {
+        awaiter.finish(currentLinkResult(handle));
+    }
+    return awaiter;
+}
+
+BLEPairingAwaiter BLESecureAsyncClass::reencrypt(BLEDevice *device)
+{
+    hci_con_handle_t handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    BLEPairingAwaiter awaiter(handle, true);
+    BLEPairingResult result = {};
+    result.reencryption = 1;
+
+    if (handle == HCI_CON_HANDLE_INVALID)
+    {
+        result.status = ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+        awaiter.finish(result);
+    }
+    else if (sm_le_device_index(handle) < 0)
+    {
+        // Without a bond requestPairing() would start a fresh pairing instead
+        result.status = ERROR_CODE_PIN_OR_KEY_MISSING;
+        awaiter.finish(result);
+    }
+    else if (BLESecure.isEncrypted(device))
+    {
+        awaiter.finish(currentLinkResult(handle));
+    }
+    return awaiter;
+}
+
+BLEPairingAwaiter BLESecureAsyncClass::pairingResult(BLEDevice *device)
+{
+    hci_con_handle_t handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    return BLEPairingAwaiter(handle, false);
+}
+
+BLEPasskeyAwaiter BLESecureAsyncClass::passkeyRequested(BLEDevice *device)
+{
+    return BLEPasskeyAwaiter(PAIRING_STEP_PASSKEY_REQUESTED, device ? device->getHandle() : HCI_CON_HANDLE_INVALID);
+}
+
+BLEPasskeyAwaiter BLESecureAsyncClass::passkeyEntered(BLEDevice *device)
+{
+    return BLEPasskeyAwaiter(PAIRING_STEP_PASSKEY_ENTERED, device ? device->getHandle() : HCI_CON_HANDLE_INVALID);
+}
+
+BLEAsyncStats BLESecureAsyncClass::getStats()
+{
+    BluetoothLock b;
+    return _stats;
+}
+
+void *BLESecureAsyncClass::allocFrame(size_t size)
+{
+    BluetoothLock b;
+    if (size > _stats.largestFrameRequest)
+        _stats.largestFrameRequest = size > 0xFFFF ? 0xFFFF : (uint16_t)size;
+
+    if (size <= BLESECURE_ASYNC_FRAME_SIZE)
+    {
+        for (int i = 0; i < BLESECURE_ASYNC_FRAMES; ++i)
+        {
+            if (!_frameUsed[i])
+            {
+                _frameUsed[i] = true;
+                _stats.framesInUse++;
+                if (_stats.framesInUse > _stats.peakFramesInUse)
+                    _stats.peakFramesInUse = _stats.framesInUse;
+                return _frames[i];
+            }
+        }
+    }
+
+    _stats.allocFailures++;
+    return nullptr;
+}
+
+void BLESecureAsyncClass::freeFrame(void *frame)
+{
+    BluetoothLock b;
+    for (int i = 0; i < BLESECURE_ASYNC_FRAMES; ++i)
+    {
+        if (frame == _frames[i] && _frameUsed[i])
+        {
+            _frameUsed[i] = false;
+            _stats.framesInUse--;
+            return;
+        }
+    }
+}
+
+bool BLESecureAsyncClass::addWaiter(BLESecureAwaiter *waiter)
+{
+    for (int i = 0; i < BLESECURE_ASYNC_WAITERS; ++i)
+    {
+        if (!_waiters[i])
+        {
+            _waiters[i] = waiter;
+            return true;
+        }
+    }
+    _stats.waiterOverflows++;
+    return false;
+}
+
+BLEPairingResult BLESecureAsyncClass::currentLinkResult(hci_con_handle_t handle)
+{
+    BLEPairingResult result = {};
+    result.keySize = gap_encryption_key_size(handle);
+    result.authenticated = gap_authenticated(handle) ? 1 : 0;
+    result.secureConnections = gap_secure_connection(handle) ? 1 : 0;
+    result.bonded = sm_le_device_index(handle) >= 0 ? 1 : 0;
+    result.status = ERROR_CODE_SUCCESS;
+    return result;
+}
+
+void BLESecureAsyncClass::handlePairingStep(BLEPairingStep step, hci_con_handle_t handle, uint32_t value)
+{
+    // Collect first: resumed coroutines may park new waiters that must not see this step
+    BLESecureAwaiter *ready[BLESECURE_ASYNC_WAITERS];
+    int count = 0;
+
+    for (int i = 0; i < BLESECURE_ASYNC_WAITERS; ++i)
+    {
+        BLESecureAwaiter *waiter = _waiters[i];
+        if (!waiter)
+            continue;
+
+        if (step == PAIRING_STEP_DISCONNECTED)
+        {
+            // Only waiters bound to this connection can no longer complete
+            if (waiter->_handle != handle)
+                continue;
+            waiter->_result = BLEPairingResult();
+            waiter->_result.status = (uint8_t)value;
+            waiter->_value = -1;
+        }
+        else
+        {
+            if (waiter->_step != step)
+                continue;
+            if (waiter->_handle != HCI_CON_HANDLE_INVALID && waiter->_handle != handle)
+                continue;
+
+            if (step == PAIRING_STEP_RESULT)
+                waiter->_result = BLESecure.getLastPairingResult();
+            else
+                waiter->_value = (int32_t)value;
+        }
+
+        _waiters[i] = nullptr;
+        ready[count++] = waiter;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        ready[i]->_coroutine.resume();
+    }
+}
+
+void BLESecureAsyncClass::pairingStepHook(void *ctx, BLEPairingStep step, hci_con_handle_t handle, uint32_t value)
+{
+    static_cast<BLESecureAsyncClass *>(ctx)->handlePairingStep(step, handle, value);
+}
+
+// Create a global instance
+BLESecureAsyncClass BLESecureAsync;
+
+#endif // BLESECURE_HAS_COROUTINES
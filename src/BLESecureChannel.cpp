@@ -0,0 +1,319 @@
+/**
+ * BLESecureChannel.cpp - Encrypted bulk transfer over an LE credit-based L2CAP channel
+ */
+
+#include "BLESecureChannel.h"
+#include "BluetoothLock.h"
+#include "l2cap.h"
+#include "BLESecureNoHeap.h"
+
+// Map BLESecure levels to the levels L2CAP enforces itself
+static gap_security_level_t toGapSecurityLevel(BLESecurityLevel level)
+{
+    switch (level)
+    {
+    case SECURITY_MEDIUM:
+        return LEVEL_2;
+    case SECURITY_HIGH:
+        return LEVEL_3;
+    case SECURITY_HIGH_SC:
+        return LEVEL_4;
+    default:
+        return LEVEL_0;
+    }
+}
+
+BLESecureChannelClass::BLESecureChannelClass() : _psm(0),
+                                                 _minLevel(SECURITY_MEDIUM),
+                                                 _localCid(0),
+                                                 _handle(HCI_CON_HANDLE_INVALID),
+                                                 _remoteMtu(0),
+                                                 _initialCredits(0),
+                                                 _pendingCredits(0),
+                                                 _stats(),
+                                                 _txHead(0),
+                                                 _txTail(0),
+                                                 _txCount(0),
+                                                 _txSending(false),
+                                                 _receiveCallback(nullptr),
+                                                 _openCallback(nullptr),
+                                                 _closedCallback(nullptr)
+{
+}
+
+bool BLESecureChannelClass::begin(uint16_t psm, BLESecurityLevel minLevel)
+{
+    BluetoothLock b;
+    _psm = psm;
+    _minLevel = minLevel;
+
+    uint8_t status = l2cap_cbm_register_service(l2capPacketHandler, psm, toGapSecurityLevel(minLevel));
+    if (status != ERROR_CODE_SUCCESS)
+    {
+        Serial.print("BLESecureChannel: could not register PSM, status: ");
+        Serial.println(status);
+        return false;
+    }
+    return true;
+}
+
+bool BLESecureChannelClass::isOpen()
+{
+    return _localCid != 0;
+}
+
+uint8_t *BLESecureChannelClass::acquireSendBuffer(uint16_t *capacity)
+{
+    // The BTstack context frees slots, read the ring under the same lock as commitSendBuffer()
+    BluetoothLock b;
+    if (_txCount >= BLESECURE_CHANNEL_TX_SLOTS)
+    {
+        _stats.sendQueueFull++;
+        return nullptr;
+    }
+
+    if (capacity)
+    {
+        // Never build SDUs larger than the peer accepts
+        uint16_t limit = BLESECURE_CHANNEL_MTU;
+        if (_remoteMtu && _remoteMtu < limit)
+            limit = _remoteMtu;
+        *capacity = limit;
+    }
+    return _txBuffers[_txHead];
+}
+
+bool BLESecureChannelClass::commitSendBuffer(uint16_t length)
+{
+    if (!isOpen() || _txCount >= BLESECURE_CHANNEL_TX_SLOTS || length == 0 || length > BLESECURE_CHANNEL_MTU)
+        return false;
+    if (_remoteMtu && length > _remoteMtu)
+        return false;
+
+    BluetoothLock b;
+    _txLengths[_txHead] = length;
+    _txHead = (_txHead + 1) % BLESECURE_CHANNEL_TX_SLOTS;
+    _txCount++;
+    scheduleSend();
+    return true;
+}
+
+bool BLESecureChannelClass::send(const uint8_t *data, uint16_t length)
+{
+    uint16_t capacity;
+    uint8_t *slot = acquireSendBuffer(&capacity);
+    if (!slot || length > capacity)
+        return false;
+
+    memcpy(slot, data, length);
+    return commitSendBuffer(length);
+}
+
+uint8_t BLESecureChannelClass::getQueuedCount()
+{
+    return _txCount;
+}
+
+void BLESecureChannelClass::disconnect()
+{
+    if (!isOpen())
+        return;
+
+    BluetoothLock b;
+    l2cap_cbm_disconnect(_localCid);
+}
+
+void BLESecureChannelClass::setReceiveCallback(void (*callback)(const uint8_t *data, uint16_t length))
+{
+    _receiveCallback = callback;
+}
+
+void BLESecureChannelClass::setOpenCallback(void (*callback)(BLEDevice *device, uint16_t remoteMtu))
+{
+    _openCallback = callback;
+}
+
+void BLESecureChannelClass::setClosedCallback(void (*callback)(void))
+{
+    _closedCallback = callback;
+}
+
+BLEChannelStats BLESecureChannelClass::getStats()
+{
+    BluetoothLock b;
+    return _stats;
+}
+
+void BLESecureChannelClass::resetStats()
+{
+    BluetoothLock b;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+uint16_t BLESecureChannelClass::pdusForSdu(uint16_t length)
+{
+    // L2CAP uses MPS = min(max LE MTU, our MTU), the first PDU carries a 2-byte SDU length
+    uint16_t mps = l2cap_max_le_mtu();
+    if (mps > BLESECURE_CHANNEL_MTU)
+        mps = BLESECURE_CHANNEL_MTU;
+    if (mps == 0)
+        return 1;
+    return (length + 2 + mps - 1) / mps;
+}
+
+void BLESecureChannelClass::scheduleSend()
+{
+    if (_localCid && _txCount > 0 && !_txSending)
+    {
+        l2cap_cbm_request_can_send_now_event(_localCid);
+    }
+}
+
+void BLESecureChannelClass::resetRing()
+{
+    _txHead = 0;
+    _txTail = 0;
+    _txCount = 0;
+    _txSending = false;
+}
+
+void BLESecureChannelClass::l2capPacketHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    BLESecureLockHeldScope held;
+
+    BLESecureChannel.handleL2CAPEvent(packet_type, channel, packet, size);
+}
+
+void BLESecureChannelClass::handleL2CAPEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    if (packet_type == L2CAP_DATA_PACKET)
+    {
+        if (channel != _localCid)
+            return;
+
+        _stats.sdusReceived++;
+        _stats.bytesReceived += size;
+
+        // Delivered straight from the receive buffer, no copy
+        if (_receiveCallback)
+        {
+            _receiveCallback(packet, size);
+        }
+
+        // The buffer is free again: return credits in batches to keep the peer streaming
+        _pendingCredits += pdusForSdu(size);
+        if (_pendingCredits >= _initialCredits / 2)
+        {
+            l2cap_cbm_provide_credits(_localCid, _pendingCredits);
+            _pendingCredits = 0;
+        }
+        return;
+    }
+
+    if (packet_type != HCI_EVENT_PACKET)
+        return;
+
+    switch (hci_event_packet_get_type(packet))
+    {
+    case L2CAP_EVENT_CBM_INCOMING_CONNECTION:
+    {
+        uint16_t cid = l2cap_event_cbm_incoming_connection_get_local_cid(packet);
+        hci_con_handle_t handle = l2cap_event_cbm_incoming_connection_get_handle(packet);
+        BLEDevice device(handle);
+
+        // L2CAP already checked the GAP level, this also covers SC-only and key size policies
+        if (BLESecure.getSecurityLevel(&device) < _minLevel)
+        {
+            _stats.rejectedInsecure++;
+            l2cap_cbm_decline_connection(cid, L2CAP_CBM_CONNECTION_RESULT_INSUFFICIENT_AUTHENTICATION);
+            break;
+        }
+
+        // One channel at a time
+        if (_localCid != 0)
+        {
+            l2cap_cbm_decline_connection(cid, L2CAP_CBM_CONNECTION_RESULT_NO_RESOURCES_AVAILABLE);
+            break;
+        }
+
+        _initialCredits = pdusForSdu(BLESECURE_CHANNEL_MTU) * BLESECURE_CHANNEL_RX_WINDOW;
+        _pendingCredits = 0;
+        l2cap_cbm_accept_connection(cid, _rxBuffer, sizeof(_rxBuffer), _initialCredits);
+        break;
+    }
+
+    case L2CAP_EVENT_CBM_CHANNEL_OPENED:
+    {
+        if (l2cap_event_cbm_channel_opened_get_status(packet) != ERROR_CODE_SUCCESS)
+            break;
+
+        _localCid = l2cap_event_cbm_channel_opened_get_local_cid(packet);
+        _handle = l2cap_event_cbm_channel_opened_get_handle(packet);
+        _remoteMtu = l2cap_event_cbm_channel_opened_get_remote_mtu(packet);
+        resetRing();
+
+        Serial.print("BLESecureChannel: channel open, remote MTU: ");
+        Serial.println(_remoteMtu);
+
+        if (_openCallback)
+        {
+            BLEDevice device(_handle);
+            _openCallback(&device, _remoteMtu);
+        }
+        break;
+    }
+
+    case L2CAP_EVENT_CAN_SEND_NOW:
+    {
+        if (l2cap_event_can_send_now_get_local_cid(packet) != _localCid || _txCount == 0 || _txSending)
+            break;
+
+        // L2CAP segments straight out of the slot, it stays reserved until sent
+        _txSending = true;
+        if (l2cap_cbm_send_data(_localCid, _txBuffers[_txTail], _txLengths[_txTail]) != ERROR_CODE_SUCCESS)
+        {
+            // No PACKET_SENT follows a refused SDU, keep it queued and ask again
+            _stats.sendErrors++;
+            _txSending = false;
+            scheduleSend();
+        }
+        break;
+    }
+
+    case L2CAP_EVENT_PACKET_SENT:
+    {
+        if (l2cap_event_packet_sent_get_local_cid(packet) != _localCid || !_txSending)
+            break;
+
+        _stats.sdusSent++;
+        _stats.bytesSent += _txLengths[_txTail];
+        _txTail = (_txTail + 1) % BLESECURE_CHANNEL_TX_SLOTS;
+        _txCount--;
+        _txSending = false;
+        scheduleSend();
+        break;
+    }
+
+    case L2CAP_EVENT_CHANNEL_CLOSED:
+    {
+        if (l2cap_event_channel_closed_get_local_cid(packet) != _localCid)
+            break;
+
+        _localCid = 0;
+        _handle = HCI_CON_HANDLE_INVALID;
+        _remoteMtu = 0;
+        resetRing();
+
+        Serial.println("BLESecureChannel: channel closed");
+
+        if (_closedCallback)
+        {
+            _closedCallback();
+        }
+        break;
+    }
+    }
+}
+
+// Create a global instance
+BLESecureChannelClass BLESecureChannel;
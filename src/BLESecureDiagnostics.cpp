@@ -0,0 +1,156 @@
+/**
+ * BLESecureDiagnostics.cpp - Security metrics as a GATT diagnostics service
+ */
+
+#include "BLESecureDiagnostics.h"
+#include "BluetoothLock.h"
+#include "ble/le_device_db.h"
+#include "BLESecureNoHeap.h"
+
+static_assert(sizeof(BLEDiagnosticsRecord) == 44, "diagnostics record layout changed, bump BLESECURE_DIAGNOSTICS_VERSION");
+
+static UUID diagnosticsService("7d1a0c00-5e2b-4f8a-9c3d-b1e5ec0d1a90");
+static UUID diagnosticsRecordUUID("7d1a0c01-5e2b-4f8a-9c3d-b1e5ec0d1a90");
+
+static uint16_t saturate16(uint32_t value)
+{
+    return value > 0xFFFF ? 0xFFFF : value;
+}
+
+static uint8_t saturate8(uint32_t value)
+{
+    return value > 0xFF ? 0xFF : value;
+}
+
+BLESecureDiagnosticsClass::BLESecureDiagnosticsClass() : _handle(0),
+                                                         _reads(0),
+                                                         _snapshot(),
+                                                         _snapshotHandle(HCI_CON_HANDLE_INVALID)
+{
+}
+
+uint16_t BLESecureDiagnosticsClass::begin(BLESecurityLevel level)
+{
+    if (_handle)
+        return _handle;
+
+    BTstack.addGATTService(&diagnosticsService);
+    _handle = BTstack.addGATTCharacteristicDynamic(&diagnosticsRecordUUID, ATT_PROPERTY_READ, 0);
+
+    // Metrics reveal usage patterns, never hand them out on a plain link
+    BLESecure.setCharacteristicSecurity(_handle, level < SECURITY_MEDIUM ? SECURITY_MEDIUM : level);
+    BLESecure.setReadHandler(_handle, readHandler, this);
+    return _handle;
+}
+
+BLEDiagnosticsRecord BLESecureDiagnosticsClass::getRecord()
+{
+    BLEDiagnosticsRecord record;
+    memset(&record, 0, sizeof(record));
+    record.version = BLESECURE_DIAGNOSTICS_VERSION;
+    record.uptimeS = millis() / 1000;
+
+    BLESecurityCounters counters = BLESecure.getSecurityCounters();
+    record.pairings = saturate16(counters.pairings);
+    record.pairingFailures = saturate16(counters.pairingFailures);
+    record.reencryptions = saturate16(counters.reencryptions);
+    record.reencryptionFailures = saturate16(counters.reencryptionFailures);
+    for (int i = 0; i < BLESECURE_FAILURE_REASONS; ++i)
+    {
+        record.failureReasons[i] = saturate8(counters.failureReasons[i]);
+    }
+
+    computeLatency(record);
+
+    {
+        BluetoothLock b;
+        record.bondCount = saturate8(le_device_db_count());
+        record.bondCapacity = saturate8(le_device_db_max_count());
+    }
+
+    computeLockStats(record);
+    return record;
+}
+
+uint16_t BLESecureDiagnosticsClass::getHandle()
+{
+    return _handle;
+}
+
+uint32_t BLESecureDiagnosticsClass::getReadCount()
+{
+    return _reads;
+}
+
+void BLESecureDiagnosticsClass::computeLatency(BLEDiagnosticsRecord &record)
+{
+    uint32_t samples[BLESECURE_LATENCY_SAMPLES];
+    uint8_t count = BLESecure.getSecurityLatencySamples(samples, BLESECURE_LATENCY_SAMPLES);
+    record.latencySamples = count;
+    if (count == 0)
+        return;
+
+    // Insertion sort, the sample window is small
+    for (uint8_t i = 1; i < count; ++i)
+    {
+        uint32_t value = samples[i];
+        int j = i - 1;
+        while (j >= 0 && samples[j] > value)
+        {
+            samples[j + 1] = samples[j];
+            j--;
+        }
+        samples[j + 1] = value;
+    }
+
+    // Nearest-rank percentiles
+    record.latencyP50Ms = saturate16(samples[(count * 50 + 99) / 100 - 1]);
+    record.latencyP90Ms = saturate16(samples[(count * 90 + 99) / 100 - 1]);
+    record.latencyMaxMs = saturate16(samples[count - 1]);
+}
+
+void BLESecureDiagnosticsClass::computeLockStats(BLEDiagnosticsRecord &record)
+{
+    uint32_t maxHoldNs = 0;
+    for (int site = 0; site < LOCK_SITE_COUNT; ++site)
+    {
+        BLELockProfile profile = BLESecure.getLockProfile((BLELockSite)site);
+        record.lockAcquisitions += profile.acquisitions;
+        if (profile.maxHoldNs > maxHoldNs)
+        {
+            maxHoldNs = profile.maxHoldNs;
+            record.lockMaxHoldSite = site;
+        }
+    }
+    record.lockMaxHoldUs = saturate16(maxHoldNs / 1000);
+}
+
+uint16_t BLESecureDiagnosticsClass::readHandler(void *ctx, hci_con_handle_t con_handle, uint16_t offset, uint8_t *buffer, uint16_t buffer_size)
+{
+    // ATT asks for the length first, the record is only built for the actual read
+    if (!buffer)
+        return sizeof(BLEDiagnosticsRecord);
+
+    BLESecureDiagnosticsClass *self = (BLESecureDiagnosticsClass *)ctx;
+
+    // Below MTU 47 a read at offset 0 is followed by Read Blob requests, which are served
+    // from the same snapshot so the parts belong together. If another central read in
+    // between, a blob request gets a fresh record.
+    if (offset == 0 || con_handle != self->_snapshotHandle)
+    {
+        self->_snapshot = self->getRecord();
+        self->_snapshotHandle = con_handle;
+        self->_reads++;
+    }
+
+    if (offset >= sizeof(self->_snapshot))
+        return 0;
+    uint16_t len = sizeof(self->_snapshot) - offset;
+    if (len > buffer_size)
+        len = buffer_size;
+    memcpy(buffer, (const uint8_t *)&self->_snapshot + offset, len);
+    return len;
+}
+
+// Create a global instance
+BLESecureDiagnosticsClass BLESecureDiagnostics;
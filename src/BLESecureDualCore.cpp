@@ -0,0 +1,182 @@
+/**
+ * BLESecureDualCore.cpp - Run BLESecure and BTstack on one core, the application on the other
+ */
+
+#include "BLESecureDualCore.h"
+#include "pico/time.h"
+#include "pico/platform.h"
+#include "BLESecureNoHeap.h"
+
+BLESecureDualCoreClass::BLESecureDualCoreClass() : _started(false),
+                                                   _stackCore(0),
+                                                   _stats(),
+                                                   _router(onEvent, this)
+{
+}
+
+bool BLESecureDualCoreClass::begin()
+{
+    if (_started)
+        return true;
+
+    // BLESecure and BTstack stay on the core that set them up
+    _stackCore = get_core_num();
+
+    // Route every user-facing callback into the rings
+    _router.attach();
+
+    _started = true;
+    return true;
+}
+
+int BLESecureDualCoreClass::poll()
+{
+    // The command ring has a single consumer, the stack core
+    if (!_started || get_core_num() != _stackCore)
+        return 0;
+
+    int executed = 0;
+    Command command;
+    while (_commands.pop(&command))
+    {
+        BLESecureEventRouter::runCommand(command.command);
+
+        uint32_t latency = time_us_32() - command.postedUs;
+        _stats.commandsExecuted++;
+        if (latency > _stats.maxCommandLatencyUs)
+            _stats.maxCommandLatencyUs = latency;
+        executed++;
+    }
+    return executed;
+}
+
+bool BLESecureDualCoreClass::receiveEvent(BLESecurityEvent *event, uint32_t timeoutMs)
+{
+    if (!event || !_started)
+        return false;
+
+    if (takeEvent(event))
+        return true;
+    if (timeoutMs == 0)
+        return false;
+
+    // postEvent() sends SEV after every push
+    absolute_time_t deadline = make_timeout_time_ms(timeoutMs);
+    while (!takeEvent(event))
+    {
+        if (best_effort_wfe_or_timeout(deadline))
+            return takeEvent(event);
+    }
+    return true;
+}
+
+bool BLESecureDualCoreClass::requestPairing(BLEDevice *device)
+{
+    if (!device)
+        return false;
+
+    return postCommand(SECURITY_COMMAND_REQUEST_PAIRING, device->getHandle(), 0);
+}
+
+bool BLESecureDualCoreClass::removeBonding(BLEDevice *device)
+{
+    if (!device)
+        return false;
+
+    return postCommand(SECURITY_COMMAND_REMOVE_BONDING, device->getHandle(), 0);
+}
+
+bool BLESecureDualCoreClass::clearAllBondings()
+{
+    return postCommand(SECURITY_COMMAND_CLEAR_ALL_BONDINGS, HCI_CON_HANDLE_INVALID, 0);
+}
+
+bool BLESecureDualCoreClass::setEnteredPasskey(uint32_t passkey)
+{
+    return postCommand(SECURITY_COMMAND_SET_ENTERED_PASSKEY, HCI_CON_HANDLE_INVALID, passkey);
+}
+
+bool BLESecureDualCoreClass::acceptNumericComparison(bool accept)
+{
+    return postCommand(SECURITY_COMMAND_ACCEPT_NUMERIC_COMPARISON, HCI_CON_HANDLE_INVALID, accept);
+}
+
+uint8_t BLESecureDualCoreClass::getStackCore()
+{
+    return _stackCore;
+}
+
+BLEDualCoreStats BLESecureDualCoreClass::getStats()
+{
+    // Fields are single-writer 32-bit words, a copy may mix values from slightly different moments
+    return _stats;
+}
+
+bool BLESecureDualCoreClass::postCommand(uint8_t type, hci_con_handle_t handle, uint32_t value)
+{
+    if (!_started)
+        return false;
+
+    Command command = {{type, handle, value}, time_us_32()};
+    if (!_commands.push(command))
+    {
+        _stats.commandsDropped++;
+        return false;
+    }
+    _stats.commandsPosted++;
+
+    // Wake the stack core's waitForEvent() so loop() reaches poll()
+    BLESecure.signalEvent();
+    return true;
+}
+
+void BLESecureDualCoreClass::postEvent(const BLESecurityEvent &event, bool prompt)
+{
+    // Never block the BTstack context, a full ring drops the event
+    EventSlot slot = {event, time_us_32()};
+    bool posted = prompt ? _prompts.push(slot) : _events.push(slot);
+
+    if (posted)
+        _stats.eventsPosted++;
+    else
+        _stats.eventsDropped++;
+
+    // Nobody will answer a dropped prompt, fail the pairing now rather than at the SM timeout
+    if (!posted && prompt)
+    {
+        BLESecure.declinePairing();
+        _stats.promptsDeclined++;
+    }
+
+    uint32_t queued = _events.size() + _prompts.size();
+    if (queued > _stats.peakEventsQueued)
+        _stats.peakEventsQueued = queued;
+
+    __sev();
+}
+
+bool BLESecureDualCoreClass::takeEvent(BLESecurityEvent *event)
+{
+    // Prompts first, the Security Manager times out waiting for an answer
+    EventSlot slot;
+    if (!_prompts.pop(&slot) && !_events.pop(&slot))
+        return false;
+
+    uint32_t latency = time_us_32() - slot.postedUs;
+    _stats.eventsReceived++;
+    _stats.lastEventLatencyUs = latency;
+    _stats.totalEventLatencyUs += latency;
+    if (latency > _stats.maxEventLatencyUs)
+        _stats.maxEventLatencyUs = latency;
+
+    *event = slot.event;
+    return true;
+}
+
+void BLESecureDualCoreClass::onEvent(void *ctx, const BLESecurityEvent &event, bool prompt)
+{
+    ((BLESecureDualCoreClass *)ctx)->postEvent(event, prompt);
+}
+
+// Create a global instance
+BLESecureDualCoreClass BLESecureDualCore;
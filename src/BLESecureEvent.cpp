@@ -0,0 +1,114 @@
+/**
+ * BLESecureEvent.cpp - Security events passed between execution contexts
+ */
+
+#include "BLESecureEvent.h"
+#include "BLESecureNoHeap.h"
+
+BLESecureEventRouter::BLESecureEventRouter(PostFunction post, void *ctx) : _post(post),
+                                                                           _ctx(ctx)
+{
+}
+
+void BLESecureEventRouter::attach()
+{
+    BLESecure.setBLEDeviceConnectedCallback(onConnected, this);
+    BLESecure.setBLEDeviceDisconnectedCallback(onDisconnected, this);
+    BLESecure.setPasskeyDisplayCallback(onPasskeyDisplay, this);
+    BLESecure.setPasskeyEntryCallback(onPasskeyEntry, this);
+    BLESecure.setNumericComparisonCallback(onNumericComparison, this);
+    BLESecure.setPairingStatusCallback(onPairingStatus, this);
+    BLESecure.setPairingResultCallback(onPairingResult, this);
+}
+
+void BLESecureEventRouter::runCommand(const BLESecurityCommand &command)
+{
+    BLEDevice device(command.handle);
+
+    switch (command.type)
+    {
+    case SECURITY_COMMAND_REQUEST_PAIRING:
+        BLESecure.requestPairing(&device);
+        break;
+    case SECURITY_COMMAND_REMOVE_BONDING:
+        BLESecure.removeBonding(&device);
+        break;
+    case SECURITY_COMMAND_CLEAR_ALL_BONDINGS:
+        BLESecure.clearAllBondings();
+        break;
+    case SECURITY_COMMAND_SET_ENTERED_PASSKEY:
+        BLESecure.setEnteredPasskey(command.value);
+        break;
+    case SECURITY_COMMAND_ACCEPT_NUMERIC_COMPARISON:
+        BLESecure.acceptNumericComparison(command.value != 0);
+        break;
+    }
+}
+
+void BLESecureEventRouter::onConnected(void *ctx, BLEStatus status, BLEDevice *device)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_CONNECTED;
+    event.handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    event.status = status;
+    router->_post(router->_ctx, event, false);
+}
+
+void BLESecureEventRouter::onDisconnected(void *ctx, BLEDevice *device)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_DISCONNECTED;
+    event.handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    router->_post(router->_ctx, event, false);
+}
+
+void BLESecureEventRouter::onPasskeyDisplay(void *ctx, uint32_t passkey)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_PASSKEY_DISPLAY;
+    event.handle = HCI_CON_HANDLE_INVALID;
+    event.passkey = passkey;
+    router->_post(router->_ctx, event, true);
+}
+
+void BLESecureEventRouter::onPasskeyEntry(void *ctx)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_PASSKEY_REQUEST;
+    event.handle = HCI_CON_HANDLE_INVALID;
+    router->_post(router->_ctx, event, true);
+}
+
+void BLESecureEventRouter::onNumericComparison(void *ctx, uint32_t passkey, BLEDevice *device)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_NUMERIC_COMPARISON;
+    event.handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    event.passkey = passkey;
+    router->_post(router->_ctx, event, true);
+}
+
+void BLESecureEventRouter::onPairingStatus(void *ctx, BLEPairingStatus status, BLEDevice *device)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_PAIRING_STATUS;
+    event.handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    event.status = status;
+    router->_post(router->_ctx, event, false);
+}
+
+void BLESecureEventRouter::onPairingResult(void *ctx, const BLEPairingResult &result, BLEDevice *device)
+{
+    BLESecureEventRouter *router = (BLESecureEventRouter *)ctx;
+    BLESecurityEvent event = {};
+    event.type = SECURITY_EVENT_PAIRING_RESULT;
+    event.handle = device ? device->getHandle() : HCI_CON_HANDLE_INVALID;
+    event.result = result;
+    router->_post(router->_ctx, event, false);
+}
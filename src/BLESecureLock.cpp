@@ -0,0 +1,116 @@
+/**
+ * BLESecureLock.cpp - BluetoothLock with optional hold and wait time profiling
+ */
+
+#include "BLESecureLock.h"
+#include "BLESecureNoHeap.h"
+
+static const char *const kSiteNames[LOCK_SITE_COUNT] = {
+    "begin",
+    "setSecurityLevel",
+    "allowReconnectionWithoutDatabaseEntry",
+    "setFixedPasskey",
+    "requestPairing",
+    "removeBonding",
+    "clearAllBondings",
+    "setPasskeyDisplayCallback",
+    "setPasskeyEntryCallback",
+    "setEnteredPasskey",
+    "setPairingStatusCallback",
+    "setPairingResultCallback",
+    "getLastPairingResult",
+    "setPairingStepHook",
+    "setNumericComparisonCallback",
+    "acceptNumericComparison",
+    "declinePairing",
+    "isEncrypted",
+    "setBLEDeviceConnectedCallback",
+    "setBLEDeviceDisconnectedCallback",
+    "setPairingRateLimit",
+    "getPairingRateLimitStats",
+    "resetPairingRateLimit",
+    "isAccessAllowed",
+    "setGATTCharacteristicWrite",
+    "setGATTCharacteristicRead",
+    "getSecurityLevel",
+    "getFirstDataLatency",
+    "getSecurityCounters",
+    "getSecurityLatencySamples",
+    "setReadHandler",
+    "getLinkInfo",
+    "getPairingTimingStats",
+    "startReconnectAdvertising",
+    "getReconnectStats",
+    "restrictToBondedDevices",
+    "refreshAcceptList",
+    "enableControllerAddressResolution",
+    "getAddressResolutionStats",
+    "setFastStartup",
+    "deferStartupTask",
+    "getStaleBondStats",
+    "setEventSubscriptions"};
+
+#if BLESECURE_LOCK_PROFILING
+// Written only with BluetoothLock held
+static BLELockProfile s_profiles[LOCK_SITE_COUNT];
+
+uint8_t BLESecureLock::_depth = 0;
+
+static int holdBucket(uint32_t holdNs)
+{
+    uint32_t us = holdNs / 1000;
+    if (us == 0)
+        return 0;
+    int bucket = 32 - __builtin_clz(us);
+    return bucket < BLESECURE_LOCK_HISTOGRAM_BUCKETS ? bucket : BLESECURE_LOCK_HISTOGRAM_BUCKETS - 1;
+}
+
+void BLESecureLock::record(uint8_t site, uint32_t waitTicks, uint32_t holdTicks)
+{
+    if (site >= LOCK_SITE_COUNT)
+        return;
+
+    uint32_t waitNs = BLESecureProfiler::ticksToNs(waitTicks);
+    uint32_t holdNs = BLESecureProfiler::ticksToNs(holdTicks);
+
+    BLELockProfile &profile = s_profiles[site];
+    profile.acquisitions++;
+    profile.totalHoldNs += holdNs;
+    profile.totalWaitNs += waitNs;
+    if (holdNs > profile.maxHoldNs)
+        profile.maxHoldNs = holdNs;
+    if (waitNs > profile.maxWaitNs)
+        profile.maxWaitNs = waitNs;
+    profile.holdHistogram[holdBucket(holdNs)]++;
+}
+#endif // BLESECURE_LOCK_PROFILING
+
+BLELockProfile BLESecureLock::getProfile(BLELockSite site)
+{
+    BLELockProfile profile;
+    memset(&profile, 0, sizeof(profile));
+#if BLESECURE_LOCK_PROFILING
+    if (site < LOCK_SITE_COUNT)
+    {
+        // A plain lock, reading the profile should not show up in it
+        BluetoothLock b;
+        profile = s_profiles[site];
+    }
+#else
+    (void)site;
+#endif
+    return profile;
+}
+
+void BLESecureLock::resetProfiles()
+{
+#if BLESECURE_LOCK_PROFILING
+    BluetoothLock b;
+    memset(s_profiles, 0, sizeof(s_profiles));
+#endif
+}
+
+const char *BLESecureLock::siteName(BLELockSite site)
+{
+    return site < LOCK_SITE_COUNT ? kSiteNames[site] : "unknown";
+}
@@ -0,0 +1,294 @@
+/**
+ * BLESecureNotifier.cpp - Queued notifications gated on link security
+ */
+
+#include "BLESecureNotifier.h"
+#include "BluetoothLock.h"
+#include "hci.h"
+#include "BLESecureNoHeap.h"
+
+// Per-record header: attribute handle and payload length
+#define NOTIFY_RECORD_HEADER 4
+
+static btstack_packet_callback_registration_t notifier_hci_registration;
+static btstack_packet_callback_registration_t notifier_sm_registration;
+
+BLESecureNotifierClass::BLESecureNotifierClass() : _registered(false)
+{
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
+    {
+        releaseQueue(&_queues[i]);
+    }
+}
+
+void BLESecureNotifierClass::begin()
+{
+    BluetoothLock b;
+    if (_registered)
+        return;
+
+    notifier_hci_registration.callback = eventHandler;
+    hci_add_event_handler(&notifier_hci_registration);
+    notifier_sm_registration.callback = eventHandler;
+    sm_add_event_handler(&notifier_sm_registration);
+    _registered = true;
+}
+
+bool BLESecureNotifierClass::notify(BLEDevice *device, uint16_t attHandle, const void *data, uint16_t length)
+{
+    if (!device || !data || length == 0)
+        return false;
+
+    // Larger records never fit, and the size sum below would wrap
+    if (length > BLESECURE_NOTIFY_QUEUE_SIZE - NOTIFY_RECORD_HEADER)
+        return false;
+
+    BluetoothLock b;
+    hci_con_handle_t handle = device->getHandle();
+    NotifyQueue *queue = findQueue(handle);
+    if (!queue)
+        queue = allocQueue(handle);
+    if (!queue)
+        return false;
+
+    uint16_t needed = NOTIFY_RECORD_HEADER + length;
+    if (needed > BLESECURE_NOTIFY_QUEUE_SIZE - queue->tail)
+    {
+        // Compact before giving up, the head may have moved since the last drain
+        uint16_t used = queue->tail - queue->head;
+        if (needed > BLESECURE_NOTIFY_QUEUE_SIZE - used)
+        {
+            queue->stats.droppedCount++;
+            queue->stats.droppedBytes += length;
+            return false;
+        }
+        memmove(queue->buffer, queue->buffer + queue->head, used);
+        queue->head = 0;
+        queue->tail = used;
+    }
+
+    uint8_t *record = queue->buffer + queue->tail;
+    little_endian_store_16(record, 0, attHandle);
+    little_endian_store_16(record, 2, length);
+    memcpy(record + NOTIFY_RECORD_HEADER, data, length);
+    queue->tail += needed;
+
+    queue->stats.queuedCount++;
+    queue->stats.queuedBytes += length;
+    if (queue->stats.queuedBytes > queue->stats.peakQueuedBytes)
+        queue->stats.peakQueuedBytes = queue->stats.queuedBytes;
+
+    scheduleDrain(queue);
+    return true;
+}
+
+uint16_t BLESecureNotifierClass::getFreeSpace(BLEDevice *device)
+{
+    if (!device)
+        return 0;
+
+    BluetoothLock b;
+    NotifyQueue *queue = findQueue(device->getHandle());
+    uint16_t used = queue ? queue->tail - queue->head : 0;
+    uint16_t free = BLESECURE_NOTIFY_QUEUE_SIZE - used;
+    return free > NOTIFY_RECORD_HEADER ? free - NOTIFY_RECORD_HEADER : 0;
+}
+
+void BLESecureNotifierClass::clear(BLEDevice *device)
+{
+    if (!device)
+        return;
+
+    BluetoothLock b;
+    NotifyQueue *queue = findQueue(device->getHandle());
+    if (!queue)
+        return;
+
+    queue->head = 0;
+    queue->tail = 0;
+    queue->stats.queuedCount = 0;
+    queue->stats.queuedBytes = 0;
+}
+
+BLENotifyQueueStats BLESecureNotifierClass::getStats(BLEDevice *device)
+{
+    BLENotifyQueueStats stats = {};
+    if (!device)
+        return stats;
+
+    BluetoothLock b;
+    NotifyQueue *queue = findQueue(device->getHandle());
+    if (queue)
+        stats = queue->stats;
+    return stats;
+}
+
+BLESecureNotifierClass::NotifyQueue *BLESecureNotifierClass::findQueue(hci_con_handle_t handle)
+{
+    if (handle == HCI_CON_HANDLE_INVALID)
+        return nullptr;
+
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
+    {
+        if (_queues[i].handle == handle)
+            return &_queues[i];
+    }
+    return nullptr;
+}
+
+BLESecureNotifierClass::NotifyQueue *BLESecureNotifierClass::allocQueue(hci_con_handle_t handle)
+{
+    if (handle == HCI_CON_HANDLE_INVALID)
+        return nullptr;
+
+    for (int i = 0; i < BLESECURE_MAX_CONNECTIONS; ++i)
+    {
+        if (_queues[i].handle == HCI_CON_HANDLE_INVALID)
+        {
+            releaseQueue(&_queues[i]);
+            _queues[i].handle = handle;
+            return &_queues[i];
+        }
+    }
+    return nullptr;
+}
+
+void BLESecureNotifierClass::releaseQueue(NotifyQueue *queue)
+{
+    queue->handle = HCI_CON_HANDLE_INVALID;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->drainPending = false;
+    memset(&queue->sendRequest, 0, sizeof(queue->sendRequest));
+    memset(&queue->stats, 0, sizeof(queue->stats));
+}
+
+void BLESecureNotifierClass::scheduleDrain(NotifyQueue *queue)
+{
+    // Security is checked when ATT calls back, by then BLESecure has seen the same SM event
+    if (queue->drainPending || queue->head == queue->tail)
+        return;
+
+    queue->sendRequest.callback = sendRequestHandler;
+    queue->sendRequest.context = queue;
+    if (att_server_request_to_send_notification(&queue->sendRequest, queue->handle) == ERROR_CODE_SUCCESS)
+    {
+        queue->drainPending = true;
+    }
+}
+
+void BLESecureNotifierClass::drain(NotifyQueue *queue)
+{
+    BLEDevice device(queue->handle);
+    bool encrypted = BLESecure.getSecurityLevel(&device) >= SECURITY_MEDIUM;
+    // ATT reports MTU 0 once the connection is gone
+    uint16_t mtu = att_server_get_mtu(queue->handle);
+    uint16_t maxPayload = mtu > 3 ? mtu - 3 : 0;
+    uint16_t burst = 0;
+    bool held = false;
+
+    while (queue->head < queue->tail)
+    {
+        uint8_t *record = queue->buffer + queue->head;
+        uint16_t attHandle = little_endian_read_16(record, 0);
+        uint16_t length = little_endian_read_16(record, 2);
+
+        // Hold everything behind the first record that may not go out yet, order is kept
+        if (!encrypted || !BLESecure.isAccessAllowed(&device, attHandle))
+        {
+            held = true;
+            break;
+        }
+
+        if (length <= maxPayload)
+        {
+            if (!att_server_can_send_packet_now(queue->handle))
+                break;
+            if (att_server_notify(queue->handle, attHandle, record + NOTIFY_RECORD_HEADER, length) != ERROR_CODE_SUCCESS)
+                break;
+
+            queue->stats.sentCount++;
+            queue->stats.sentBytes += length;
+            burst++;
+        }
+        else
+        {
+            // ATT would truncate it, drop it instead
+            queue->stats.droppedCount++;
+            queue->stats.droppedBytes += length;
+        }
+
+        queue->head += NOTIFY_RECORD_HEADER + length;
+        queue->stats.queuedCount--;
+        queue->stats.queuedBytes -= length;
+    }
+
+    if (queue->head == queue->tail)
+    {
+        queue->head = 0;
+        queue->tail = 0;
+    }
+
+    if (burst > queue->stats.maxBurst)
+        queue->stats.maxBurst = burst;
+
+    // Controller buffers ran out: continue on the next send opportunity.
+    // Held records wait for the next security event instead.
+    if (!held)
+        scheduleDrain(queue);
+}
+
+void BLESecureNotifierClass::sendRequestHandler(void *context)
+{
+    BLESecureLockHeldScope held;
+
+    NotifyQueue *queue = (NotifyQueue *)context;
+    queue->drainPending = false;
+    if (queue->handle != HCI_CON_HANDLE_INVALID)
+    {
+        BLESecureNotifier.drain(queue);
+    }
+}
+
+void BLESecureNotifierClass::eventHandler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    BLESecureLockHeldScope held;
+
+    BLESecureNotifier.handleEvent(packet_type, channel, packet, size);
+}
+
+void BLESecureNotifierClass::handleEvent(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size)
+{
+    if (packet_type != HCI_EVENT_PACKET)
+        return;
+
+    NotifyQueue *queue = nullptr;
+    switch (hci_event_packet_get_type(packet))
+    {
+    case HCI_EVENT_DISCONNECTION_COMPLETE:
+        // ATT forgets pending send requests with the connection
+        queue = findQueue(hci_event_disconnection_complete_get_connection_handle(packet));
+        if (queue)
+            releaseQueue(queue);
+        return;
+
+    // Security may now allow held notifications
+    case HCI_EVENT_ENCRYPTION_CHANGE:
+        queue = findQueue(hci_event_encryption_change_get_connection_handle(packet));
+        break;
+    case SM_EVENT_PAIRING_COMPLETE:
+        queue = findQueue(sm_event_pairing_complete_get_handle(packet));
+        break;
+    case SM_EVENT_REENCRYPTION_COMPLETE:
+        queue = findQueue(sm_event_reencryption_complete_get_handle(packet));
+        break;
+    default:
+        return;
+    }
+
+    if (queue)
+        scheduleDrain(queue);
+}
+
+// Create a global instance
+BLESecureNotifierClass BLESecureNotifier;
@@ -0,0 +1,200 @@
+/**
+ * BLESecureProfiler.cpp - Cost of SM events inside BLESecure and inside user callbacks
+ */
+
+#include "BLESecureProfiler.h"
+#include "BLESecureLock.h"
+#include "btstack_event.h"
+#include "pico/time.h"
+
+// The DWT cycle counter exists on the RP2350's Cortex-M33 cores, not on Hazard3
+#if defined(PICO_RP2350) && !defined(__riscv)
+#define PROFILE_USE_CYCLE_COUNTER 1
+#include "hardware/structs/m33.h"
+#include "hardware/clocks.h"
+#else
+#define PROFILE_USE_CYCLE_COUNTER 0
+#endif
+
+#include "BLESecureNoHeap.h"
+
+#if PROFILE_USE_CYCLE_COUNTER
+static uint32_t s_cyclesPerUs = 150;
+#endif
+
+uint32_t BLESecureProfiler::ticks()
+{
+#if PROFILE_USE_CYCLE_COUNTER
+    return m33_hw->dwt_cyccnt;
+#else
+    return time_us_32();
+#endif
+}
+
+uint32_t BLESecureProfiler::ticksToNs(uint32_t ticks)
+{
+#if PROFILE_USE_CYCLE_COUNTER
+    return (uint32_t)(((uint64_t)ticks * 1000) / s_cyclesPerUs);
+#else
+    return ticks > UINT32_MAX / 1000 ? UINT32_MAX : ticks * 1000;
+#endif
+}
+
+void BLESecureProfiler::startClock()
+{
+#if PROFILE_USE_CYCLE_COUNTER && (BLESECURE_LOCK_PROFILING || BLESECURE_EVENT_PROFILING)
+    s_cyclesPerUs = clock_get_hz(clk_sys) / 1000000;
+    if (s_cyclesPerUs == 0)
+        s_cyclesPerUs = 1;
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+}
+
+#if BLESECURE_EVENT_PROFILING
+// Written only from the BTstack context
+static BLEEventProfile s_eventProfiles[BLESECURE_PROFILED_SM_EVENTS];
+
+bool BLESecureProfiler::_inEvent = false;
+uint8_t BLESecureProfiler::_eventType = 0;
+uint32_t BLESecureProfiler::_callbackTicks = 0;
+
+void BLESecureProfiler::recordEvent(uint8_t smEventType, uint32_t totalTicks, uint32_t callbackTicks)
+{
+    uint8_t index = smEventType - SM_EVENT_JUST_WORKS_REQUEST;
+    if (index >= BLESECURE_PROFILED_SM_EVENTS)
+        return;
+
+    uint32_t libraryNs = ticksToNs(totalTicks > callbackTicks ? totalTicks - callbackTicks : 0);
+
+    BLEEventProfile &profile = s_eventProfiles[index];
+    profile.events++;
+    profile.libraryTotalNs += libraryNs;
+    if (libraryNs > profile.libraryMaxNs)
+        profile.libraryMaxNs = libraryNs;
+}
+
+void BLESecureProfiler::recordCallback(uint32_t ticks)
+{
+    // Callbacks outside an SM event (connection callbacks, API calls) are not attributed
+    if (!_inEvent)
+        return;
+
+    _callbackTicks += ticks;
+
+    uint8_t index = _eventType - SM_EVENT_JUST_WORKS_REQUEST;
+    if (index >= BLESECURE_PROFILED_SM_EVENTS)
+        return;
+
+    uint32_t callbackNs = ticksToNs(ticks);
+    BLEEventProfile &profile = s_eventProfiles[index];
+    profile.callbacks++;
+    profile.callbackTotalNs += callbackNs;
+    if (callbackNs > profile.callbackMaxNs)
+        profile.callbackMaxNs = callbackNs;
+}
+#endif // BLESECURE_EVENT_PROFILING
+
+BLEEventProfile BLESecureProfiler::getEventProfile(uint8_t smEventType)
+{
+    BLEEventProfile profile;
+    memset(&profile, 0, sizeof(profile));
+#if BLESECURE_EVENT_PROFILING
+    uint8_t index = smEventType - SM_EVENT_JUST_WORKS_REQUEST;
+    if (index < BLESECURE_PROFILED_SM_EVENTS)
+    {
+        BluetoothLock b;
+        profile = s_eventProfiles[index];
+    }
+#else
+    (void)smEventType;
+#endif
+    return profile;
+}
+
+void BLESecureProfiler::resetEventProfiles()
+{
+#if BLESECURE_EVENT_PROFILING
+    BluetoothLock b;
+    memset(s_eventProfiles, 0, sizeof(s_eventProfiles));
+#endif
+}
+
+static const char *smEventName(uint8_t smEventType)
+{
+    switch (smEventType)
+    {
+    case SM_EVENT_JUST_WORKS_REQUEST:
+        return "JUST_WORKS_REQUEST";
+    case SM_EVENT_PASSKEY_DISPLAY_NUMBER:
+        return "PASSKEY_DISPLAY_NUMBER";
+    case SM_EVENT_PASSKEY_DISPLAY_CANCEL:
+        return "PASSKEY_DISPLAY_CANCEL";
+    case SM_EVENT_PASSKEY_INPUT_NUMBER:
+        return "PASSKEY_INPUT_NUMBER";
+    case SM_EVENT_NUMERIC_COMPARISON_REQUEST:
+        return "NUMERIC_COMPARISON_REQUEST";
+    case SM_EVENT_IDENTITY_RESOLVING_STARTED:
+        return "IDENTITY_RESOLVING_STARTED";
+    case SM_EVENT_IDENTITY_RESOLVING_FAILED:
+        return "IDENTITY_RESOLVING_FAILED";
+    case SM_EVENT_IDENTITY_RESOLVING_SUCCEEDED:
+        return "IDENTITY_RESOLVING_SUCCEEDED";
+    case SM_EVENT_AUTHORIZATION_REQUEST:
+        return "AUTHORIZATION_REQUEST";
+    case SM_EVENT_AUTHORIZATION_RESULT:
+        return "AUTHORIZATION_RESULT";
+    case SM_EVENT_KEYPRESS_NOTIFICATION:
+        return "KEYPRESS_NOTIFICATION";
+    case SM_EVENT_IDENTITY_CREATED:
+        return "IDENTITY_CREATED";
+    case SM_EVENT_PAIRING_STARTED:
+        return "PAIRING_STARTED";
+    case SM_EVENT_PAIRING_COMPLETE:
+        return "PAIRING_COMPLETE";
+    case SM_EVENT_REENCRYPTION_STARTED:
+        return "REENCRYPTION_STARTED";
+    case SM_EVENT_REENCRYPTION_COMPLETE:
+        return "REENCRYPTION_COMPLETE";
+    default:
+        return nullptr;
+    }
+}
+
+void BLESecureProfiler::printEventProfileCSV(Print &out)
+{
+    out.println("event,count,library_total_ns,library_max_ns,library_mean_ns,callbacks,callback_total_ns,callback_max_ns");
+
+    for (int i = 0; i < BLESECURE_PROFILED_SM_EVENTS; ++i)
+    {
+        uint8_t eventType = SM_EVENT_JUST_WORKS_REQUEST + i;
+        BLEEventProfile profile = getEventProfile(eventType);
+        if (profile.events == 0)
+            continue;
+
+        const char *name = smEventName(eventType);
+        if (name)
+        {
+            out.print(name);
+        }
+        else
+        {
+            out.print("0x");
+            out.print(eventType, HEX);
+        }
+        out.print(',');
+        out.print(profile.events);
+        out.print(',');
+        out.print((unsigned long long)profile.libraryTotalNs);
+        out.print(',');
+        out.print(profile.libraryMaxNs);
+        out.print(',');
+        out.print((uint32_t)(profile.libraryTotalNs / profile.events));
+        out.print(',');
+        out.print(profile.callbacks);
+        out.print(',');
+        out.print((unsigned long long)profile.callbackTotalNs);
+        out.print(',');
+        out.println(profile.callbackMaxNs);
+    }
+}
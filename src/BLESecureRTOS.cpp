@@ -0,0 +1,149 @@
+/**
+ * BLESecureRTOS.cpp - FreeRTOS integration for BLESecure
+ */
+
+#include "BLESecureRTOS.h"
+#include "BLESecureNoHeap.h"
+
+#ifdef __FREERTOS
+
+BLESecureRTOSClass::BLESecureRTOSClass() : _task(nullptr),
+                                           _commandQueue(nullptr),
+                                           _eventQueue(nullptr),
+                                           _stats(),
+                                           _router(onEvent, this)
+{
+}
+
+bool BLESecureRTOSClass::begin()
+{
+    if (_task)
+        return true;
+
+    static_assert(BLESECURE_RTOS_PROMPT_SLOTS < BLESECURE_RTOS_EVENT_QUEUE_LEN, "the event queue needs slots for other events");
+
+    _commandQueue = xQueueCreateStatic(BLESECURE_RTOS_COMMAND_QUEUE_LEN, sizeof(BLESecurityCommand), _commandStorage, &_commandQueueBuffer);
+    _eventQueue = xQueueCreateStatic(BLESECURE_RTOS_EVENT_QUEUE_LEN, sizeof(BLESecurityEvent), _eventStorage, &_eventQueueBuffer);
+    if (!_commandQueue || !_eventQueue)
+        return false;
+
+    // Route every user-facing callback into the event queue
+    _router.attach();
+
+    _task = xTaskCreateStatic(ownerTask, "BLESecure", BLESECURE_RTOS_STACK_SIZE, this, BLESECURE_RTOS_PRIORITY, _taskStack, &_taskBuffer);
+    return _task != nullptr;
+}
+
+bool BLESecureRTOSClass::receiveEvent(BLESecurityEvent *event, TickType_t timeout)
+{
+    if (!event || !_eventQueue)
+        return false;
+
+    return xQueueReceive(_eventQueue, event, timeout) == pdTRUE;
+}
+
+bool BLESecureRTOSClass::requestPairing(BLEDevice *device, TickType_t timeout)
+{
+    if (!device)
+        return false;
+
+    return postCommand(SECURITY_COMMAND_REQUEST_PAIRING, device->getHandle(), 0, timeout);
+}
+
+bool BLESecureRTOSClass::removeBonding(BLEDevice *device, TickType_t timeout)
+{
+    if (!device)
+        return false;
+
+    return postCommand(SECURITY_COMMAND_REMOVE_BONDING, device->getHandle(), 0, timeout);
+}
+
+bool BLESecureRTOSClass::clearAllBondings(TickType_t timeout)
+{
+    return postCommand(SECURITY_COMMAND_CLEAR_ALL_BONDINGS, HCI_CON_HANDLE_INVALID, 0, timeout);
+}
+
+bool BLESecureRTOSClass::setEnteredPasskey(uint32_t passkey, TickType_t timeout)
+{
+    return postCommand(SECURITY_COMMAND_SET_ENTERED_PASSKEY, HCI_CON_HANDLE_INVALID, passkey, timeout);
+}
+
+bool BLESecureRTOSClass::acceptNumericComparison(bool accept, TickType_t timeout)
+{
+    return postCommand(SECURITY_COMMAND_ACCEPT_NUMERIC_COMPARISON, HCI_CON_HANDLE_INVALID, accept, timeout);
+}
+
+BLERTOSStats BLESecureRTOSClass::getStats()
+{
+    taskENTER_CRITICAL();
+    BLERTOSStats stats = _stats;
+    taskEXIT_CRITICAL();
+    return stats;
+}
+
+bool BLESecureRTOSClass::postCommand(uint8_t type, hci_con_handle_t handle, uint32_t value, TickType_t timeout)
+{
+    if (!_commandQueue)
+        return false;
+
+    BLESecurityCommand command = {type, handle, value};
+    bool posted = xQueueSendToBack(_commandQueue, &command, timeout) == pdTRUE;
+
+    taskENTER_CRITICAL();
+    if (posted)
+        _stats.commandsPosted++;
+    else
+        _stats.commandsDropped++;
+    taskEXIT_CRITICAL();
+    return posted;
+}
+
+void BLESecureRTOSClass::postEvent(const BLESecurityEvent &event, bool prompt)
+{
+    // Never block the BTstack context, a full queue drops the event. Only the
+    // BTstack context posts, so the free space cannot shrink before the send.
+    BaseType_t posted = pdFALSE;
+    if (prompt || uxQueueSpacesAvailable(_eventQueue) > BLESECURE_RTOS_PROMPT_SLOTS)
+        posted = xQueueSendToBack(_eventQueue, &event, 0);
+    UBaseType_t queued = uxQueueMessagesWaiting(_eventQueue);
+
+    // Nobody will answer a dropped prompt, fail the pairing now rather than at the SM timeout
+    if (posted != pdTRUE && prompt)
+        BLESecure.declinePairing();
+
+    taskENTER_CRITICAL();
+    if (posted == pdTRUE)
+        _stats.eventsPosted++;
+    else
+        _stats.eventsDropped++;
+    if (posted != pdTRUE && prompt)
+        _stats.promptsDeclined++;
+    if (queued > _stats.peakEventsQueued)
+        _stats.peakEventsQueued = queued;
+    taskEXIT_CRITICAL();
+}
+
+void BLESecureRTOSClass::ownerTask(void *param)
+{
+    BLESecureRTOSClass *self = (BLESecureRTOSClass *)param;
+    BLESecurityCommand command;
+
+    // The only task besides BTstack itself that takes BluetoothLock for BLESecure
+    for (;;)
+    {
+        if (xQueueReceive(self->_commandQueue, &command, portMAX_DELAY) == pdTRUE)
+        {
+            BLESecureEventRouter::runCommand(command);
+        }
+    }
+}
+
+void BLESecureRTOSClass::onEvent(void *ctx, const BLESecurityEvent &event, bool prompt)
+{
+    ((BLESecureRTOSClass *)ctx)->postEvent(event, prompt);
+}
+
+// Create a global instance
+BLESecureRTOSClass BLESecureRTOS;
+
+#endif // __FREERTOS
@@ -0,0 +1,206 @@
+/**
+ * BLESecureRateLimiter.cpp - Pairing admission control for BLESecure
+ */
+
+#include "BLESecureRateLimiter.h"
+#include "BLESecureNoHeap.h"
+
+// Defaults: bursts of 4 pairings per minute overall, 2 per peer every 30 s,
+// denied peers back off from 5 s up to 10 minutes.
+static const BLEPairingRateLimitConfig kDefaultRateLimitConfig = {
+    4,      // globalBurst
+    15000,  // globalRefillMs
+    2,      // peerBurst
+    30000,  // peerRefillMs
+    5000,   // denyBaseMs
+    600000  // denyMaxMs
+};
+
+// Time comparisons are done on differences so millis() wrap-around is harmless
+static inline bool timeBefore(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+BLESecureRateLimiter::BLESecureRateLimiter()
+{
+    configure(kDefaultRateLimitConfig);
+    resetStats();
+}
+
+void BLESecureRateLimiter::configure(const BLEPairingRateLimitConfig &config)
+{
+    _config = config;
+    if (_config.globalBurst == 0)
+        _config.globalBurst = 1;
+    if (_config.peerBurst == 0)
+        _config.peerBurst = 1;
+    reset();
+}
+
+void BLESecureRateLimiter::reset()
+{
+    memset(_peers, 0, sizeof(_peers));
+    _globalTokens = _config.globalBurst;
+    _globalLastRefillMs = 0;
+}
+
+void BLESecureRateLimiter::refill(uint8_t &tokens, uint32_t &lastRefillMs, uint8_t burst, uint32_t refillMs, uint32_t nowMs)
+{
+    if (tokens >= burst || refillMs == 0)
+    {
+        tokens = burst;
+        lastRefillMs = nowMs;
+        return;
+    }
+
+    uint32_t elapsed = nowMs - lastRefillMs;
+    uint32_t earned = elapsed / refillMs;
+    if (earned == 0)
+        return;
+
+    if (earned >= (uint32_t)(burst - tokens))
+    {
+        tokens = burst;
+        lastRefillMs = nowMs;
+    }
+    else
+    {
+        tokens += (uint8_t)earned;
+        // Keep the remainder so partial refill periods are not lost
+        lastRefillMs += earned * refillMs;
+    }
+}
+
+BLESecureRateLimiter::PeerEntry *BLESecureRateLimiter::findPeer(uint8_t addrType, const uint8_t addr[6])
+{
+    for (int i = 0; i < BLESECURE_RATE_LIMIT_PEERS; ++i)
+    {
+        PeerEntry &p = _peers[i];
+        if (p.used && p.addrType == addrType && memcmp(p.addr, addr, 6) == 0)
+            return &p;
+    }
+    return nullptr;
+}
+
+const BLESecureRateLimiter::PeerEntry *BLESecureRateLimiter::findPeer(uint8_t addrType, const uint8_t addr[6]) const
+{
+    return const_cast<BLESecureRateLimiter *>(this)->findPeer(addrType, addr);
+}
+
+BLESecureRateLimiter::PeerEntry *BLESecureRateLimiter::findOrAllocPeer(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs)
+{
+    PeerEntry *peer = findPeer(addrType, addr);
+    if (peer)
+        return peer;
+
+    // Prefer a free slot, then a slot that is not deny-listed and least recently seen
+    PeerEntry *victim = nullptr;
+    for (int i = 0; i < BLESECURE_RATE_LIMIT_PEERS; ++i)
+    {
+        PeerEntry &p = _peers[i];
+        if (!p.used)
+        {
+            victim = &p;
+            break;
+        }
+        bool denied = timeBefore(nowMs, p.deniedUntilMs);
+        if (denied)
+            continue;
+        if (!victim || timeBefore(p.lastSeenMs, victim->lastSeenMs))
+            victim = &p;
+    }
+
+    // Every slot is deny-listed: replace the one whose deny period ends first
+    if (!victim)
+    {
+        victim = &_peers[0];
+        for (int i = 1; i < BLESECURE_RATE_LIMIT_PEERS; ++i)
+        {
+            if (timeBefore(_peers[i].deniedUntilMs, victim->deniedUntilMs))
+                victim = &_peers[i];
+        }
+    }
+
+    memset(victim, 0, sizeof(*victim));
+    victim->used = 1;
+    victim->addrType = addrType;
+    memcpy(victim->addr, addr, 6);
+    victim->tokens = _config.peerBurst;
+    victim->lastRefillMs = nowMs;
+    victim->lastSeenMs = nowMs;
+    victim->deniedUntilMs = nowMs;
+    return victim;
+}
+
+void BLESecureRateLimiter::strike(PeerEntry *peer, uint32_t nowMs)
+{
+    uint32_t backoff = _config.denyBaseMs;
+    for (uint8_t i = 0; i < peer->strikes && backoff < _config.denyMaxMs; ++i)
+        backoff <<= 1;
+    if (backoff > _config.denyMaxMs)
+        backoff = _config.denyMaxMs;
+
+    if (peer->strikes < 31)
+        peer->strikes++;
+    peer->deniedUntilMs = nowMs + backoff;
+    _stats.denyListed++;
+}
+
+BLEPairingAdmission BLESecureRateLimiter::admit(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs)
+{
+    // Deny list is checked first and costs no tokens
+    PeerEntry *peer = findPeer(addrType, addr);
+    if (peer && timeBefore(nowMs, peer->deniedUntilMs))
+    {
+        peer->lastSeenMs = nowMs;
+        _stats.rejectedDenied++;
+        return PAIRING_REJECTED_DENIED;
+    }
+
+    refill(_globalTokens, _globalLastRefillMs, _config.globalBurst, _config.globalRefillMs, nowMs);
+    if (_globalTokens == 0)
+    {
+        _stats.rejectedGlobal++;
+        return PAIRING_REJECTED_GLOBAL;
+    }
+
+    if (!peer)
+        peer = findOrAllocPeer(addrType, addr, nowMs);
+    peer->lastSeenMs = nowMs;
+
+    refill(peer->tokens, peer->lastRefillMs, _config.peerBurst, _config.peerRefillMs, nowMs);
+    if (peer->tokens == 0)
+    {
+        strike(peer, nowMs);
+        _stats.rejectedPeer++;
+        return PAIRING_REJECTED_PEER;
+    }
+
+    peer->tokens--;
+    _globalTokens--;
+    _stats.admitted++;
+    return PAIRING_ADMITTED;
+}
+
+void BLESecureRateLimiter::recordFailure(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs)
+{
+    PeerEntry *peer = findOrAllocPeer(addrType, addr, nowMs);
+    peer->lastSeenMs = nowMs;
+    strike(peer, nowMs);
+}
+
+void BLESecureRateLimiter::recordSuccess(uint8_t addrType, const uint8_t addr[6])
+{
+    PeerEntry *peer = findPeer(addrType, addr);
+    if (!peer)
+        return;
+    peer->strikes = 0;
+    peer->deniedUntilMs = peer->lastSeenMs;
+}
+
+bool BLESecureRateLimiter::isDenied(uint8_t addrType, const uint8_t addr[6], uint32_t nowMs) const
+{
+    const PeerEntry *peer = findPeer(addrType, addr);
+    return peer && timeBefore(nowMs, peer->deniedUntilMs);
+}
@@ -0,0 +1,289 @@
+/**
+ * BLESecureStatsStore.cpp - Security statistics that survive reboots
+ */
+
+#include "BLESecureStatsStore.h"
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+#include "BLESecureNoHeap.h"
+
+// "BLSS"
+#define STATS_MAGIC 0x53534C42
+
+// Filesystem region from the arduino-pico linker script
+extern uint8_t _FS_start;
+extern uint8_t _FS_end;
+
+#define STATS_SLOTS ((uint16_t)(FLASH_SECTOR_SIZE / 64))
+
+BLESecureStatsStoreClass::BLESecureStatsStoreClass() : _started(false),
+                                                       _offset(0),
+                                                       _sector(0),
+                                                       _nextSlot(0),
+                                                       _sequence(0),
+                                                       _base(),
+                                                       _ramOffset(),
+                                                       _flushedEvents(0),
+                                                       _lastAppendMs(0),
+                                                       _recordsWritten(0),
+                                                       _sectorErases(0)
+{
+}
+
+bool BLESecureStatsStoreClass::begin(uint32_t flashOffset)
+{
+    static_assert(sizeof(Record) == 64, "journal records must stay 64 bytes");
+
+    if (flashOffset == 0)
+    {
+        if ((uint32_t)(&_FS_end - &_FS_start) < 2 * FLASH_SECTOR_SIZE)
+        {
+            Serial.println("BLESecureStatsStore: filesystem region too small, set board_build.filesystem_size");
+            return false;
+        }
+        flashOffset = (uint32_t)&_FS_start - XIP_BASE;
+    }
+    if (flashOffset % FLASH_SECTOR_SIZE)
+        return false;
+
+    _offset = flashOffset;
+
+    // The scan does not decide who may connect, with fast startup it waits for advertising
+    if (BLESecure.isStartupDeferred() && BLESecure.deferStartupTask(loadTask, this))
+        return true;
+    load();
+    return true;
+}
+
+void BLESecureStatsStoreClass::loadTask(void *ctx)
+{
+    static_cast<BLESecureStatsStoreClass *>(ctx)->load();
+}
+
+void BLESecureStatsStoreClass::load()
+{
+    memset(&_base, 0, sizeof(_base));
+    _sequence = 0;
+
+    // The newest valid record across both sectors holds the totals
+    const Record *newest = nullptr;
+    uint8_t newestSector = 0;
+    uint16_t newestSlot = 0;
+    for (uint8_t sector = 0; sector < 2; ++sector)
+    {
+        for (uint16_t slot = 0; slot < STATS_SLOTS; ++slot)
+        {
+            const Record *record = slotAt(sector, slot);
+            if (isValid(record) && (!newest || record->sequence > newest->sequence))
+            {
+                newest = record;
+                newestSector = sector;
+                newestSlot = slot;
+            }
+        }
+    }
+
+    if (newest)
+    {
+        _base = *newest;
+        _sequence = newest->sequence;
+        _sector = newestSector;
+
+        // Continue after the newest record, skipping slots torn by a reset
+        _nextSlot = newestSlot + 1;
+        while (_nextSlot < STATS_SLOTS && !isErased(slotAt(_sector, _nextSlot)))
+            _nextSlot++;
+    }
+    else
+    {
+        // Nothing usable, the first append erases sector 0
+        _sector = 1;
+        _nextSlot = STATS_SLOTS;
+    }
+
+    // Events since boot are not in the journal yet
+    _ramOffset = BLESecurityCounters();
+    _flushedEvents = 0;
+    _started = true;
+}
+
+void BLESecureStatsStoreClass::poll()
+{
+    if (!_started)
+        return;
+
+    // Both bounds together limit sector erases, also when a central keeps failing pairings
+    BLESecurityCounters counters = BLESecure.getSecurityCounters();
+    if (eventCount(counters) - _flushedEvents < BLESECURE_STATS_FLUSH_EVENTS)
+        return;
+    if (_recordsWritten > 0 && millis() - _lastAppendMs < BLESECURE_STATS_MIN_WRITE_MS)
+        return;
+    append(counters);
+}
+
+bool BLESecureStatsStoreClass::flush()
+{
+    if (!_started)
+        return false;
+
+    BLESecurityCounters counters = BLESecure.getSecurityCounters();
+    if (eventCount(counters) == _flushedEvents)
+        return true;
+    return append(counters);
+}
+
+BLEPersistentStats BLESecureStatsStoreClass::getStats()
+{
+    BLEPersistentStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (!_started)
+        return stats;
+
+    // Full-width sums, the saturating record fields are only for storage
+    BLESecurityCounters counters = BLESecure.getSecurityCounters();
+    stats.pairings = _base.pairings + counters.pairings - _ramOffset.pairings;
+    stats.pairingFailures = _base.pairingFailures + counters.pairingFailures - _ramOffset.pairingFailures;
+    stats.reencryptions = _base.reencryptions + counters.reencryptions - _ramOffset.reencryptions;
+    stats.reencryptionFailures = _base.reencryptionFailures + counters.reencryptionFailures - _ramOffset.reencryptionFailures;
+    stats.bondsEvicted = _base.bondsEvicted + counters.bondsEvicted - _ramOffset.bondsEvicted;
+    for (int i = 0; i < BLESECURE_FAILURE_REASONS; ++i)
+    {
+        stats.failureReasons[i] = _base.failureReasons[i] + counters.failureReasons[i] - _ramOffset.failureReasons[i];
+    }
+
+    uint32_t totalPairingMs = _base.totalPairingMs + counters.totalPairingMs - _ramOffset.totalPairingMs;
+    stats.averagePairingMs = stats.pairings ? totalPairingMs / stats.pairings : 0;
+    stats.recordsWritten = _recordsWritten;
+    stats.sectorErases = _sectorErases;
+    return stats;
+}
+
+void BLESecureStatsStoreClass::reset()
+{
+    if (!_started)
+        return;
+
+    eraseSector(0);
+    eraseSector(1);
+    memset(&_base, 0, sizeof(_base));
+    _sequence = 0;
+    _sector = 0;
+    _nextSlot = 0;
+
+    // Counting restarts now, earlier RAM counts are left out
+    _ramOffset = BLESecure.getSecurityCounters();
+    _flushedEvents = eventCount(_ramOffset);
+}
+
+void BLESecureStatsStoreClass::buildRecord(Record &record, const BLESecurityCounters &counters)
+{
+    memset(&record, 0xFF, sizeof(record));
+    record.magic = STATS_MAGIC;
+    record.sequence = _sequence + 1;
+    record.pairings = _base.pairings + counters.pairings - _ramOffset.pairings;
+    record.pairingFailures = _base.pairingFailures + counters.pairingFailures - _ramOffset.pairingFailures;
+    record.reencryptions = _base.reencryptions + counters.reencryptions - _ramOffset.reencryptions;
+    record.reencryptionFailures = _base.reencryptionFailures + counters.reencryptionFailures - _ramOffset.reencryptionFailures;
+    record.bondsEvicted = _base.bondsEvicted + counters.bondsEvicted - _ramOffset.bondsEvicted;
+    record.totalPairingMs = _base.totalPairingMs + counters.totalPairingMs - _ramOffset.totalPairingMs;
+    for (int i = 0; i < BLESECURE_FAILURE_REASONS; ++i)
+    {
+        uint32_t total = _base.failureReasons[i] + counters.failureReasons[i] - _ramOffset.failureReasons[i];
+        record.failureReasons[i] = total > 0xFFFF ? 0xFFFF : total;
+    }
+    record.crc = crc16((const uint8_t *)&record, offsetof(Record, crc));
+}
+
+bool BLESecureStatsStoreClass::append(const BLESecurityCounters &counters)
+{
+    Record record;
+    buildRecord(record, counters);
+
+    // Compaction: the newest totals start the other sector, the only erase the journal does
+    if (_nextSlot >= STATS_SLOTS)
+    {
+        uint8_t target = _sector ^ 1;
+        eraseSector(target);
+        _sector = target;
+        _nextSlot = 0;
+    }
+
+    uint16_t slot = _nextSlot++;
+    programSlot(_sector, slot, record);
+    if (!isValid(slotAt(_sector, slot)))
+        return false;
+
+    _sequence = record.sequence;
+    _flushedEvents = eventCount(counters);
+    _lastAppendMs = millis();
+    _recordsWritten++;
+    return true;
+}
+
+const BLESecureStatsStoreClass::Record *BLESecureStatsStoreClass::slotAt(uint8_t sector, uint16_t slot) const
+{
+    return (const Record *)(XIP_BASE + _offset + sector * FLASH_SECTOR_SIZE + slot * sizeof(Record));
+}
+
+bool BLESecureStatsStoreClass::isValid(const Record *record)
+{
+    return record->magic == STATS_MAGIC && record->crc == crc16((const uint8_t *)record, offsetof(Record, crc));
+}
+
+bool BLESecureStatsStoreClass::isErased(const Record *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (size_t i = 0; i < sizeof(Record); ++i)
+    {
+        if (bytes[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+uint16_t BLESecureStatsStoreClass::crc16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+uint32_t BLESecureStatsStoreClass::eventCount(const BLESecurityCounters &counters)
+{
+    return counters.pairings + counters.pairingFailures + counters.reencryptions +
+           counters.reencryptionFailures + counters.bondsEvicted;
+}
+
+void BLESecureStatsStoreClass::programSlot(uint8_t sector, uint16_t slot, const Record &record)
+{
+    // Flash is programmed in whole pages, 0xFF leaves the neighbouring slots untouched
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    uint32_t address = _offset + sector * FLASH_SECTOR_SIZE + slot * sizeof(Record);
+    uint32_t pageAddress = address & ~(uint32_t)(FLASH_PAGE_SIZE - 1);
+    memcpy(page + (address - pageAddress), &record, sizeof(record));
+
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_program(pageAddress, page, FLASH_PAGE_SIZE);
+    interrupts();
+    rp2040.resumeOtherCore();
+}
+
+void BLESecureStatsStoreClass::eraseSector(uint8_t sector)
+{
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_erase(_offset + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    interrupts();
+    rp2040.resumeOtherCore();
+    _sectorErases++;
+}
+
+// Create a global instance
+BLESecureStatsStoreClass BLESecureStatsStore;
@@ -0,0 +1,215 @@
+/**
+ * test_rate_limiter.cpp - Host test for BLESecureRateLimiter
+ *
+ * Floods the limiter with 10k pairing attempts and checks the global and
+ * per-peer bursts, the deny list and the exponential backoff. The limiter
+ * takes the time as an argument, so the test drives the clock itself.
+ */
+
+#include "BLESecureRateLimiter.h"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do                                                                      \
+    {                                                                       \
+        if (!(cond))                                                        \
+        {                                                                   \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static const uint32_t FLOOD = 10000;
+
+// Defaults of the library, spelled out so the expectations below follow from them
+static const BLEPairingRateLimitConfig kConfig = {
+    4,      // globalBurst
+    15000,  // globalRefillMs
+    2,      // peerBurst
+    30000,  // peerRefillMs
+    5000,   // denyBaseMs
+    600000  // denyMaxMs
+};
+
+// A distinct random address per attempt
+static void peerAddress(uint32_t n, uint8_t addr[6])
+{
+    addr[0] = 0x40;
+    addr[1] = 0x00;
+    addr[2] = (uint8_t)(n >> 24);
+    addr[3] = (uint8_t)(n >> 16);
+    addr[4] = (uint8_t)(n >> 8);
+    addr[5] = (uint8_t)n;
+}
+
+static uint32_t totalAttempts(const BLEPairingRateLimitStats &stats)
+{
+    return stats.admitted + stats.rejectedGlobal + stats.rejectedPeer + stats.rejectedDenied;
+}
+
+// 10k peers at the same instant: only the global burst gets through
+static void testGlobalBurst()
+{
+    BLESecureRateLimiter limiter;
+    limiter.configure(kConfig);
+
+    uint8_t addr[6];
+    for (uint32_t i = 0; i < FLOOD; ++i)
+    {
+        peerAddress(i, addr);
+        BLEPairingAdmission result = limiter.admit(0x01, addr, 1000);
+        CHECK(result == (i < kConfig.globalBurst ? PAIRING_ADMITTED : PAIRING_REJECTED_GLOBAL));
+    }
+
+    const BLEPairingRateLimitStats &stats = limiter.getStats();
+    CHECK(stats.admitted == kConfig.globalBurst);
+    CHECK(stats.rejectedGlobal == FLOOD - kConfig.globalBurst);
+    CHECK(totalAttempts(stats) == FLOOD);
+}
+
+// 10k peers, one every 10 ms: the burst plus one pairing per refill period
+static void testGlobalRefill()
+{
+    BLESecureRateLimiter limiter;
+    limiter.configure(kConfig);
+
+    uint8_t addr[6];
+    uint32_t start = 1000;
+    uint32_t now = start;
+    for (uint32_t i = 0; i < FLOOD; ++i)
+    {
+        now = start + i * 10;
+        peerAddress(i, addr);
+        limiter.admit(0x01, addr, now);
+    }
+
+    const BLEPairingRateLimitStats &stats = limiter.getStats();
+    CHECK(stats.admitted == kConfig.globalBurst + (now - start) / kConfig.globalRefillMs);
+    CHECK(totalAttempts(stats) == FLOOD);
+}
+
+// One peer hammering: its burst, one strike, then the deny list for the rest
+static void testPeerBurstAndDenyList()
+{
+    BLEPairingRateLimitConfig config = kConfig;
+    config.globalBurst = 255;
+    config.globalRefillMs = 0;
+
+    BLESecureRateLimiter limiter;
+    limiter.configure(config);
+
+    uint8_t addr[6];
+    peerAddress(7, addr);
+    uint32_t now = 1000;
+    for (uint8_t i = 0; i < config.peerBurst; ++i)
+        CHECK(limiter.admit(0x01, addr, now) == PAIRING_ADMITTED);
+    CHECK(limiter.admit(0x01, addr, now) == PAIRING_REJECTED_PEER);
+    CHECK(limiter.isDenied(0x01, addr, now));
+
+    for (uint32_t i = 0; i < FLOOD; ++i)
+        CHECK(limiter.admit(0x01, addr, now + i % config.denyBaseMs) == PAIRING_REJECTED_DENIED);
+
+    const BLEPairingRateLimitStats &stats = limiter.getStats();
+    CHECK(stats.admitted == config.peerBurst);
+    CHECK(stats.rejectedPeer == 1);
+    CHECK(stats.rejectedDenied == FLOOD);
+    CHECK(stats.denyListed == 1);
+
+    // The deny period ends after denyBaseMs
+    CHECK(!limiter.isDenied(0x01, addr, now + config.denyBaseMs));
+
+    // Same address with another type is another peer
+    CHECK(limiter.admit(0x00, addr, now) == PAIRING_ADMITTED);
+}
+
+// Each strike doubles the deny period up to denyMaxMs, a success starts over
+static void testBackoff()
+{
+    BLESecureRateLimiter limiter;
+    limiter.configure(kConfig);
+
+    uint8_t addr[6];
+    peerAddress(42, addr);
+    uint32_t now = 1000;
+    uint32_t expected = kConfig.denyBaseMs;
+    for (int strike = 0; strike < 20; ++strike)
+    {
+        limiter.recordFailure(0x01, addr, now);
+        CHECK(limiter.isDenied(0x01, addr, now + expected - 1));
+        CHECK(!limiter.isDenied(0x01, addr, now + expected));
+
+        now += expected;
+        expected = expected * 2 > kConfig.denyMaxMs ? kConfig.denyMaxMs : expected * 2;
+    }
+    CHECK(expected == kConfig.denyMaxMs);
+    CHECK(limiter.getStats().denyListed == 20);
+
+    limiter.recordSuccess(0x01, addr);
+    CHECK(!limiter.isDenied(0x01, addr, now));
+    limiter.recordFailure(0x01, addr, now);
+    CHECK(limiter.isDenied(0x01, addr, now + kConfig.denyBaseMs - 1));
+    CHECK(!limiter.isDenied(0x01, addr, now + kConfig.denyBaseMs));
+}
+
+// 10k other peers cycling through the table must not evict a deny-listed peer
+static void testDenyListSurvivesFlood()
+{
+    BLEPairingRateLimitConfig config = kConfig;
+    config.globalBurst = 255;
+    config.globalRefillMs = 0;
+
+    BLESecureRateLimiter limiter;
+    limiter.configure(config);
+
+    uint8_t denied[6];
+    peerAddress(0xFFFFFFFF, denied);
+    uint32_t now = 1000;
+    limiter.recordFailure(0x01, denied, now);
+    limiter.recordFailure(0x01, denied, now);
+
+    uint8_t addr[6];
+    for (uint32_t i = 0; i < FLOOD; ++i)
+    {
+        peerAddress(i, addr);
+        CHECK(limiter.admit(0x01, addr, now + 1) == PAIRING_ADMITTED);
+    }
+
+    CHECK(limiter.isDenied(0x01, denied, now + 1));
+    CHECK(limiter.admit(0x01, denied, now + 1) == PAIRING_REJECTED_DENIED);
+    CHECK(limiter.getStats().admitted == FLOOD);
+}
+
+// millis() wraps after 49.7 days, deny periods across the wrap still end on time
+static void testWrapAround()
+{
+    BLESecureRateLimiter limiter;
+    limiter.configure(kConfig);
+
+    uint8_t addr[6];
+    peerAddress(3, addr);
+    uint32_t now = 0xFFFFFFFFu - 1000;
+    limiter.recordFailure(0x01, addr, now);
+    CHECK(limiter.isDenied(0x01, addr, now + kConfig.denyBaseMs - 1));
+    CHECK(!limiter.isDenied(0x01, addr, now + kConfig.denyBaseMs));
+}
+
+int main()
+{
+    testGlobalBurst();
+    testGlobalRefill();
+    testPeerBurstAndDenyList();
+    testBackoff();
+    testDenyListSurvivesFlood();
+    testWrapAround();
+
+    if (failures)
+    {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All rate limiter checks passed\n");
+    return 0;
+}